@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+BASIC++ (IB) benchmark harness.
+
+Builds ib.c with the two configurations the README documents
+(-Os for size, -O2 for speed), runs every bench/*.bas workload with
+each build in script mode (ib program.bas --run), and reports:
+
+- statements: the number of statements the workload executes
+  (counted once, with --profile-csv, outside the timed runs)
+- best time:  the fastest of --repeat timed runs (wall clock)
+- stmts/sec:  statements / best time
+- peak RSS:   the peak resident set size of one (untimed) run
+
+Usage (from the repository root):
+
+    python3 bench/bench.py [--repeat N] [--cc gcc] [--cflags="..."]
+
+Extra --cflags are added to both builds, e.g.
+--cflags=-DIB_COMPACT_STORAGE (note the "=", as the value starts with "-").
+Only the Python standard library is used. Peak RSS is measured by the
+small bench/peakrss.c helper, which needs a POSIX system (it is
+reported as n/a where the helper does not build).
+"""
+
+import argparse
+import glob
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(BENCH_DIR, os.pardir, "ib.c")
+
+BUILDS = [
+    ("-Os", ["-Wall", "-Os"]),
+    ("-O2", ["-Wall", "-O2"]),
+]
+
+
+def build(cc, name, flags, extra, out_dir):
+    """Compiles ib.c into out_dir and returns the executable's path."""
+    exe = os.path.join(out_dir, "ib" + name)
+    cmd = [cc] + flags + extra + ["-o", exe, SOURCE]
+    subprocess.check_call(cmd)
+    return exe
+
+
+def count_statements(exe, program, work_dir):
+    """Runs the program once with --profile-csv and sums the command hits."""
+    csv_path = os.path.join(work_dir, "profile.csv")
+    run(exe, program, work_dir, ["--profile-csv", csv_path])
+    total = 0
+    with open(csv_path) as csv:
+        for row in csv:
+            fields = row.strip().split(",")
+            if fields[0] == "command":
+                total += int(fields[2])
+    return total
+
+
+def run(exe, program, work_dir, extra=()):
+    """Runs one program in script mode; returns the wall time in seconds."""
+    cmd = [exe, program, "--run", "--lprint", os.path.join(work_dir, "lprint.out")]
+    cmd += list(extra)
+    start = time.perf_counter()
+    status = subprocess.call(cmd, stdout=subprocess.DEVNULL, cwd=work_dir)
+    elapsed = time.perf_counter() - start
+    if status != 0:
+        sys.exit("%s: %s exited with status %d" % (exe, program, status))
+    return elapsed
+
+
+def measure_peak_rss(peakrss, exe, program, work_dir):
+    """Runs the program once under bench/peakrss.c; returns its peak RSS in KB."""
+    if peakrss is None:
+        return None
+    cmd = [peakrss, exe, program, "--run",
+           "--lprint", os.path.join(work_dir, "lprint.out")]
+    result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                            cwd=work_dir)
+    for line in result.stderr.decode().splitlines():
+        if line.startswith("PEAKRSS "):
+            return int(line.split()[1])
+    return None
+
+
+def build_peakrss(cc, out_dir):
+    """Compiles the peak-RSS helper; returns None where it cannot build."""
+    exe = os.path.join(out_dir, "peakrss")
+    cmd = [cc, "-Wall", "-Os", "-o", exe, os.path.join(BENCH_DIR, "peakrss.c")]
+    if subprocess.call(cmd, stderr=subprocess.DEVNULL) != 0:
+        return None
+    return exe
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    parser.add_argument("--repeat", type=int, default=5,
+                        help="timed runs per workload and build (default 5)")
+    parser.add_argument("--cc", default=os.environ.get("CC", "gcc"),
+                        help="C compiler (default $CC or gcc)")
+    parser.add_argument("--cflags", default="",
+                        help="extra flags for both builds")
+    args = parser.parse_args()
+
+    programs = sorted(glob.glob(os.path.join(BENCH_DIR, "*.bas")))
+    work_dir = tempfile.mkdtemp(prefix="ib-bench-")
+    try:
+        exes = [(name, build(args.cc, name, flags, args.cflags.split(), work_dir))
+                for name, flags in BUILDS]
+        peakrss = build_peakrss(args.cc, work_dir)
+
+        print("%-16s %-5s %12s %12s %14s %10s" %
+              ("WORKLOAD", "BUILD", "STATEMENTS", "BEST (ms)", "STMTS/SEC", "PEAK RSS"))
+        for program in programs:
+            workload = os.path.splitext(os.path.basename(program))[0]
+            statements = count_statements(exes[0][1], program, work_dir)
+            for name, exe in exes:
+                best = min(run(exe, program, work_dir) for _ in range(args.repeat))
+                rss = measure_peak_rss(peakrss, exe, program, work_dir)
+                print("%-16s %-5s %12d %12.3f %14.0f %10s" %
+                      (workload, name, statements, best * 1000.0,
+                       statements / best if best > 0 else 0.0,
+                       "%d KB" % rss if rss is not None else "n/a"))
+    finally:
+        shutil.rmtree(work_dir)
+
+
+if __name__ == "__main__":
+    main()
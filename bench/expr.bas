@@ -0,0 +1,15 @@
+10 REM EXPRESSION-HEAVY ARITHMETIC (8-BIT WRAPAROUND INCLUDED), 10 * 100 * 100 TIMES
+15 LET K = 0
+20 LET A = 0
+30 LET B = 0
+40 LET C = ( A * 3 + B / 2 - 7 ) * 2
+50 LET D = ( C - A ) / ( B + 1 ) + A * B
+60 LET E = ( ( A + B ) * ( A - B ) + C * D ) / 3
+70 LET F = E * 5 - D * 3 + C * 2 - B + A / 4
+80 LET B = B + 1
+90 IF B < 100 THEN 40
+100 LET A = A + 1
+110 IF A < 100 THEN 30
+112 LET K = K + 1
+114 IF K < 10 THEN 20
+120 PRINT F
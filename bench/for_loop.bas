@@ -0,0 +1,8 @@
+10 REM FOR...NEXT LOOP: 100 * 100 * 100 ITERATIONS (AS GOTO_LOOP.BAS)
+20 FOR A = 1 TO 100
+30 FOR B = 1 TO 100
+40 FOR C = 1 TO 100
+50 NEXT C
+60 NEXT B
+70 NEXT A
+80 END
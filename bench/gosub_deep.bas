@@ -0,0 +1,13 @@
+10 REM GOSUB RECURSION TO THE FULL STACK DEPTH (STACK_SIZE = 64), 2000 TIMES
+20 LET A = 0
+30 LET B = 0
+40 LET D = 0
+50 GOSUB 200
+60 LET B = B + 1
+70 IF B < 100 THEN 40
+80 LET A = A + 1
+90 IF A < 20 THEN 30
+100 END
+200 LET D = D + 1
+210 IF D < 64 THEN GOSUB 200
+220 RETURN
@@ -0,0 +1,11 @@
+10 REM TIGHT GOTO LOOP: 100 * 100 * 100 ITERATIONS
+20 LET A = 0
+30 LET B = 0
+40 LET C = 0
+50 LET C = C + 1
+60 IF C < 100 THEN 50
+70 LET B = B + 1
+80 IF B < 100 THEN 40
+90 LET A = A + 1
+100 IF A < 100 THEN 30
+110 END
@@ -0,0 +1,20 @@
+10 REM BRANCH-HEAVY CODE: EVERY COMPARISON OPERATOR, TAKEN AND NOT TAKEN, 10 * 100 * 100 TIMES
+15 LET K = 0
+20 LET A = 0
+30 LET B = 0
+40 LET N = 0
+50 IF B = 50 THEN 70
+60 LET N = N + 1
+70 IF B <> 25 THEN 90
+80 LET N = N - 1
+90 IF B < 10 THEN 110
+100 IF B > 90 THEN 110
+110 IF A = B THEN 130
+120 IF A < B THEN 130
+130 LET B = B + 1
+140 IF B < 100 THEN 50
+150 LET A = A + 1
+160 IF A < 100 THEN 30
+162 LET K = K + 1
+164 IF K < 10 THEN 20
+170 PRINT N
@@ -0,0 +1,500 @@
+10 REM 500-LINE PROGRAM: MEASURES LOAD (READ, TOKENIZE, STORE), THEN A SHORT RUN
+20 LET A = A + 1
+30 LET B = ( A * 2 ) - B
+40 REM PADDING LINE 2
+50 IF A > 100 THEN 60
+60 REM PADDING LINE 4
+70 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+80 LET C = A / 3 + B
+90 GOSUB 9000
+100 LET A = A + 1
+110 LET B = ( A * 2 ) - B
+120 REM PADDING LINE 10
+130 IF A > 100 THEN 140
+140 REM PADDING LINE 12
+150 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+160 LET C = A / 3 + B
+170 GOSUB 9000
+180 LET A = A + 1
+190 LET B = ( A * 2 ) - B
+200 REM PADDING LINE 18
+210 IF A > 100 THEN 220
+220 REM PADDING LINE 20
+230 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+240 LET C = A / 3 + B
+250 GOSUB 9000
+260 LET A = A + 1
+270 LET B = ( A * 2 ) - B
+280 REM PADDING LINE 26
+290 IF A > 100 THEN 300
+300 REM PADDING LINE 28
+310 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+320 LET C = A / 3 + B
+330 GOSUB 9000
+340 LET A = A + 1
+350 LET B = ( A * 2 ) - B
+360 REM PADDING LINE 34
+370 IF A > 100 THEN 380
+380 REM PADDING LINE 36
+390 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+400 LET C = A / 3 + B
+410 GOSUB 9000
+420 LET A = A + 1
+430 LET B = ( A * 2 ) - B
+440 REM PADDING LINE 42
+450 IF A > 100 THEN 460
+460 REM PADDING LINE 44
+470 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+480 LET C = A / 3 + B
+490 GOSUB 9000
+500 LET A = A + 1
+510 LET B = ( A * 2 ) - B
+520 REM PADDING LINE 50
+530 IF A > 100 THEN 540
+540 REM PADDING LINE 52
+550 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+560 LET C = A / 3 + B
+570 GOSUB 9000
+580 LET A = A + 1
+590 LET B = ( A * 2 ) - B
+600 REM PADDING LINE 58
+610 IF A > 100 THEN 620
+620 REM PADDING LINE 60
+630 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+640 LET C = A / 3 + B
+650 GOSUB 9000
+660 LET A = A + 1
+670 LET B = ( A * 2 ) - B
+680 REM PADDING LINE 66
+690 IF A > 100 THEN 700
+700 REM PADDING LINE 68
+710 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+720 LET C = A / 3 + B
+730 GOSUB 9000
+740 LET A = A + 1
+750 LET B = ( A * 2 ) - B
+760 REM PADDING LINE 74
+770 IF A > 100 THEN 780
+780 REM PADDING LINE 76
+790 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+800 LET C = A / 3 + B
+810 GOSUB 9000
+820 LET A = A + 1
+830 LET B = ( A * 2 ) - B
+840 REM PADDING LINE 82
+850 IF A > 100 THEN 860
+860 REM PADDING LINE 84
+870 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+880 LET C = A / 3 + B
+890 GOSUB 9000
+900 LET A = A + 1
+910 LET B = ( A * 2 ) - B
+920 REM PADDING LINE 90
+930 IF A > 100 THEN 940
+940 REM PADDING LINE 92
+950 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+960 LET C = A / 3 + B
+970 GOSUB 9000
+980 LET A = A + 1
+990 LET B = ( A * 2 ) - B
+1000 REM PADDING LINE 98
+1010 IF A > 100 THEN 1020
+1020 REM PADDING LINE 100
+1030 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1040 LET C = A / 3 + B
+1050 GOSUB 9000
+1060 LET A = A + 1
+1070 LET B = ( A * 2 ) - B
+1080 REM PADDING LINE 106
+1090 IF A > 100 THEN 1100
+1100 REM PADDING LINE 108
+1110 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1120 LET C = A / 3 + B
+1130 GOSUB 9000
+1140 LET A = A + 1
+1150 LET B = ( A * 2 ) - B
+1160 REM PADDING LINE 114
+1170 IF A > 100 THEN 1180
+1180 REM PADDING LINE 116
+1190 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1200 LET C = A / 3 + B
+1210 GOSUB 9000
+1220 LET A = A + 1
+1230 LET B = ( A * 2 ) - B
+1240 REM PADDING LINE 122
+1250 IF A > 100 THEN 1260
+1260 REM PADDING LINE 124
+1270 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1280 LET C = A / 3 + B
+1290 GOSUB 9000
+1300 LET A = A + 1
+1310 LET B = ( A * 2 ) - B
+1320 REM PADDING LINE 130
+1330 IF A > 100 THEN 1340
+1340 REM PADDING LINE 132
+1350 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1360 LET C = A / 3 + B
+1370 GOSUB 9000
+1380 LET A = A + 1
+1390 LET B = ( A * 2 ) - B
+1400 REM PADDING LINE 138
+1410 IF A > 100 THEN 1420
+1420 REM PADDING LINE 140
+1430 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1440 LET C = A / 3 + B
+1450 GOSUB 9000
+1460 LET A = A + 1
+1470 LET B = ( A * 2 ) - B
+1480 REM PADDING LINE 146
+1490 IF A > 100 THEN 1500
+1500 REM PADDING LINE 148
+1510 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1520 LET C = A / 3 + B
+1530 GOSUB 9000
+1540 LET A = A + 1
+1550 LET B = ( A * 2 ) - B
+1560 REM PADDING LINE 154
+1570 IF A > 100 THEN 1580
+1580 REM PADDING LINE 156
+1590 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1600 LET C = A / 3 + B
+1610 GOSUB 9000
+1620 LET A = A + 1
+1630 LET B = ( A * 2 ) - B
+1640 REM PADDING LINE 162
+1650 IF A > 100 THEN 1660
+1660 REM PADDING LINE 164
+1670 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1680 LET C = A / 3 + B
+1690 GOSUB 9000
+1700 LET A = A + 1
+1710 LET B = ( A * 2 ) - B
+1720 REM PADDING LINE 170
+1730 IF A > 100 THEN 1740
+1740 REM PADDING LINE 172
+1750 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1760 LET C = A / 3 + B
+1770 GOSUB 9000
+1780 LET A = A + 1
+1790 LET B = ( A * 2 ) - B
+1800 REM PADDING LINE 178
+1810 IF A > 100 THEN 1820
+1820 REM PADDING LINE 180
+1830 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1840 LET C = A / 3 + B
+1850 GOSUB 9000
+1860 LET A = A + 1
+1870 LET B = ( A * 2 ) - B
+1880 REM PADDING LINE 186
+1890 IF A > 100 THEN 1900
+1900 REM PADDING LINE 188
+1910 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+1920 LET C = A / 3 + B
+1930 GOSUB 9000
+1940 LET A = A + 1
+1950 LET B = ( A * 2 ) - B
+1960 REM PADDING LINE 194
+1970 IF A > 100 THEN 1980
+1980 REM PADDING LINE 196
+1990 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2000 LET C = A / 3 + B
+2010 GOSUB 9000
+2020 LET A = A + 1
+2030 LET B = ( A * 2 ) - B
+2040 REM PADDING LINE 202
+2050 IF A > 100 THEN 2060
+2060 REM PADDING LINE 204
+2070 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2080 LET C = A / 3 + B
+2090 GOSUB 9000
+2100 LET A = A + 1
+2110 LET B = ( A * 2 ) - B
+2120 REM PADDING LINE 210
+2130 IF A > 100 THEN 2140
+2140 REM PADDING LINE 212
+2150 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2160 LET C = A / 3 + B
+2170 GOSUB 9000
+2180 LET A = A + 1
+2190 LET B = ( A * 2 ) - B
+2200 REM PADDING LINE 218
+2210 IF A > 100 THEN 2220
+2220 REM PADDING LINE 220
+2230 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2240 LET C = A / 3 + B
+2250 GOSUB 9000
+2260 LET A = A + 1
+2270 LET B = ( A * 2 ) - B
+2280 REM PADDING LINE 226
+2290 IF A > 100 THEN 2300
+2300 REM PADDING LINE 228
+2310 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2320 LET C = A / 3 + B
+2330 GOSUB 9000
+2340 LET A = A + 1
+2350 LET B = ( A * 2 ) - B
+2360 REM PADDING LINE 234
+2370 IF A > 100 THEN 2380
+2380 REM PADDING LINE 236
+2390 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2400 LET C = A / 3 + B
+2410 GOSUB 9000
+2420 LET A = A + 1
+2430 LET B = ( A * 2 ) - B
+2440 REM PADDING LINE 242
+2450 IF A > 100 THEN 2460
+2460 REM PADDING LINE 244
+2470 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2480 LET C = A / 3 + B
+2490 GOSUB 9000
+2500 LET A = A + 1
+2510 LET B = ( A * 2 ) - B
+2520 REM PADDING LINE 250
+2530 IF A > 100 THEN 2540
+2540 REM PADDING LINE 252
+2550 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2560 LET C = A / 3 + B
+2570 GOSUB 9000
+2580 LET A = A + 1
+2590 LET B = ( A * 2 ) - B
+2600 REM PADDING LINE 258
+2610 IF A > 100 THEN 2620
+2620 REM PADDING LINE 260
+2630 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2640 LET C = A / 3 + B
+2650 GOSUB 9000
+2660 LET A = A + 1
+2670 LET B = ( A * 2 ) - B
+2680 REM PADDING LINE 266
+2690 IF A > 100 THEN 2700
+2700 REM PADDING LINE 268
+2710 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2720 LET C = A / 3 + B
+2730 GOSUB 9000
+2740 LET A = A + 1
+2750 LET B = ( A * 2 ) - B
+2760 REM PADDING LINE 274
+2770 IF A > 100 THEN 2780
+2780 REM PADDING LINE 276
+2790 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2800 LET C = A / 3 + B
+2810 GOSUB 9000
+2820 LET A = A + 1
+2830 LET B = ( A * 2 ) - B
+2840 REM PADDING LINE 282
+2850 IF A > 100 THEN 2860
+2860 REM PADDING LINE 284
+2870 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2880 LET C = A / 3 + B
+2890 GOSUB 9000
+2900 LET A = A + 1
+2910 LET B = ( A * 2 ) - B
+2920 REM PADDING LINE 290
+2930 IF A > 100 THEN 2940
+2940 REM PADDING LINE 292
+2950 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+2960 LET C = A / 3 + B
+2970 GOSUB 9000
+2980 LET A = A + 1
+2990 LET B = ( A * 2 ) - B
+3000 REM PADDING LINE 298
+3010 IF A > 100 THEN 3020
+3020 REM PADDING LINE 300
+3030 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3040 LET C = A / 3 + B
+3050 GOSUB 9000
+3060 LET A = A + 1
+3070 LET B = ( A * 2 ) - B
+3080 REM PADDING LINE 306
+3090 IF A > 100 THEN 3100
+3100 REM PADDING LINE 308
+3110 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3120 LET C = A / 3 + B
+3130 GOSUB 9000
+3140 LET A = A + 1
+3150 LET B = ( A * 2 ) - B
+3160 REM PADDING LINE 314
+3170 IF A > 100 THEN 3180
+3180 REM PADDING LINE 316
+3190 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3200 LET C = A / 3 + B
+3210 GOSUB 9000
+3220 LET A = A + 1
+3230 LET B = ( A * 2 ) - B
+3240 REM PADDING LINE 322
+3250 IF A > 100 THEN 3260
+3260 REM PADDING LINE 324
+3270 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3280 LET C = A / 3 + B
+3290 GOSUB 9000
+3300 LET A = A + 1
+3310 LET B = ( A * 2 ) - B
+3320 REM PADDING LINE 330
+3330 IF A > 100 THEN 3340
+3340 REM PADDING LINE 332
+3350 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3360 LET C = A / 3 + B
+3370 GOSUB 9000
+3380 LET A = A + 1
+3390 LET B = ( A * 2 ) - B
+3400 REM PADDING LINE 338
+3410 IF A > 100 THEN 3420
+3420 REM PADDING LINE 340
+3430 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3440 LET C = A / 3 + B
+3450 GOSUB 9000
+3460 LET A = A + 1
+3470 LET B = ( A * 2 ) - B
+3480 REM PADDING LINE 346
+3490 IF A > 100 THEN 3500
+3500 REM PADDING LINE 348
+3510 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3520 LET C = A / 3 + B
+3530 GOSUB 9000
+3540 LET A = A + 1
+3550 LET B = ( A * 2 ) - B
+3560 REM PADDING LINE 354
+3570 IF A > 100 THEN 3580
+3580 REM PADDING LINE 356
+3590 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3600 LET C = A / 3 + B
+3610 GOSUB 9000
+3620 LET A = A + 1
+3630 LET B = ( A * 2 ) - B
+3640 REM PADDING LINE 362
+3650 IF A > 100 THEN 3660
+3660 REM PADDING LINE 364
+3670 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3680 LET C = A / 3 + B
+3690 GOSUB 9000
+3700 LET A = A + 1
+3710 LET B = ( A * 2 ) - B
+3720 REM PADDING LINE 370
+3730 IF A > 100 THEN 3740
+3740 REM PADDING LINE 372
+3750 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3760 LET C = A / 3 + B
+3770 GOSUB 9000
+3780 LET A = A + 1
+3790 LET B = ( A * 2 ) - B
+3800 REM PADDING LINE 378
+3810 IF A > 100 THEN 3820
+3820 REM PADDING LINE 380
+3830 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3840 LET C = A / 3 + B
+3850 GOSUB 9000
+3860 LET A = A + 1
+3870 LET B = ( A * 2 ) - B
+3880 REM PADDING LINE 386
+3890 IF A > 100 THEN 3900
+3900 REM PADDING LINE 388
+3910 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+3920 LET C = A / 3 + B
+3930 GOSUB 9000
+3940 LET A = A + 1
+3950 LET B = ( A * 2 ) - B
+3960 REM PADDING LINE 394
+3970 IF A > 100 THEN 3980
+3980 REM PADDING LINE 396
+3990 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4000 LET C = A / 3 + B
+4010 GOSUB 9000
+4020 LET A = A + 1
+4030 LET B = ( A * 2 ) - B
+4040 REM PADDING LINE 402
+4050 IF A > 100 THEN 4060
+4060 REM PADDING LINE 404
+4070 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4080 LET C = A / 3 + B
+4090 GOSUB 9000
+4100 LET A = A + 1
+4110 LET B = ( A * 2 ) - B
+4120 REM PADDING LINE 410
+4130 IF A > 100 THEN 4140
+4140 REM PADDING LINE 412
+4150 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4160 LET C = A / 3 + B
+4170 GOSUB 9000
+4180 LET A = A + 1
+4190 LET B = ( A * 2 ) - B
+4200 REM PADDING LINE 418
+4210 IF A > 100 THEN 4220
+4220 REM PADDING LINE 420
+4230 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4240 LET C = A / 3 + B
+4250 GOSUB 9000
+4260 LET A = A + 1
+4270 LET B = ( A * 2 ) - B
+4280 REM PADDING LINE 426
+4290 IF A > 100 THEN 4300
+4300 REM PADDING LINE 428
+4310 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4320 LET C = A / 3 + B
+4330 GOSUB 9000
+4340 LET A = A + 1
+4350 LET B = ( A * 2 ) - B
+4360 REM PADDING LINE 434
+4370 IF A > 100 THEN 4380
+4380 REM PADDING LINE 436
+4390 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4400 LET C = A / 3 + B
+4410 GOSUB 9000
+4420 LET A = A + 1
+4430 LET B = ( A * 2 ) - B
+4440 REM PADDING LINE 442
+4450 IF A > 100 THEN 4460
+4460 REM PADDING LINE 444
+4470 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4480 LET C = A / 3 + B
+4490 GOSUB 9000
+4500 LET A = A + 1
+4510 LET B = ( A * 2 ) - B
+4520 REM PADDING LINE 450
+4530 IF A > 100 THEN 4540
+4540 REM PADDING LINE 452
+4550 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4560 LET C = A / 3 + B
+4570 GOSUB 9000
+4580 LET A = A + 1
+4590 LET B = ( A * 2 ) - B
+4600 REM PADDING LINE 458
+4610 IF A > 100 THEN 4620
+4620 REM PADDING LINE 460
+4630 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4640 LET C = A / 3 + B
+4650 GOSUB 9000
+4660 LET A = A + 1
+4670 LET B = ( A * 2 ) - B
+4680 REM PADDING LINE 466
+4690 IF A > 100 THEN 4700
+4700 REM PADDING LINE 468
+4710 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4720 LET C = A / 3 + B
+4730 GOSUB 9000
+4740 LET A = A + 1
+4750 LET B = ( A * 2 ) - B
+4760 REM PADDING LINE 474
+4770 IF A > 100 THEN 4780
+4780 REM PADDING LINE 476
+4790 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4800 LET C = A / 3 + B
+4810 GOSUB 9000
+4820 LET A = A + 1
+4830 LET B = ( A * 2 ) - B
+4840 REM PADDING LINE 482
+4850 IF A > 100 THEN 4860
+4860 REM PADDING LINE 484
+4870 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4880 LET C = A / 3 + B
+4890 GOSUB 9000
+4900 LET A = A + 1
+4910 LET B = ( A * 2 ) - B
+4920 REM PADDING LINE 490
+4930 IF A > 100 THEN 4940
+4940 REM PADDING LINE 492
+4950 REM FILLER LINE WITH SOME TEXT TO MAKE IT A TYPICAL LENGTH
+4960 LET C = A / 3 + B
+4970 GOSUB 9000
+4980 LET A = A + 1
+8990 END
+9000 RETURN
@@ -0,0 +1,9 @@
+10 REM LPRINT-HEAVY LOGGING: 10000 VALUES
+20 LET A = 0
+30 LET B = 0
+40 LPRINT B
+50 LET B = B + 1
+60 IF B < 100 THEN 40
+70 LET A = A + 1
+80 IF A < 100 THEN 30
+90 END
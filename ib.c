@@ -44,12 +44,14 @@
  * =============================================================================
  *
  * 1. Do one thing and do it well:
- * This interpreter executes a minimal, 8-bit Integer BASIC. It does not
- * manage a GUI, edit files (beyond SAVE/LOAD), or perform complex OS tasks.
+ * This interpreter executes a minimal, 8-bit Integer BASIC (or a 16- or
+ * 32-bit one, with IB_INT16 or IB_INT32). It does not manage a GUI,
+ * edit files (beyond SAVE/LOAD), or perform complex OS tasks.
  *
  * 2. Write programs that work together:
  * This interpreter reads/writes plain text files (.bas, lprint.out),
  * allowing it to be scripted or have its output piped to other tools.
+ * (A binary .ibc program image is available as a fast-loading cache.)
  *
  * 3. Handle plain text streams:
  * The core I/O (PRINT, INPUT, SAVE, LOAD) is text-based, adhering
@@ -89,30 +91,113 @@
  *
  * gcc -Wall -g -o ib ib.c
  *
+ * 4.  For Capacity (Compact Program Storage):
+ * Defining IB_COMPACT_STORAGE stores each line in only as many bytes
+ * as it needs (see MEMORY LAYOUT below). It combines with any of the above.
+ *
+ * gcc -Wall -Os -DIB_COMPACT_STORAGE -o ib ib.c
+ *
+ * 5.  For Portability (Switch Dispatch):
+ * GCC builds run programs through a "computed goto" dispatch table.
+ * Defining IB_SWITCH_DISPATCH uses the portable `switch` instead,
+ * as every other compiler does (see IB_THREADED_DISPATCH below).
+ *
+ * gcc -Wall -O2 -DIB_SWITCH_DISPATCH -o ib ib.c
+ *
+ * 6.  For Embedded Targets (Static Memory):
+ * Defining IB_STATIC_MEMORY keeps all memory in static arrays, with
+ * no `malloc` at all, at the price of the --lines, --stack and
+ * --arena-bytes options (see HOW TO ADJUST MEMORY below).
+ *
+ * gcc -Wall -Os -DIB_STATIC_MEMORY -o ib ib.c
+ *
+ * 7.  For Embedding (Library):
+ * Defining IB_LIBRARY leaves out `main` and provides the small API
+ * declared in ib.h instead, for running any number of independent
+ * interpreters inside another program (see IB_LIBRARY below).
+ *
+ * gcc -Wall -O2 -c -DIB_LIBRARY ib.c
+ *
+ * 8.  For Parallel Batches (Threads):
+ * Defining IB_THREADS runs the programs of `ib --jobs N` on N POSIX
+ * threads at once (see IB_THREADS below). It needs -pthread.
+ *
+ * gcc -Wall -O2 -DIB_THREADS -pthread -o ib ib.c
+ *
+ * 9.  For Wider Numbers (16- or 32-bit Dialect):
+ * Defining IB_INT16 or IB_INT32 makes every value 16 or 32 bits wide,
+ * instead of 8 (see IB_INT16 below). It combines with any of the above.
+ *
+ * gcc -Wall -O2 -DIB_INT16 -o ib ib.c
+ *
  * =============================================================================
  *
  * MEMORY LAYOUT:
  *
- * The interpreter's "user memory" is defined by static, fixed-size
- * arrays. The total allocatable memory (with v5.0 defaults) is:
+ * The interpreter's "user memory" is a set of fixed-size areas, which
+ * are allocated once, at startup, as a single block (or, with
+ * IB_STATIC_MEMORY, are static arrays). The total allocatable
+ * memory (with v5.0 defaults) is:
  *
- * | Memory Area       | Constant      | Size         | Calculation (assuming 4-byte int)     | Total Size   |
- * | :---------------- | :------------ | :----------- | :------------------------------------ | :----------- |
- * | Program Storage   | MAX_LINES     | 500 lines    | 500 * (127 chars + 4 bytes for line#) | 64.0 KB      |
- * | Variable Storage  | NUM_VARIABLES | 26 vars      | 26 * 1 byte (signed char)             | 26 bytes     |
- * | GOSUB Stack       | STACK_SIZE    | 64 levels    | 64 * 4 bytes (int)                    | 256 bytes    |
- * | **Total**         |               |              |                                       | **~64.2 KB** |
+ * | Memory Area       | Constant           | Size         | Calculation (assuming 4-byte int)               | Total Size    |
+ * | :---------------- | :----------------- | :----------- | :---------------------------------------------- | :------------ |
+ * | Program Storage   | MAX_LINES          | 500 lines    | 500 * (127 chars + 190 tokens + 4 bytes line#)  | 158.2 KB      |
+ * | Variable Storage  | NUM_VARIABLES      | 26 vars      | 26 * 1 byte (signed char)                       | 26 bytes      |
+ * | GOSUB Stack       | STACK_SIZE         | 64 levels    | 64 * 8-byte GosubFrame (2 ints)                 | 512 bytes     |
+ * | FOR Loop Stack    | LOOP_STACK_SIZE    | 16 levels    | 16 * 24-byte LoopFrame (LP64)                   | 384 bytes     |
+ * | LOAD Sort Order   | MAX_LINES          | 500 slots    | 500 * 4 bytes (int)                             | 2.0 KB        |
+ * | Include List      | INCLUDE_LIMIT      | 16 names     | 16 * 127 chars (MAX_LINE_LEN)                   | 2.0 KB        |
+ * | Output Buffer     | OUTPUT_BUFFER_SIZE | 16,384 bytes | 16 * 1024 bytes                                 | 16.0 KB       |
+ * | Input Buffer      | INPUT_BUFFER_SIZE  | 16,384 bytes | 16 * 1024 bytes                                 | 16.0 KB       |
+ * | Profile Counters  | MAX_LINES          | 500 lines    | 500 * 16 bytes + 64 commands * 8 bytes (LP64)   | 8.3 KB        |
+ * | Trace Buffer      | TRACE_SIZE         | 64 entries   | 64 * 8-byte TraceEntry                          | 512 bytes     |
+ * | **Total**         |                    |              |                                                 | **~204 KB**   |
+ *
+ * Each line is stored twice: as text (for LIST and SAVE) and as
+ * compiled tokens (MAX_CODE_LEN bytes, for RUN). The token room is
+ * sized for the worst line of MAX_LINE_LEN characters, although a
+ * typical line's tokens need about a third of its text: building with
+ * -DIB_CODE_LEN=64 caps it (500 * 196-byte padded Line = 95.7 KB),
+ * and IB_COMPACT_STORAGE (below) stores only the bytes each line uses.
+ *
+ * IB_INT16 and IB_INT32 widen "Variable Storage" to 52 and 104 bytes,
+ * and a LoopFrame to 24 and 32 bytes (and IB_INT32 a TraceEntry to 12).
  *
  * The "xx kbytes Free" message at startup only reports the main
- * "Program Storage" (65,500 bytes / 1024 = 63 KB, via integer division).
+ * "Program Storage" (500 * 324-byte padded Line = 162,000 bytes
+ * / 1024 = 158 KB, via integer division).
+ *
+ * With IB_COMPACT_STORAGE, "Program Storage" and "LOAD Sort Order"
+ * are replaced by a byte arena and a small index:
+ *
+ * | Memory Area       | Constant           | Size         | Calculation                                     | Total Size    |
+ * | :---------------- | :----------------- | :----------- | :---------------------------------------------- | :------------ |
+ * | Program Arena     | PROGRAM_ARENA_SIZE | 49,152 bytes | 48 * 1024 bytes                                 | 48.0 KB       |
+ * | Line Index        | MAX_LINES          | 2000 lines   | 2000 * 8-byte LineIndex                         | 15.6 KB       |
+ * | Profile Counters  | MAX_LINES          | 2000 lines   | 2000 * 16 bytes + 64 commands * 8 bytes (LP64)  | 31.8 KB       |
+ *
+ * Each line then costs its text + tokens + 2 bytes, plus its index
+ * entry, so the same ~64 KB holds about four times as many typical
+ * lines. "xx kbytes Free" reports the arena (48 KB).
  *
  * --- HOW TO ADJUST MEMORY ---
  *
- * To change the memory limits, you must edit the #define constants
- * in the "--- Constants ---" section below:
+ * The number of lines, the GOSUB depth and (with IB_COMPACT_STORAGE)
+ * the arena size can be chosen when the interpreter starts, with no
+ * recompiling:
+ *
+ * ib --lines 2000 --stack 256 --arena-bytes 262144
  *
- * - To increase/decrease program memory, change MAX_LINES or MAX_LINE_LEN.
- * - To increase/decrease GOSUB depth, change STACK_SIZE.
+ * or with the IB_LINES, IB_STACK and IB_ARENA_BYTES environment
+ * variables (the command line wins). The defaults, the line length,
+ * and the sizes of an IB_STATIC_MEMORY build are set by editing the
+ * #define constants in the "--- Constants ---" section below:
+ *
+ * - To increase/decrease program memory, change MAX_LINES or MAX_LINE_LEN
+ * (MAX_CODE_LEN follows MAX_LINE_LEN automatically), or, with
+ * IB_COMPACT_STORAGE, PROGRAM_ARENA_SIZE.
+ * - To increase/decrease GOSUB depth, change STACK_SIZE
+ * (and, for FOR...NEXT nesting, LOOP_STACK_SIZE).
  * - NUM_VARIABLES is fixed at 26 (A-Z) and should not be changed
  * without modifying the variable storage logic.
  *
@@ -123,12 +208,26 @@
  * HOW TO STOP AN ENDLESS LOOP:
  *
  * If your BASIC program enters an endless loop (e.g., "10 GOTO 10"),
- * you can force-quit the interpreter by pressing:
+ * you can stop it by pressing:
  *
  * Ctrl+C
  *
- * This will send an interrupt signal (SIGINT), stop the program, and return you
- * to your command-line shell (POSIX or FreeDOS).
+ * This sends an interrupt signal (SIGINT). While a program is running,
+ * the interpreter catches it, stops the program with "BREAK IN 10",
+ * and returns you to the READY prompt, with your program still in
+ * memory. At the prompt itself, Ctrl+C quits to your command-line
+ * shell (POSIX or FreeDOS), as before.
+ *
+ * For unattended use, --max-steps N stops any RUN after N statements,
+ * and --timeout SECONDS after that much processor time.
+ * STATS shows what the programs have done so far (statements, jumps,
+ * GOSUB depth, ...), and --stats-json FILE writes the same counters,
+ * as JSON, when the interpreter exits.
+ * --trace (or TRACE ON) keeps the last TRACE_SIZE statements of each
+ * RUN in memory, and shows them on stderr when an error or a BREAK
+ * stops the program; TRACE shows them at any time.
+ * SNAPSHOT FILE saves the program, its variables and its GOSUB and FOR
+ * stacks; --restore FILE (or RESTORE FILE) carries on from there.
  *
  * =============================================================================
  */
@@ -145,6 +244,27 @@
 #include <string.h>   /* For strcmp, strncpy, strlen, strtok, memset (String ops) */
 #include <ctype.h>    /* For isdigit, isalpha, isspace (Character types) */
 #include <stddef.h>   /* For size_t (used by string.h etc.) */
+#include <limits.h>   /* For LONG_MAX, LONG_MIN (INPUT's number parser) */
+#include <time.h>     /* For clock, clock_gettime (the --profile timer, --timeout) */
+#include <signal.h>   /* For signal, SIGINT (Ctrl+C stops a RUN with BREAK) */
+#include <unistd.h>   /* For isatty, STDOUT_FILENO (POSIX; also provided by DJGPP) */
+#include <sys/time.h> /* For gettimeofday (the wall time of a RUN, for STATS) */
+
+#ifdef IB_THREADS
+#include <pthread.h>  /* For pthread_create, mutexes (--jobs; POSIX threads) */
+#endif
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__DJGPP__) && !defined(IB_NO_MMAP)
+#define IB_MAPPED_LOAD /* See IB_MAPPED_LOAD below */
+#include <sys/mman.h> /* For mmap, munmap (LOAD maps the whole file) */
+#include <sys/stat.h> /* For fstat (the size of the file to map) */
+#endif
+
+#ifdef IB_LIBRARY
+#include "ib.h"       /* The embedding API: IB_Context, ib_create, ib_run, ... */
+#else
+typedef struct IB_Context IB_Context;
+#endif
 
 /*
  * Note: We provide our own portable, case-insensitive string compare
@@ -159,12 +279,124 @@
  * =============================================================================
  */
 
+/**
+ * @brief IB_COMPACT_STORAGE
+ * Define this (gcc -DIB_COMPACT_STORAGE ...) to store the program in
+ * a single byte arena of variable-length lines instead of fixed-size
+ * Line slots. See "--- Program Storage ---" below.
+ */
+
+/**
+ * @brief IB_STATIC_MEMORY
+ * Define this (gcc -DIB_STATIC_MEMORY ...) to place the program
+ * storage, the GOSUB stack and the --profile line counters in static
+ * arrays of the sizes below, for embedded targets: the interpreter
+ * then never calls `malloc` at all.
+ * Otherwise, they are all carved out of *one* block, allocated once
+ * at startup by `memory_init` (and never during a run). Its sizes
+ * default to the same constants, but can be chosen for each run with
+ * --lines, --stack and --arena-bytes (or the IB_LINES, IB_STACK and
+ * IB_ARENA_BYTES environment variables), with no recompiling.
+ */
+
+/**
+ * @brief IB_THREADED_DISPATCH
+ * When set, `dispatch_program` jumps from statement to statement
+ * through a table of label addresses ("computed goto", a GNU C
+ * extension) instead of a `switch`. It is set automatically for GCC
+ * and compatible compilers; define IB_SWITCH_DISPATCH to use the
+ * portable `switch` anyway (it is always used by other compilers).
+ */
+#if defined(__GNUC__) && !defined(IB_SWITCH_DISPATCH)
+#define IB_THREADED_DISPATCH
+#endif
+
+/**
+ * @brief IB_MAPPED_LOAD
+ * When set, LOAD, $MERGE and $INCLUDE map the whole program file
+ * into memory (`mmap`) and split it into lines in a single pass (see
+ * `scan_lines`), with no stdio call per line. It is set automatically
+ * on POSIX systems; define IB_NO_MMAP to read each line with `fgets`
+ * anyway, as is always done on FreeDOS (DJGPP has no `mmap`) and
+ * whenever a file cannot be mapped (a pipe, for instance).
+ */
+
+/**
+ * @brief IB_LIBRARY, IB_THREAD
+ * Define IB_LIBRARY (gcc -c -DIB_LIBRARY ib.c) to build the interpreter
+ * as a library, with no `main`, for programs that embed it. Its API
+ * (`ib_create`, `ib_load_string`, `ib_run`, `ib_destroy`) is declared
+ * in ib.h and described in README Section 2.7.
+ * IB_THREAD is the storage class which makes `ctx` a per-thread
+ * variable there: `__thread` for GCC and compatible compilers, or
+ * C11's `_Thread_local`. Without either, the library still works,
+ * but only one thread may use it at a time.
+ * GCC's "initial-exec" model keeps `ctx` one load away even in a
+ * shared library (-fPIC), where the default model would call
+ * `__tls_get_addr` on every access, and run programs half as fast.
+ */
+/**
+ * @brief IB_THREADS
+ * Define this (gcc -DIB_THREADS -pthread ...) to run the programs of
+ * `ib --jobs N` on N POSIX threads, each with its own IB_Context (so
+ * `ctx` is then a per-thread variable too). Without it, --jobs runs
+ * the same programs, with the same results, one after another.
+ * It needs `malloc`, so it cannot be combined with IB_STATIC_MEMORY.
+ */
+#if defined(IB_THREADS) && defined(IB_STATIC_MEMORY)
+#error "IB_THREADS cannot be combined with IB_STATIC_MEMORY"
+#endif
+
+#if defined(__GNUC__)
+#define IB_THREAD __thread __attribute__((tls_model("initial-exec")))
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define IB_THREAD _Thread_local
+#else
+#define IB_THREAD
+#endif
+
+/**
+ * @brief IB_INT16, IB_INT32, VALUE_BYTES, DIALECT_NAME
+ * The width of every BASIC value: the variables, the literals, and
+ * all arithmetic, which wraps around at that width. The default is
+ * the classic 8 bits (-128 to 127). Define IB_INT16 (gcc -DIB_INT16
+ * ...) for 16-bit values, or IB_INT32 for 32-bit ones; see `Value`.
+ * The width is fixed when the interpreter is compiled, so a build
+ * only ever carries the code for its own width.
+ * VALUE_BYTES is the size of a literal in the tokens (see TOK_NUM),
+ * and DIALECT_NAME is the name the startup banner shows.
+ */
+#if defined(IB_INT16) && defined(IB_INT32)
+#error "IB_INT16 and IB_INT32 cannot be combined"
+#endif
+
+#if defined(IB_INT32)
+#if INT_MAX < 2147483647
+#error "IB_INT32 needs an int of at least 32 bits"
+#endif
+#define VALUE_BYTES  4
+#define DIALECT_NAME "core32"
+#elif defined(IB_INT16)
+#define VALUE_BYTES  2
+#define DIALECT_NAME "core16"
+#else
+#define VALUE_BYTES  1
+#define DIALECT_NAME "core"
+#endif
+
 /**
  * @brief MAX_LINES
- * The maximum number of lines the BASIC program can have.
+ * The maximum number of lines the BASIC program can have
+ * (the default for --lines; see `max_lines`).
  * This directly impacts the "Program Storage" memory.
+ * The compact storage only spends a small index entry per line,
+ * so it allows many more lines in the same footprint.
  */
+#ifdef IB_COMPACT_STORAGE
+#define MAX_LINES 2000
+#else
 #define MAX_LINES 500
+#endif
 
 /**
  * @brief MAX_LINE_LEN
@@ -176,11 +408,31 @@
 
 /**
  * @brief STACK_SIZE
- * The maximum number of nested GOSUB calls.
+ * The maximum number of nested GOSUB calls
+ * (the default for --stack; see `stack_size`).
  * This directly impacts the "GOSUB Stack" memory.
  */
 #define STACK_SIZE 64
 
+/**
+ * @brief LOOP_STACK_SIZE
+ * The maximum number of nested FOR...NEXT loops (see `loop_stack`).
+ * This directly impacts the "FOR Loop Stack" memory.
+ */
+#define LOOP_STACK_SIZE 16
+
+/**
+ * @brief INCLUDE_LIMIT, INCLUDE_DEPTH_LIMIT
+ * INCLUDE_LIMIT is how many file names $INCLUDE remembers (see
+ * `included_files`); it directly impacts the "Include List" memory.
+ * Files past the limit are simply not remembered (they are read
+ * again by a later $INCLUDE). INCLUDE_DEPTH_LIMIT is how deeply
+ * $MERGE and $INCLUDE lines may nest, which stops a file that
+ * merges itself.
+ */
+#define INCLUDE_LIMIT       16
+#define INCLUDE_DEPTH_LIMIT 8
+
 /**
  * @brief NUM_VARIABLES
  * The number of variables (A-Z). This is fixed at 26.
@@ -194,338 +446,5707 @@
  */
 #define COMMAND_MAX_LEN 32
 
-
-/*
- * =============================================================================
- * --- Data Structures ---
- * =============================================================================
+/**
+ * @brief EXPR_STACK_SIZE
+ * The depth of the value stack used by `eval_expression`. Only a
+ * right-nested expression such as "A+(B+(C+...))" needs more than two
+ * entries, and each level of it costs at least three characters, so
+ * no line of MAX_LINE_LEN characters can come close to this.
  */
+#define EXPR_STACK_SIZE ((MAX_LINE_LEN + 1) / 2)
 
 /**
- * @brief Line
- * A structure to hold a single line of BASIC code in program storage.
- * It stores the line number and the text of the line.
+ * @brief MAX_CODE_LEN
+ * The size of the buffer holding the *tokenized* form of a line.
+ * Tokens are usually shorter than the text they replace (a keyword
+ * becomes one byte), but a few shapes such as "(1)+(1)+..." grow
+ * slightly, so we leave 50% headroom. A line that still does not fit
+ * compiles to a "LINE TOO COMPLEX" error.
+ * This directly impacts the "Program Storage" memory.
  */
-typedef struct
-{
-    int line_number;
-    char text[MAX_LINE_LEN];
-} Line;
+#define MAX_CODE_LEN (MAX_LINE_LEN + MAX_LINE_LEN / 2)
 
-
-/*
- * =============================================================================
- * --- Global Variables ---
- * =============================================================================
+/**
+ * @brief LINE_CODE_LEN
+ * The room for the tokens of each slot of the (fixed) program storage.
+ * By default, every line of MAX_LINE_LEN characters fits, whatever its
+ * shape. As typical tokens take about a third of the room of their
+ * text, a build which must hold its program in less memory may cap
+ * the slots, with -DIB_CODE_LEN=N (e.g., 64, which is more than most
+ * full-length lines need): a line whose tokens do not fit then
+ * compiles to "LINE TOO COMPLEX", as it would past MAX_CODE_LEN (and
+ * an image holding one is a "BAD PROGRAM IMAGE"). Direct-mode lines, and the compact storage's records (which are
+ * always the exact size of their tokens), are not capped.
  */
+#ifdef IB_CODE_LEN
+#if IB_CODE_LEN < 3 || IB_CODE_LEN > MAX_CODE_LEN
+#error "IB_CODE_LEN must be between 3 and MAX_CODE_LEN"
+#endif
+#define LINE_CODE_LEN IB_CODE_LEN
+#else
+#define LINE_CODE_LEN MAX_CODE_LEN
+#endif
 
-/*
- * Program Storage:
- * An array to hold all lines of the user's BASIC program.
- * Its size is (MAX_LINES * sizeof(Line)).
+/**
+ * @brief PROGRAM_ARENA_SIZE
+ * (IB_COMPACT_STORAGE only.) The number of bytes in the program arena
+ * (the default for --arena-bytes; see `arena_size`).
+ * Each line costs only what it uses: 2 bytes of header and terminator,
+ * its text, and its tokens. A typical "10 GOTO 20" line takes 16 bytes
+ * here, plus its entry in `line_index`.
+ * This directly impacts the "Program Storage" memory.
  */
-static Line program_storage[MAX_LINES];
+#define PROGRAM_ARENA_SIZE (48 * 1024)
 
 /**
- * @brief line_count
- * The number of lines *currently* stored in `program_storage`.
+ * @brief MAX_KEYWORDS
+ * The maximum number of keywords (core + modules) that can be
+ * registered in the `keyword_table`. Each keyword uses one opcode,
+ * so this may not exceed (256 - OP_BASE).
  */
-static int line_count = 0;
+#define MAX_KEYWORDS 64
 
 /**
- * @brief variables
- * A simple array for variables A-Z. 'A' maps to index 0, 'B' to 1, etc.
- * We use `signed char` as it's typically the smallest signed type (1 byte),
- * which gives us our 8-bit signed range (-128 to +127).
+ * @brief KEYWORD_HASH_SIZE
+ * The number of slots in the keyword hash index.
+ * This MUST be a power of two, and should be about twice MAX_KEYWORDS
+ * so that lookups almost never probe more than one slot.
  */
-static signed char variables[NUM_VARIABLES];
+#define KEYWORD_HASH_SIZE 128
 
 /**
- * @brief gosub_stack
- * A fixed-size stack to store return addresses (line indices) for GOSUB.
+ * @brief KW_DIRECT_ONLY
+ * Keyword flag: the command may only be used in direct mode
+ * (e.g., RUN, LIST). Using it in a program line is an error.
  */
-static int gosub_stack[STACK_SIZE];
+#define KW_DIRECT_ONLY 0x01
 
 /**
- * @brief stack_pointer
- * Points to the next *free* slot in the `gosub_stack`.
+ * @brief KW_WHOLE_LINE
+ * Keyword flag: the command's argument is everything up to the end
+ * of the line, ':' included (e.g., REM, or "LOAD C:PROG.BAS"), so no
+ * other statement can follow it on the same line.
  */
-static int stack_pointer = 0;
+#define KW_WHOLE_LINE 0x02
 
 /**
- * @brief program_counter
- * The *index* in `program_storage` of the line being executed.
- * This is only used when `RUN`ning a program.
+ * @brief TARGET_UNRESOLVED, TARGET_MISSING
+ * Special values for the cached line index of a TOK_LINE.
+ * UNRESOLVED: not looked up yet (a freshly compiled line).
+ * MISSING: looked up, and no such line exists.
  */
-static int program_counter = 0;
+#define TARGET_UNRESOLVED 0xFFFF
+#define TARGET_MISSING    0xFFFE
 
 /**
- * @brief is_running
- * A flag to control the `RUN` loop. Set to 0 by END, STOP, or an error.
+ * @brief LINES_LIMIT, STACK_LIMIT, ARENA_BYTES_LIMIT
+ * The largest values accepted by --lines, --stack and --arena-bytes.
+ * A line's index must fit in 16 bits below TARGET_MISSING (see
+ * TOK_LINE), and an arena offset must fit in an `unsigned int`.
  */
-static int is_running = 0;
+#define LINES_LIMIT       TARGET_MISSING
+#define STACK_LIMIT       65535L
+#define ARENA_BYTES_LIMIT (1024L * 1024L * 1024L)
 
 /**
- * @brief is_debug_mode
- * A flag set at startup by the --debug argument.
- * This will enable verbose logging of interpreter state.
+ * @brief LPRINT_FLUSH_INTERVAL
+ * LPRINT output is buffered, and written to the file when the
+ * program stops (END, STOP, an error, or the last line), on
+ * "LPRINT FLUSH", and when the interpreter exits.
+ * Set this to N to *also* write it out after every N LPRINTs
+ * (e.g., 1 to follow the file with "tail -f"). 0 = no interval.
  */
-static int is_debug_mode = 0;
+#define LPRINT_FLUSH_INTERVAL 0
 
 /**
- * @brief parser_ptr
- * A global string pointer used by the parser.
- * This points to the *current character* being parsed within a line.
- * This is a common and simple way to manage state in a recursive parser.
+ * @brief OUTPUT_BUFFER_SIZE
+ * The size of the console output buffer used when standard output
+ * is not a terminal (a file or a pipe), or in --batch mode.
+ * Output is then written in large blocks instead of line by line.
  */
-static char* parser_ptr;
+#define OUTPUT_BUFFER_SIZE 16384
 
 /**
- * @brief current_dialect_name
- * A global variable to hold the name of the dialect for the startup banner.
- * This allows modules to "re-brand" the interpreter.
+ * @brief LISTING_BUFFER_SIZE
+ * The size of the buffer in which LIST and SAVE format the program
+ * text (see `write_program_text`). It is written out in one block
+ * whenever it is nearly full, so a listing costs one write for every
+ * few dozen lines, instead of one `fprintf` per line.
  */
-static const char* current_dialect_name = "core";
+#define LISTING_BUFFER_SIZE 4096
 
 /**
- * @brief current_version
- * A global variable to hold the version string.
- * This is the "single source of truth" for the version number.
+ * @brief INPUT_BUFFER_SIZE
+ * The size of the stdio buffer for standard input when it is not a
+ * terminal (see `is_streamed_input`), so that a stream of INPUT data
+ * is read in large blocks.
  */
-static const char* current_version = "5.0";
+#define INPUT_BUFFER_SIZE 16384
 
-
-/*
- * =============================================================================
- * --- Forward Declarations ---
- * =============================================================================
+/**
+ * @brief IB_GETC
+ * Reads one character for INPUT. Where POSIX provides it, this is
+ * `getc_unlocked`, which skips the stream lock `getc` takes for
+ * every character (stdin is only ever read by the main thread).
  */
+#if defined(_POSIX_THREAD_SAFE_FUNCTIONS) && (_POSIX_THREAD_SAFE_FUNCTIONS - 0) > 0
+#define IB_GETC(file) getc_unlocked(file)
+#else
+#define IB_GETC(file) getc(file)
+#endif
 
-/*
- * This is a "table of contents" for all our functions.
- * It tells the C compiler about the "shape" of each function *before* it's
- * used. This allows us to define functions in a clean, logical order
- * without worrying about "implicit declaration" compile errors.
+/**
+ * @brief IMAGE_EXTENSION, IMAGE_VERSION, IMAGE_FORMAT, IMAGE_HEADER_LEN
+ * SAVE and LOAD use the binary program image format (see
+ * "--- Program Image Functions ---") for file names ending in
+ * IMAGE_EXTENSION. IMAGE_VERSION MUST be increased whenever the token
+ * encoding changes, so that old images are refused, not misread.
+ * IMAGE_FORMAT, the byte actually written, adds the value width
+ * (the literals of an IB_INT16 or IB_INT32 build are wider).
  */
+#define IMAGE_EXTENSION     ".ibc"
+#define IMAGE_VERSION       5
+#define IMAGE_FORMAT        (IMAGE_VERSION + 0x40 * (VALUE_BYTES / 2))
+#define IMAGE_HEADER_LEN    16
+#define IMAGE_CHECKSUM_SEED 2166136261UL
 
-/* --- Core Interpreter Functions --- */
-static void execute_statement(void);
-static void run_program(void);
-static void list_program(void);
-static void new_program(void);
-static void save_program(const char* filename);
-static void load_program(const char* filename);
+/**
+ * @brief SNAPSHOT_NO_RESUME
+ * The resume line of a snapshot made in direct mode, which restores
+ * the program and its variables but does not carry on running (see
+ * "--- Snapshot Functions ---").
+ */
+#define SNAPSHOT_NO_RESUME 0xFFFFFFFFUL
 
-/* --- Program Storage Functions --- */
-static int  find_line_index(int line_number);
-static void store_line(const char* line_str);
+/**
+ * @brief PROFILE_TOP_LINES
+ * The number of "hot" lines listed by the --profile report.
+ * (The --profile-csv file always lists every line that ran.)
+ */
+#define PROFILE_TOP_LINES 20
 
-/* --- Command Handlers (cmd_*.c) --- */
-static void cmd_print(void);
-static void cmd_lprint(void);
-static void cmd_input(void);
-static void cmd_let(void);
-static void cmd_goto(void);
-static void cmd_gosub(void);
-static void cmd_return(void);
-static void cmd_if(void);
-static void cmd_rem(void);
-static void cmd_end(void);
-static void cmd_beep(void);
-static void cmd_system(void);
-static void cmd_exit(void);
-static void cmd_quit(void);
-static void cmd_stub(const char* command);
+/**
+ * @brief TRACE_SIZE
+ * The number of statements kept by the execution trace (--trace, or
+ * TRACE ON): the most recent ones of the RUN, in a ring (see
+ * `TraceEntry`). It MUST be a power of two.
+ */
+#define TRACE_SIZE 64
 
-/* --- Parser Functions (parser.c) --- */
-static signed char parse_expression(void);
-static signed char parse_term(void);
-static signed char parse_number(void);
+/**
+ * @brief POLL_INTERVAL
+ * A running program checks for Ctrl+C, --max-steps and --timeout
+ * once every POLL_INTERVAL statements (see `poll_interrupts`), so
+ * that these checks cost (almost) nothing per statement.
+ */
+#define POLL_INTERVAL 1024
 
-/* --- Utility Functions (utils.c) --- */
-static void report_error(const char* message);
-static void skip_whitespace(void);
-static int  ib_stricmp(const char* s1, const char* s2);
+/**
+ * @brief JOBS_LIMIT
+ * The largest number of programs `ib --jobs N` runs at once.
+ */
+#define JOBS_LIMIT 256
 
 
 /*
  * =============================================================================
- * --- Core Interpreter ---
+ * --- Token Codes ---
  * =============================================================================
  */
 
-/**
- * @brief main
- * The main entry point for the IB interpreter.
- * It initializes the interpreter and runs the main REPL
- * (Read-Evaluate-Print Loop).
+/*
+ * Every stored line is "compiled" once, in store_line(), into a short
+ * string of byte tokens. `run_program` then executes these tokens
+ * instead of re-reading the text, so keywords, numbers and variable
+ * names are only ever lexed once.
  *
- * @param argc The count of command-line arguments.
- * @param argv An array of command-line argument strings.
- * @return 0 on successful exit.
+ * A compiled line is one or more statements, separated by TOK_COLON
+ * (a ':' in the text, as in "LET A = 1 : PRINT A"):
  *
- * We add `argc` and `argv` to check for command-line arguments
- * like `--debug`, as requested in the project specifications.
+ * [opcode] [operand tokens ...] TOK_COLON [opcode] [operands ...] TOK_EOL
+ *
+ * The original text is kept next to the tokens for LIST and SAVE.
+ * Expressions are stored in postfix order, with their constant parts
+ * already worked out (see `compile_expression`).
+ *
+ * Syntax errors are *not* reported at store time. Instead, the compiler
+ * emits a TOK_ERROR token at the point where the old text parser would
+ * have failed, and the error is raised when (and only if) execution
+ * reaches it. This keeps the classic "error on RUN" behavior.
  */
-int main(int argc, char *argv[])
+enum
 {
-    /*
-     * We use MAX_LINE_LEN for the input buffer, but add extra space
-     * (+20) to safely accommodate a line number and spaces, preventing
-     * a buffer overflow on user input.
-     */
-    char input_buffer[MAX_LINE_LEN + 20];
-    long total_program_bytes = sizeof(program_storage);
-    long total_program_kb = total_program_bytes / 1024;
-
-    /*
-     * A temporary buffer for the "immediate mode" line.
-     * We copy the user's input into this buffer because
-     * `execute_statement` will modify it (via `parser_ptr` and `strtok`).
-     */
-    char immediate_line[MAX_LINE_LEN + 20];
+    /* --- Operand tokens --- */
+    TOK_EOL = 0,    /* End of the compiled line */
+    TOK_NUM,        /* Numeric literal. Followed by VALUE_BYTES bytes (low first) */
+    TOK_STR,        /* String literal. Followed by a length byte, then the characters */
+    TOK_LINE,       /* Line number target. Followed by 2 bytes (low, high), then
+                       2 bytes of cached line *index* (a hint; see `cmd_goto`) */
+    TOK_ERROR,      /* Deferred syntax error. Followed by 1 byte (ERR_* code) */
+    TOK_ADD,        /* + */
+    TOK_SUB,        /* - */
+    TOK_MUL,        /* * */
+    TOK_DIV,        /* / */
+    TOK_LPAREN,     /* ( (no longer emitted: expressions are postfix) */
+    TOK_RPAREN,     /* ) (no longer emitted: expressions are postfix) */
+    TOK_EQ,         /* =  (IF comparison) */
+    TOK_NE,         /* <> (IF comparison) */
+    TOK_LT,         /* <  (IF comparison) */
+    TOK_GT,         /* >  (IF comparison) */
+    TOK_THEN,       /* THEN, followed by the nested statement */
+    TOK_FLUSH,      /* FLUSH (as in "LPRINT FLUSH") */
+    TOK_COLON,      /* : (another statement follows on the same line) */
+    TOK_TO,         /* TO (as in "FOR I = 1 TO 10") */
+    TOK_STEP,       /* STEP (as in "FOR I = 10 TO 1 STEP -1") */
+    TOK_VAR,        /* Variable A. TOK_VAR + 1 is B, ..., TOK_VAR + 25 is Z */
 
-    /* --- Check for --debug flag --- */
     /*
-     * This fulfills the requirement for a --debug flag.
-     * We loop through all arguments, not just the first one.
+     * --- Fused statements ("superinstructions") ---
+     * The compiler turns the two shapes which dominate counting loops
+     * into one opcode each (see `compile_let` and `compile_if`):
+     *
+     * LET X = X + k       ->  OP_LET_ADD [TOK_VAR X] [TOK_NUM k]
+     * IF X < k THEN n     ->  OP_IF_LT [TOK_VAR X] [TOK_NUM k] [OP_GOTO] [TOK_LINE n]
+     *
+     * ("X - k" is stored as "X + (-k)", and OP_IF_EQ, _NE and _GT
+     * cover the other comparisons.) Their operands are ordinary
+     * tokens, so `token_length` and `resolve_jump_targets` need no
+     * special cases.
      */
-    int i;
-    for (i = 1; i < argc; i++)
-    {
-        if (strcmp(argv[i], "--debug") == 0)
-        {
-            is_debug_mode = 1;
-            printf("[DEBUG] Debug mode enabled.\n");
-            break; /* Stop checking once found */
-        }
-    }
+    OP_LET_ADD = 0x38,
+    OP_IF_EQ,       /* The four OP_IF_* MUST stay in TOK_EQ..TOK_GT order */
+    OP_IF_NE,
+    OP_IF_LT,
+    OP_IF_GT,
 
-
-    /* Clear memory and prepare the interpreter for startup. */
-    new_program();
-
-    /* --- Startup Banner --- */
-    /* Note: We use %ld for 'long' to be portable. */
-    printf("BASIC++ (%s) v%s\n", current_dialect_name, current_version);
-    printf("%ld kbytes Free\n", total_program_kb);
-    printf("READY\n");
+    /* --- Special statements --- */
+    OP_NOP = 0x3F,  /* Empty statement (e.g., "IF A = 1 THEN") */
 
     /*
-     * --- Main REPL Loop ---
-     * This is the main Read-Evaluate-Print Loop.
-     * 1. READ:   It waits for user input (using fgets).
-     * 2. EVAL:   It figures out if it's a direct command or a stored line.
-     * 3. PRINT:  It executes the command (printing output) or stores the line.
-     * 4. LOOP:   It repeats.
+     * --- Statement opcodes (one per keyword) ---
+     * A keyword's opcode is OP_BASE + its index in `keyword_table`.
+     * The core keywords are listed here in table order; keywords
+     * added by modules take the opcodes that follow OP_RESTORE.
      */
-    while (1)
-    {
-        printf("> ");
-        fflush(stdout); /* Ensure prompt is displayed before input */
-
-        if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
-        {
-            /*
-             * User pressed Ctrl+D (end-of-file) or an error occurred.
-             * This is a clean way to exit the REPL.
-             */
-            printf("\n"); /* Print a newline to make it clean */
-            break; /* Exit loop and terminate program */
-        }
-
-        /* Remove newline character (both \n and \r) from input */
-        input_buffer[strcspn(input_buffer, "\r\n")] = 0;
-
-        /* --- Direct Mode or Stored Line? --- */
-        parser_ptr = input_buffer;  /* MUST set parser_ptr before skip_whitespace() */
-        skip_whitespace();
+    OP_BASE = 0x40,
+    OP_PRINT = OP_BASE,
+    OP_LPRINT,
+    OP_LET,
+    OP_INPUT,
+    OP_GOTO,
+    OP_GOSUB,
+    OP_RETURN,
+    OP_IF,
+    OP_REM,
+    OP_END,
+    OP_STOP,
+    OP_BEEP,
+    OP_RUN,
+    OP_LIST,
+    OP_NEW,
+    OP_SAVE,
+    OP_LOAD,
+    OP_SYSTEM,
+    OP_QUIT,
+    OP_EXIT,
+    OP_IMPORT,
+    OP_INCLUDE,
+    OP_MERGE,
+    OP_FOR,
+    OP_NEXT,
+    OP_STATS,
+    OP_TRACE,
+    OP_SNAPSHOT,
+    OP_RESTORE
+};
 
-        if (isdigit((unsigned char)*parser_ptr))
-        {
-            /*
-             * 1. STORED LINE
-             * The line starts with a digit, so it's a program line
-             * that needs to be stored.
-             */
-            store_line(input_buffer);
-        }
-        else if (*parser_ptr != '\0')
-        {
-            /*
-             * 2. DIRECT MODE
-             * The line does NOT start with a digit, and it's not empty.
-             * This is a direct command to be executed immediately.
-             */
-
-            /*
-             * We MUST copy the input line before executing.
-             * `execute_statement` modifies the string it's parsing,
-             * so we give it a temporary copy to work with.
-             */
-			strncpy(immediate_line, input_buffer, sizeof(immediate_line));
-			immediate_line[sizeof(immediate_line) - 1] = '\0';  /* Safety */
+/*
+ * Error codes carried by TOK_ERROR.
+ * They index the `error_messages` table below.
+ */
+enum
+{
+    ERR_UNKNOWN_COMMAND = 0,
+    ERR_EXPECTED_NUMBER,
+    ERR_INVALID_NUMBER,
+    ERR_INVALID_VARIABLE,
+    ERR_EXPECTED_RPAREN,
+    ERR_UNTERMINATED_STRING,
+    ERR_EXPECTED_VARIABLE_INPUT,
+    ERR_EXPECTED_VARIABLE_LET,
+    ERR_EXPECTED_EQUALS_LET,
+    ERR_EXPECTED_OPERATOR_IF,
+    ERR_EXPECTED_THEN,
+    ERR_EXPECTED_VARIABLE_FOR,
+    ERR_EXPECTED_EQUALS_FOR,
+    ERR_EXPECTED_TO,
+    ERR_EXPECTED_VARIABLE_NEXT,
+    ERR_LINE_TOO_COMPLEX
+};
 
-            /* Set the global parser pointer to the start of our copy */
-            parser_ptr = immediate_line;
 
-            /*
-             * Set the `is_running` flag. This tells our functions
-             * (like `report_error`) that we are in "execution mode"
-             * (even though it's just one line).
-             */
-            is_running = 1;
+/*
+ * =============================================================================
+ * --- Data Structures ---
+ * =============================================================================
+ */
 
-            /* Call the main dispatch function to run this single line. */
-            execute_statement();
+/**
+ * @brief Value, ValueWide
+ * `Value` is the type of every BASIC value (see IB_INT16, IB_INT32).
+ * Arithmetic is done in `ValueWide` and then cast back to `Value`,
+ * which is where the wraparound happens: `(signed char)128` becomes
+ * -128. For 32 bits, `ValueWide` is unsigned, since only unsigned
+ * arithmetic is allowed to wrap in C.
+ */
+#if defined(IB_INT32)
+typedef int Value;
+typedef unsigned long ValueWide;
+#elif defined(IB_INT16)
+typedef short Value;
+typedef long ValueWide;
+#else
+typedef signed char Value;
+typedef int ValueWide;
+#endif
 
-            /*
-             * The line is done, so we clear the flag.
-             * If an error occurred, `is_running` will already be 0,
-             * but it's safe to set it again.
-             */
-            is_running = 0;
-            printf("OK\n"); /* "OK" is the standard response in direct mode */
-            printf("READY\n");
-        }
-        else
-        {
-            /*
-             * 3. BLANK LINE
-             * The user just hit Enter. Do nothing and show the prompt.
-             */
-            printf("READY\n");
-        }
-    }
+/**
+ * @brief VALUE_ADD, VALUE_SUB, VALUE_MUL
+ * Wrapping arithmetic on two Values.
+ */
+#define VALUE_ADD(a, b) ((Value)((ValueWide)(a) + (ValueWide)(b)))
+#define VALUE_SUB(a, b) ((Value)((ValueWide)(a) - (ValueWide)(b)))
+#define VALUE_MUL(a, b) ((Value)((ValueWide)(a) * (ValueWide)(b)))
 
-    return 0; /* User exited the REPL */
-}
+/**
+ * @brief GET_VALUE, VALUE_LEN
+ * GET_VALUE reads the literal which follows a TOK_NUM (`p` points
+ * just after the TOK_NUM), low byte first; `emit_value` writes it.
+ * VALUE_LEN is the length of the whole token.
+ */
+#if VALUE_BYTES == 4
+#define GET_VALUE(p) ((Value)((ValueWide)(p)[0] | ((ValueWide)(p)[1] << 8) | \
+                              ((ValueWide)(p)[2] << 16) | ((ValueWide)(p)[3] << 24)))
+#elif VALUE_BYTES == 2
+#define GET_VALUE(p) ((Value)((p)[0] | ((p)[1] << 8)))
+#else
+#define GET_VALUE(p) ((Value)(signed char)(p)[0])
+#endif
+#define VALUE_LEN (1 + VALUE_BYTES)
 
+/**
+ * @brief Line
+ * A structure to hold a single line of BASIC code in program storage.
+ * It stores the line number, the text of the line (for LIST and SAVE),
+ * and the tokenized form of the line (for RUN).
+ */
+typedef struct
+{
+    int line_number;
+    char text[MAX_LINE_LEN];
+    unsigned char code[LINE_CODE_LEN];
+} Line;
 
 /**
- * @brief execute_statement
- * The main "dispatch" function for the interpreter.
+ * @brief LineIndex
+ * (IB_COMPACT_STORAGE only.) One entry of the compact storage's index.
+ * It locates a line's record in `program_arena`:
  *
- * This function reads the *first word* from the global `parser_ptr`
- * (which is assumed to be a command) and then "dispatches"
- * execution to the correct `cmd_...` handler function.
+ * - `offset`:      Where the record starts.
+ * - `line_number`: The BASIC line number (1 to 65535).
+ * - `size`:        The size of the record in bytes (0 for a slot
+ *                  that has just been opened by `open_slot`).
  *
- * This is the primary place to **ADD NEW COMMANDS**.
- * As per the architecture proposals, this large if/else block is the
- * component that will be replaced by a dynamic dispatch table.
+ * A record is laid out as:
+ *
+ * [text length] [text ...] '\0' [tokens ...] TOK_EOL
+ */
+typedef struct
+{
+    unsigned int offset;
+    unsigned short line_number;
+    unsigned short size;
+} LineIndex;
+
+/**
+ * @brief Keyword
+ * One entry in the keyword registration table.
+ *
+ * - `name`:    The command word, in upper case (e.g., "PRINT").
+ * - `compile`: Compiles the command's arguments from `parser_ptr`
+ *              (NULL if the command takes no arguments).
+ * - `handler`: Executes the command, reading its arguments
+ *              from `code_ptr`.
+ * - `flags`:   KW_DIRECT_ONLY and/or KW_WHOLE_LINE, or 0.
+ */
+typedef struct
+{
+    const char* name;
+    void (*compile)(void);
+    void (*handler)(void);
+    unsigned char flags;
+} Keyword;
+
+/**
+ * @brief GosubFrame
+ * One level of the GOSUB stack: where RETURN resumes.
+ *
+ * - `line`:   The index of the line *after* the GOSUB's line
+ *             (the `program_counter` at the time of the call).
+ * - `offset`: Where the GOSUB's line continues, as an offset into
+ *             its tokens (at the TOK_COLON after "GOSUB n"), or 0
+ *             if the GOSUB was the last statement on its line.
+ */
+typedef struct
+{
+    int line;
+    int offset;
+} GosubFrame;
+
+/**
+ * @brief LoopFrame
+ * One level of the FOR...NEXT loop stack: everything NEXT needs,
+ * worked out once by FOR, so that NEXT is an add, a compare and
+ * (while the loop goes on) a jump.
+ *
+ * - `body`:     The token just after the FOR statement: a TOK_COLON
+ *               if the body starts on the same line, or its TOK_EOL.
+ * - `line`:     The `program_counter` at the FOR (the index of the
+ *               line after the FOR's line).
+ * - `depth`:    The GOSUB depth (`stack_pointer`) at the FOR. A loop
+ *               belongs to its subroutine: NEXT and FOR only see the
+ *               loops of the current depth, and RETURN drops them.
+ * - `variable`: The index of the control variable (0 for A).
+ * - `limit`:    The value after TO.
+ * - `step`:     The value after STEP (1 if there is none).
+ *
+ * `body` points into the running program (or direct-mode line),
+ * which cannot change while it runs; the stack is emptied whenever
+ * a program or a direct-mode line starts.
+ */
+typedef struct
+{
+    const unsigned char* body;
+    int line;
+    int depth;
+    unsigned char variable;
+    Value limit;
+    Value step;
+} LoopFrame;
+
+/**
+ * @brief RunStats
+ * The always-on counters shown by STATS and written by --stats-json.
+ * They cover every RUN since the interpreter started (NEW does not
+ * clear them), and each costs at most an increment where it happens.
+ *
+ * - `runs`:               The number of RUNs.
+ * - `statements`:         Statements executed, in all RUNs (as counted
+ *                         for --max-steps; see `poll_interrupts`).
+ * - `last_statements`:    ...in the last RUN.
+ * - `jumps`:              GOTOs taken, including "IF ... THEN n" and
+ *                         the jump of every GOSUB (see `cmd_goto`).
+ * - `gosubs`:             GOSUBs made.
+ * - `max_gosub_depth`:    The deepest the GOSUB stack has been.
+ * - `line_lookups`:       Searches for a line number (`find_line_index`):
+ *                         a jump whose cached target was stale, mostly.
+ * - `lprint_writes`:      Values written by LPRINT.
+ * - `errors`:             Errors reported (BREAK included). Unlike
+ *                         `error_count`, which each job starts afresh,
+ *                         this is never reset.
+ * - `last_seconds`, `total_seconds`: The wall time of the last RUN,
+ *                         and of all of them.
+ */
+typedef struct
+{
+    unsigned long runs;
+    unsigned long statements;
+    unsigned long last_statements;
+    unsigned long jumps;
+    unsigned long gosubs;
+    unsigned long line_lookups;
+    unsigned long lprint_writes;
+    unsigned long errors;
+    int max_gosub_depth;
+    double last_seconds;
+    double total_seconds;
+} RunStats;
+
+/**
+ * @brief TraceEntry
+ * One statement in the execution trace ring (see `trace_record`),
+ * written as the statement starts, with no I/O at all.
+ *
+ * - `line_index`: The index of its line in the program storage.
+ * - `opcode`:     Its opcode (OP_PRINT, ...; or TOK_ERROR, OP_NOP).
+ * - `variable`:   The variable it assigned last (0 = A), or -1.
+ * - `value`:      ...and the value it assigned.
+ */
+typedef struct
+{
+    int line_index;
+    unsigned char opcode;
+    signed char variable;
+    Value value;
+} TraceEntry;
+
+
+#ifdef IB_THREADS
+
+/**
+ * @brief Job
+ * One program of a threaded batch, and where its output is kept until
+ * it is shown: `output` (PRINT, errors) and `lprint` (LPRINT) are
+ * temporary files, written by the worker which runs it.
+ * `done` is set (under the queue's lock) when `status` is known.
+ */
+typedef struct
+{
+    char* filename;
+    FILE* output;
+    FILE* lprint;
+    int status;
+    int done;
+} Job;
+
+/**
+ * @brief JobQueue
+ * The jobs of a threaded batch, shared by its workers. Every program
+ * is independent and runs to the end, so the "queue" is simply the
+ * index of the next job not yet taken: an idle worker takes the next
+ * one, and the load balances itself. `finished` is signalled each
+ * time a job is done.
+ */
+typedef struct
+{
+    Job* jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} JobQueue;
+
+#endif
+
+
+/*
+ * =============================================================================
+ * --- Global Variables ---
+ * =============================================================================
+ */
+
+/**
+ * @brief IB_Context
+ * Everything that belongs to *one* interpreter: its program, its
+ * variables and GOSUB stack, where it is executing, and its LPRINT
+ * "printer". Everything else (the keyword table, the command-line
+ * modes such as --debug) is shared by the whole process.
+ *
+ * The stand-alone interpreter has exactly one, `main_context`. The
+ * IB_LIBRARY build creates as many as the host asks for (`ib_create`),
+ * so that independent programs can run side by side, one per thread.
+ * The rest of the interpreter reaches the one it is running through
+ * `ctx` (see below), so none of it needs to know which build it is.
+ */
+struct IB_Context
+{
+#ifdef IB_COMPACT_STORAGE
+    /*
+     * Program Storage (compact):
+     * Every line's record, packed back to back in line-number order,
+     * with no padding. `line_index` holds one small entry per line,
+     * so lines can still be found by index (and binary-searched).
+     * Its size is (arena_size + max_lines * sizeof(LineIndex)).
+     */
+#ifdef IB_STATIC_MEMORY
+    unsigned char program_arena[PROGRAM_ARENA_SIZE];
+    LineIndex line_index[MAX_LINES];
+#else
+    unsigned char* program_arena;  /* Set up by `memory_init` */
+    LineIndex* line_index;
+#endif
+
+    /*
+     * arena_used:
+     * The number of bytes of `program_arena` holding records.
+     * Everything after it is free.
+     */
+    unsigned int arena_used;
+#else
+    /*
+     * Program Storage:
+     * An array to hold all lines of the user's BASIC program.
+     * Its size is (max_lines * sizeof(Line)).
+     *
+     * sort_order:
+     * Scratch space for `sort_program_storage`, used when LOAD reads
+     * a file whose lines are out of order. One slot number per line.
+     */
+#ifdef IB_STATIC_MEMORY
+    Line program_storage[MAX_LINES];
+    int sort_order[MAX_LINES];
+#else
+    Line* program_storage;  /* Set up by `memory_init` */
+    int* sort_order;
+#endif
+#endif
+
+    /*
+     * memory_block:
+     * The single allocation `memory_init` carved the areas above
+     * (and below) out of, for `memory_free` (NULL until then).
+     */
+    void* memory_block;
+
+    /*
+     * max_lines, stack_size, arena_size:
+     * The sizes of the program storage, in lines, of the GOSUB stack, in
+     * levels, and (IB_COMPACT_STORAGE only) of the program arena, in bytes.
+     * They are set before `memory_init` (--lines, --stack, --arena-bytes)
+     * and never change afterwards. With IB_STATIC_MEMORY, they are fixed.
+     */
+    int max_lines;
+    int stack_size;
+#ifdef IB_COMPACT_STORAGE
+    long arena_size;
+#endif
+
+    /*
+     * line_count:
+     * The number of lines *currently* stored in the program storage.
+     */
+    int line_count;
+
+    /*
+     * variables:
+     * A simple array for variables A-Z. 'A' maps to index 0, 'B' to 1, etc.
+     * By default `Value` is a `signed char`, as it's typically the smallest
+     * signed type (1 byte), which gives us our 8-bit signed range (-128 to
+     * +127); IB_INT16 and IB_INT32 widen it.
+     */
+    Value variables[NUM_VARIABLES];
+
+    /*
+     * gosub_stack:
+     * A fixed-size stack (`stack_size` levels) to store return
+     * addresses for GOSUB (see `GosubFrame`).
+     * `stack_pointer` points to the next *free* slot.
+     */
+#ifdef IB_STATIC_MEMORY
+    GosubFrame gosub_stack[STACK_SIZE];
+#else
+    GosubFrame* gosub_stack;  /* Set up by `memory_init` */
+#endif
+    int stack_pointer;
+
+    /*
+     * loop_stack:
+     * A fixed-size stack of the FOR...NEXT loops in progress
+     * (see `LoopFrame`). `loop_pointer` points to the next *free* slot.
+     */
+    LoopFrame loop_stack[LOOP_STACK_SIZE];
+    int loop_pointer;
+
+    /*
+     * program_counter:
+     * The *index* in `program_storage` of the next line to execute.
+     * `run_program` advances it *before* executing a line, so a GOTO,
+     * GOSUB or RETURN simply overwrites it.
+     * This is only used when `RUN`ning a program.
+     */
+    int program_counter;
+
+    /*
+     * is_running:
+     * A flag to control the `RUN` loop. Set to 0 by END, STOP, or an error.
+     */
+    int is_running;
+
+    /*
+     * error_count:
+     * The number of errors reported (by `report_error`) so far.
+     * `ib program.bas --run` uses it to choose its exit status.
+     */
+    int error_count;
+
+    /*
+     * max_steps, timeout_seconds:
+     * Set by --max-steps N and --timeout SECONDS (0 = no limit).
+     * A RUN which executes more than `max_steps` statements, or uses more
+     * than `timeout_seconds` of processor time (its own: see `run_clock`),
+     * is stopped with an error.
+     */
+    long max_steps;
+    long timeout_seconds;
+
+    /*
+     * poll_countdown, poll_chunk, run_steps, run_started:
+     * The state of `poll_interrupts` during a RUN: the statements left
+     * before the next check, the number the current count started from,
+     * the statements executed before it, and when the RUN started.
+     */
+    int poll_countdown;
+    int poll_chunk;
+    long run_steps;
+    double run_started;
+
+    /*
+     * profile_line_hits, profile_line_time, profile_command_hits:
+     * The --profile counters. The line counters are indexed like the
+     * program storage (a line's index cannot change during a RUN);
+     * the command counters are indexed like `keyword_table`.
+     */
+#ifdef IB_STATIC_MEMORY
+    unsigned long profile_line_hits[MAX_LINES];
+    clock_t profile_line_time[MAX_LINES];
+#else
+    unsigned long* profile_line_hits;  /* Only allocated with --profile */
+    clock_t* profile_line_time;
+#endif
+    unsigned long profile_command_hits[MAX_KEYWORDS];
+
+    /*
+     * stats:
+     * The counters behind STATS and --stats-json (see `RunStats`).
+     */
+    RunStats stats;
+
+    /*
+     * is_trace_mode:
+     * Set by --trace or TRACE ON. Every statement of a RUN is then noted
+     * in the `trace` ring, and the ring is written to stderr when an
+     * error or a BREAK stops the program (see `trace_dump`). It belongs
+     * to the context, like the ring, so that TRACE ON in one library
+     * context (or --jobs worker) leaves the others as they are.
+     */
+    int is_trace_mode;
+
+    /*
+     * trace, trace_count:
+     * The execution trace of the current (or last) RUN, while
+     * `is_trace_mode` is set: the statement numbered `trace_count`
+     * (counting from 0 at RUN) is kept in `trace[trace_count %
+     * TRACE_SIZE]`, so the ring always holds the most recent ones.
+     */
+    TraceEntry trace[TRACE_SIZE];
+    unsigned long trace_count;
+
+    /*
+     * parser_ptr:
+     * A string pointer used by the parser.
+     * This points to the *current character* being parsed within a line.
+     * This is a common and simple way to manage state in a recursive parser.
+     * It is `const`: the parser never writes to the text it reads, so it
+     * can work directly on the input buffer or on program storage.
+     */
+    const char* parser_ptr;
+
+    /*
+     * code_ptr:
+     * The runtime counterpart of `parser_ptr`.
+     * This points to the *current token* being executed within a
+     * compiled line. The command handlers and the expression evaluator
+     * all read tokens from here.
+     */
+    const unsigned char* code_ptr;
+
+    /*
+     * emit_ptr, emit_end, compile_failed, compile_overflow:
+     * The compiler's output state. `emit_ptr` points to the next free
+     * byte in the code buffer being written, and `emit_end` marks the
+     * last usable byte (one is always kept free for TOK_EOL).
+     * `compile_failed` is set once a TOK_ERROR has been emitted: nothing
+     * after it can ever execute, so the compiler stops there.
+     * `compile_overflow` is set if the tokens did not fit in the buffer.
+     */
+    unsigned char* emit_ptr;
+    unsigned char* emit_end;
+    int compile_failed;
+    int compile_overflow;
+
+    /*
+     * is_program_mode:
+     * A flag set by `run_program` while a *stored program* is executing
+     * (as opposed to a single direct-mode line). KW_DIRECT_ONLY commands
+     * are refused while it is set.
+     */
+    int is_program_mode;
+
+    /*
+     * lprint_path, lprint_file, lprint_count:
+     * The LPRINT "printer". `lprint_path` is the file it appends to
+     * (set with --lprint). `lprint_file` is opened by the first LPRINT
+     * and kept open until `lprint_close`, so a loop of LPRINTs costs one
+     * buffered write each, not an fopen/fclose pair.
+     * `lprint_count` counts LPRINTs since the last flush.
+     */
+    const char* lprint_path;
+    FILE* lprint_file;
+    int lprint_count;
+
+    /*
+     * included_files, include_count, include_depth:
+     * The files read into the program since the last NEW (by LOAD,
+     * $MERGE or $INCLUDE), so that $INCLUDE reads each file only once.
+     * `include_depth` counts the $MERGE and $INCLUDE lines being read
+     * (see `merge_file`).
+     */
+    char included_files[INCLUDE_LIMIT][MAX_LINE_LEN];
+    int include_count;
+    int include_depth;
+
+    /*
+     * load_file_name, load_file_line:
+     * The file being read by `read_lines` ("" for `ib_load_string`,
+     * NULL when none is), and the number of its line being read, so
+     * that a line which cannot be loaded is reported by its position
+     * (see `report_load_error`).
+     */
+    const char* load_file_name;
+    long load_file_line;
+
+    /*
+     * output, input, lprint_sink:
+     * Where the interpreter's console is: PRINT, prompts and error
+     * messages go to `output`, and INPUT reads from `input` (NULL:
+     * there is none, and INPUT ends the program as at end-of-file).
+     * They are stdout and stdin, except for a --jobs job, whose
+     * output is collected until it is its turn to be shown. Such a
+     * job also has an `lprint_sink`, which LPRINT writes to instead
+     * of opening `lprint_path` (see `run_jobs`).
+     */
+    FILE* output;
+    FILE* input;
+    FILE* lprint_sink;
+};
+
+/**
+ * @brief ctx
+ * The interpreter being run. Every access to the state above goes
+ * through it (e.g., `ctx->line_count`).
+ *
+ * In the stand-alone build it is simply the address of the static
+ * `main_context`, a constant, so it costs nothing at all. In the
+ * IB_LIBRARY build it is a per-thread pointer (IB_THREAD), which
+ * `ib_run` and the other API functions point at their context for
+ * the duration of the call (and, with IB_THREADS, each --jobs worker
+ * points at its own): two threads can each run a different
+ * interpreter at the same time without ever seeing each other's state.
+ */
+#if defined(IB_LIBRARY)
+static IB_THREAD IB_Context* ctx = NULL;
+#elif defined(IB_THREADS)
+static IB_Context main_context;
+static IB_THREAD IB_Context* ctx = &main_context; /* Each --jobs worker has its own */
+#else
+static IB_Context main_context;
+#define ctx (&main_context)
+#endif
+
+/*
+ * The accessors below hide which storage is in use. The rest of the
+ * interpreter only ever reaches a line through them.
+ */
+#ifdef IB_COMPACT_STORAGE
+#define LINE_NUMBER(i) ((int)ctx->line_index[i].line_number)
+#define LINE_TEXT(i)   ((char*)&ctx->program_arena[ctx->line_index[i].offset + 1])
+#define LINE_CODE(i)   (&ctx->program_arena[ctx->line_index[i].offset + 2 + \
+                                            ctx->program_arena[ctx->line_index[i].offset]])
+#else
+#define LINE_NUMBER(i) (ctx->program_storage[i].line_number)
+#define LINE_TEXT(i)   (ctx->program_storage[i].text)
+#define LINE_CODE(i)   (ctx->program_storage[i].code)
+#endif
+
+/**
+ * @brief is_debug_mode
+ * A flag set at startup by the --debug argument.
+ * This will enable verbose logging of interpreter state.
+ */
+static int is_debug_mode = 0;
+
+/**
+ * @brief is_batch_mode
+ * A flag set at startup by the --batch argument. The interpreter then
+ * runs silently, as a filter: no banner, "> " prompt, "OK" or "READY",
+ * and no alert bell on errors. Only the program's own output (and
+ * error messages) are written.
+ * The library is always silent, as is `ib program.bas --run`.
+ */
+#ifdef IB_LIBRARY
+static int is_batch_mode = 1;
+#else
+static int is_batch_mode = 0;
+#endif
+
+/**
+ * @brief is_buffered_output
+ * Set at startup when standard output is not a terminal, or in
+ * --batch mode. Console output is then collected in `output_buffer`
+ * and only flushed when INPUT waits for the user, when a program
+ * ends, or on exit (see `console_flush`).
+ * The library leaves the buffering of stdout to its host.
+ */
+#ifdef IB_LIBRARY
+static int is_buffered_output = 1;
+#else
+static int is_buffered_output = 0;
+#endif
+
+/**
+ * @brief is_streamed_input
+ * Set at startup when standard input is not a terminal (a file or a
+ * pipe). INPUT then prints no "?" prompt, never flushes the output
+ * to show one, and stdin is read through `input_stream_buffer`.
+ * The library never prompts, as it has no user.
+ */
+#ifdef IB_LIBRARY
+static int is_streamed_input = 1;
+#else
+static int is_streamed_input = 0;
+#endif
+
+/**
+ * @brief break_requested
+ * Set by the SIGINT (Ctrl+C) handler, `on_interrupt`, while a program
+ * is running. `poll_interrupts` then stops it with "BREAK IN n".
+ */
+static volatile sig_atomic_t break_requested = 0;
+
+/**
+ * @brief is_job_mode
+ * Set by `run_jobs` while `ib --jobs` runs its programs. The SIGINT
+ * handler is then installed once, for all of them, and a BREAK stops
+ * every one. QUIT only ends its own program.
+ */
+static int is_job_mode = 0;
+
+/**
+ * @brief is_profile_mode, profile_csv_path
+ * Set at startup by --profile (or --profile-csv FILE). `run_program`
+ * then counts and times every line, and `execute_statement` counts
+ * every command, and a report is written when the program ends:
+ * to stderr, or as CSV to `profile_csv_path` if it is set.
+ */
+static int is_profile_mode = 0;
+static const char* profile_csv_path = NULL;
+
+#ifndef IB_LIBRARY
+/**
+ * @brief stats_json_path
+ * Set at startup by --stats-json FILE: the interpreter's counters
+ * (see `RunStats`) are written there, as JSON, when it exits.
+ */
+static const char* stats_json_path = NULL;
+#endif
+
+/**
+ * @brief output_buffer
+ * The stdio buffer for standard output when `is_buffered_output` is set.
+ */
+#ifndef IB_LIBRARY
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+#endif
+
+/**
+ * @brief input_stream_buffer
+ * The stdio buffer for standard input when `is_streamed_input` is set.
+ */
+#ifndef IB_LIBRARY
+static char input_stream_buffer[INPUT_BUFFER_SIZE];
+#endif
+
+/**
+ * @brief end_of_line
+ * A lone TOK_EOL, shared by every interpreter. Whatever ends a line
+ * early (a GOTO, a false IF, ...) points `code_ptr` here, so the
+ * execution loops skip the rest of the line and fetch the line at
+ * `program_counter` next.
+ */
+static const unsigned char end_of_line = TOK_EOL;
+
+/**
+ * @brief error_messages
+ * The text for each ERR_* code carried by a TOK_ERROR token.
+ * The order MUST match the ERR_* enumeration.
+ */
+static const char* const error_messages[] =
+{
+    "UNKNOWN COMMAND",
+    "EXPECTED NUMBER",
+    "INVALID NUMBER",
+    "INVALID VARIABLE",
+    "EXPECTED ')'",
+    "UNTERMINATED STRING",
+    "EXPECTED VARIABLE FOR INPUT",
+    "EXPECTED VARIABLE FOR LET",
+    "EXPECTED '=' IN LET",
+    "EXPECTED OPERATOR IN IF",
+    "EXPECTED 'THEN' IN IF",
+    "EXPECTED VARIABLE FOR FOR",
+    "EXPECTED '=' IN FOR",
+    "EXPECTED 'TO' IN FOR",
+    "EXPECTED VARIABLE FOR NEXT",
+    "LINE TOO COMPLEX"
+};
+
+#ifndef IB_LIBRARY /* Only the stand-alone banner shows them */
+/**
+ * @brief current_dialect_name
+ * A global variable to hold the name of the dialect for the startup banner.
+ * This allows modules to "re-brand" the interpreter.
+ */
+static const char* current_dialect_name = DIALECT_NAME;
+
+/**
+ * @brief current_version
+ * A global variable to hold the version string.
+ * This is the "single source of truth" for the version number.
+ */
+static const char* current_version = "5.0";
+#endif
+
+
+/*
+ * =============================================================================
+ * --- Forward Declarations ---
+ * =============================================================================
+ */
+
+/*
+ * This is a "table of contents" for all our functions.
+ * It tells the C compiler about the "shape" of each function *before* it's
+ * used. This allows us to define functions in a clean, logical order
+ * without worrying about "implicit declaration" compile errors.
+ */
+
+/* --- Core Interpreter Functions --- */
+static void execute_statement(void);
+static void dispatch_program(int is_prime);
+static void run_program(int is_resume);
+static int  poll_interrupts(void);
+static double run_clock(void);
+#ifndef IB_LIBRARY
+static void on_interrupt(int signal_number);
+static void (*install_interrupt_handler(void))(int);
+#endif
+static void list_program(int first_line, int last_line);
+static int  write_program_text(FILE* file, int first_line, int last_line);
+static void new_program(void);
+static void save_program(const char* filename);
+static int  load_program(const char* filename);
+static void load_line(const char* line, int* highest_line, int* is_sorted);
+static void read_lines(FILE* file, const char* filename,
+                       int* highest_line, int* is_sorted);
+#ifdef IB_MAPPED_LOAD
+static void scan_lines(const char* text, size_t length,
+                       int* highest_line, int* is_sorted);
+#endif
+static int  merge_program(const char* filename, int is_include);
+static int  merge_file(const char* filename, int is_include,
+                       int* highest_line, int* is_sorted);
+static void remember_file(const char* filename);
+
+/* --- Program Storage Functions --- */
+static int  find_insert_index(int line_number);
+static int  find_line_index(int line_number);
+static int  split_line(const char* line_str, int* line_number, const char** text_part);
+static int  set_line(int index, int line_number, const char* text);
+static int  append_line(int line_number, const char* text);
+static void open_slot(int index);
+static void close_slot(int index);
+static void store_line(const char* line_str);
+static int  compare_load_order(const void* a, const void* b);
+static void sort_program_storage(void);
+static void resolve_jump_targets(void);
+static int  token_length(const unsigned char* token);
+#ifdef IB_COMPACT_STORAGE
+static void shift_records(int index, long delta);
+#endif
+
+/* --- Memory Functions --- */
+static void context_init(void);
+static int  memory_init(void);
+#ifndef IB_LIBRARY
+static int  memory_option(const char* name, const char* text);
+static int  parse_limit(const char* name, const char* text, long limit, long* value);
+#endif
+
+/* --- Batch Job Functions --- */
+#ifndef IB_LIBRARY
+static int  run_job(const char* filename);
+static void job_finished(const char* filename, int job_status, int* status);
+static int  read_manifest_line(FILE* file, char* buffer, int size);
+static int  run_jobs(const char* const* files, int file_count,
+                     const char* manifest, int worker_count);
+#ifdef IB_THREADS
+static void* job_worker(void* arg);
+static long show_file(FILE* file, FILE* out);
+static int  add_job(Job** jobs, int* count, int* capacity, const char* filename);
+#endif
+#endif
+
+/* --- Profiler Functions --- */
+static void profile_reset(void);
+static void profile_report(void);
+static void profile_write_csv(void);
+
+/* --- Statistics Functions --- */
+static double stats_clock(void);
+static void stats_run_finished(double started);
+#ifndef IB_LIBRARY
+static void stats_write_json(void);
+#ifdef IB_THREADS
+static void stats_merge(RunStats* total, const RunStats* part);
+#endif
+#endif
+
+/* --- Trace Functions --- */
+static void trace_record(void);
+static void trace_variable(int var_index, Value value);
+static void trace_dump(FILE* file);
+static const char* trace_opcode_name(unsigned char opcode);
+
+/* --- Program Image Functions --- */
+static int  is_image_file(const char* filename);
+static void save_image(const char* filename);
+static int  write_image(FILE* file);
+static int  load_image(const char* filename);
+static int  read_image(FILE* file);
+static int  read_image_records(FILE* file, unsigned long record_bytes,
+                               unsigned long* sum);
+static unsigned long image_checksum(unsigned long sum, const unsigned char* data,
+                                    unsigned long length);
+static void put_le(unsigned char* out, unsigned long value, int bytes);
+static unsigned long get_le(const unsigned char* in, int bytes);
+static int  code_length(const unsigned char* code);
+static int  is_valid_code(const unsigned char* code, int code_len);
+
+/* --- Snapshot Functions --- */
+static void save_snapshot(const char* filename);
+static int  restore_snapshot(const char* filename);
+static int  read_state(FILE* file, unsigned long* resume_line);
+static int  is_resume_point(int line, int offset);
+static void put_state(FILE* file, unsigned long value, int bytes, unsigned long* sum);
+static int  get_state(FILE* file, unsigned char* data, int bytes, unsigned long* sum);
+
+/* --- Keyword Table Functions (keywords.c) --- */
+static void init_keywords(void);
+static int  register_keyword(const char* name, void (*compile)(void),
+                             void (*handler)(void), unsigned char flags);
+static const Keyword* find_keyword(const char* name);
+static unsigned int keyword_hash_of(const char* name);
+
+/* --- Compiler Functions (compiler.c) --- */
+static void compile_line(const char* text, unsigned char* code, int size);
+static void compile_statement(void);
+static void compile_print(void);
+static void compile_lprint(void);
+static void compile_input(void);
+static void compile_let(void);
+static void compile_if(void);
+static void compile_for(void);
+static void compile_next(void);
+static void compile_expression(void);
+static void compile_term(void);
+static void compile_number(void);
+static void compile_line_target(void);
+static void compile_string(void);
+static void compile_rest_of_line(void);
+static void compile_list(void);
+static int  compile_list_bound(long* line_number);
+static void emit(unsigned char byte);
+static void emit_error(unsigned char error_code);
+
+/* --- Command Handlers (cmd_*.c) --- */
+static void cmd_print(void);
+static void cmd_lprint(void);
+static void cmd_input(void);
+static void cmd_let(void);
+static void cmd_goto(void);
+static void cmd_gosub(void);
+static void cmd_return(void);
+static void cmd_if(void);
+static void cmd_let_add(void);
+static void cmd_if_branch(void);
+static void cmd_for(void);
+static void cmd_next(void);
+static void cmd_rem(void);
+static void cmd_end(void);
+static void cmd_beep(void);
+static void cmd_system(void);
+static void cmd_exit(void);
+static void cmd_quit(void);
+static void cmd_stats(void);
+static void cmd_trace(void);
+static void cmd_run(void);
+static void cmd_list(void);
+static void cmd_new(void);
+static void cmd_save(void);
+static void cmd_load(void);
+static void cmd_import(void);
+static void cmd_include(void);
+static void cmd_merge(void);
+static void cmd_snapshot(void);
+static void cmd_restore(void);
+static void cmd_stub(const char* command);
+
+/* --- Expression Evaluator (parser.c) --- */
+static Value eval_expression(void);
+static Value apply_operator(unsigned char op, Value left, Value right);
+static int  expect_token(unsigned char token);
+
+/* --- Utility Functions (utils.c) --- */
+static void report_error(const char* message);
+static void report_load_error(const char* message);
+static void lprint_close(void);
+static void console_flush(void);
+static int  read_input_field(FILE* file, Value* value);
+static void skip_whitespace(void);
+static int  ib_stricmp(const char* s1, const char* s2);
+static char* format_line_number(char* out, unsigned int line_number);
+
+
+/*
+ * =============================================================================
+ * --- Keyword Table ---
+ * =============================================================================
+ */
+
+/**
+ * @brief keyword_table
+ * The keyword registration table: every command the interpreter knows.
+ *
+ * A keyword's opcode is its index here plus OP_BASE, so the core
+ * entries MUST stay in the same order as the OP_* opcodes.
+ * Modules add their own keywords at run time with `register_keyword`.
+ *
+ * TO ADD A NEW CORE COMMAND:
+ * 1. Write a `cmd_mycommand(void)` function (and, if it takes
+ * arguments, a `compile_mycommand(void)` function).
+ * 2. Add their prototypes to the "Forward Declarations" section.
+ * 3. Add an `OP_MYCOMMAND` opcode after OP_RESTORE, and a matching
+ * entry at the end of the core entries below.
+ */
+static Keyword keyword_table[MAX_KEYWORDS] =
+{
+    { "PRINT",    compile_print,        cmd_print,   0 },
+    { "LPRINT",   compile_lprint,       cmd_lprint,  0 },
+    { "LET",      compile_let,          cmd_let,     0 },
+    { "INPUT",    compile_input,        cmd_input,   0 },
+    { "GOTO",     compile_line_target,  cmd_goto,    0 },
+    { "GOSUB",    compile_line_target,  cmd_gosub,   0 },
+    { "RETURN",   NULL,                 cmd_return,  0 },
+    { "IF",       compile_if,           cmd_if,      0 },
+    { "REM",      NULL,                 cmd_rem,     KW_WHOLE_LINE },
+    { "END",      NULL,                 cmd_end,     0 },
+    { "STOP",     NULL,                 cmd_end,     0 }, /* STOP is an alias for END */
+    { "BEEP",     NULL,                 cmd_beep,    0 },
+    { "RUN",      NULL,                 cmd_run,     KW_DIRECT_ONLY },
+    { "LIST",     compile_list,         cmd_list,    KW_DIRECT_ONLY },
+    { "NEW",      NULL,                 cmd_new,     KW_DIRECT_ONLY },
+    { "SAVE",     compile_rest_of_line, cmd_save,    KW_DIRECT_ONLY | KW_WHOLE_LINE },
+    { "LOAD",     compile_rest_of_line, cmd_load,    KW_DIRECT_ONLY | KW_WHOLE_LINE },
+    { "SYSTEM",   NULL,                 cmd_system,  0 },
+    { "QUIT",     NULL,                 cmd_quit,    0 }, /* Also allowed as "10 QUIT" */
+    { "EXIT",     NULL,                 cmd_exit,    0 }, /* EXIT is an alias for QUIT */
+    { "$IMPORT",  NULL,                 cmd_import,  0 },
+    { "$INCLUDE", compile_rest_of_line, cmd_include, KW_DIRECT_ONLY | KW_WHOLE_LINE },
+    { "$MERGE",   compile_rest_of_line, cmd_merge,   KW_DIRECT_ONLY | KW_WHOLE_LINE },
+    { "FOR",      compile_for,          cmd_for,     0 },
+    { "NEXT",     compile_next,         cmd_next,    0 },
+    { "STATS",    NULL,                 cmd_stats,   KW_DIRECT_ONLY },
+    { "TRACE",    compile_rest_of_line, cmd_trace,   KW_DIRECT_ONLY },
+    { "SNAPSHOT", compile_rest_of_line, cmd_snapshot, KW_WHOLE_LINE },
+    { "RESTORE",  compile_rest_of_line, cmd_restore, KW_DIRECT_ONLY | KW_WHOLE_LINE }
+};
+
+/**
+ * @brief keyword_count
+ * The number of entries *currently* used in `keyword_table`.
+ */
+static int keyword_count = OP_RESTORE - OP_BASE + 1;
+
+/**
+ * @brief keyword_hash
+ * An open-addressing hash index over `keyword_table`, built by
+ * `init_keywords` and `register_keyword`. Each slot holds a table
+ * index + 1, or 0 if the slot is empty.
+ * This turns the compiler's command lookup into (almost always)
+ * a single hash and a single `strcmp`.
+ */
+static unsigned char keyword_hash[KEYWORD_HASH_SIZE];
+
+
+/*
+ * =============================================================================
+ * --- Core Interpreter ---
+ * =============================================================================
+ */
+
+/**
+ * @brief main
+ * The main entry point for the IB interpreter.
+ * It initializes the interpreter and runs the main REPL
+ * (Read-Evaluate-Print Loop).
+ *
+ * @param argc The count of command-line arguments.
+ * @param argv An array of command-line argument strings.
+ * @return 0 on successful exit.
+ *
+ * We add `argc` and `argv` to check for command-line arguments
+ * like `--debug`, as requested in the project specifications.
+ *
+ * (The IB_LIBRARY build has no `main`: see "--- Library Interface ---".)
+ */
+#ifndef IB_LIBRARY
+int main(int argc, char *argv[])
+{
+    /*
+     * We use MAX_LINE_LEN for the input buffer, but add extra space
+     * (+20) to safely accommodate a line number and spaces, preventing
+     * a buffer overflow on user input.
+     */
+    char input_buffer[MAX_LINE_LEN + 20];
+    long total_program_bytes;
+    long total_program_kb;
+
+    /*
+     * The tokenized form of the "immediate mode" line.
+     * Direct commands are compiled exactly like stored lines
+     * and then run through the same `execute_statement`.
+     */
+    unsigned char immediate_code[MAX_CODE_LEN];
+
+    /*
+     * A program file named on the command line, and whether to
+     * RUN it and exit (--run) instead of entering the REPL.
+     */
+    const char* program_file = NULL;
+    int run_and_exit = 0;
+
+    /* A snapshot to restore (--restore FILE) instead of a program file */
+    const char* restore_file = NULL;
+
+    /*
+     * Batch mode (--jobs N, --manifest FILE): every program file named
+     * is a job. They are gathered at the front of `argv` (argv[1] to
+     * argv[file_count]) as the arguments are read.
+     */
+    long job_workers = 0;
+    const char* manifest_file = NULL;
+    int file_count = 0;
+
+    /* The environment variables which choose memory sizes (see `memory_option`) */
+    static const char* const memory_variables[] = { "IB_LINES", "IB_STACK", "IB_ARENA_BYTES" };
+    const char* memory_value;
+
+    /* --- Check for command-line flags --- */
+    /*
+     * ib [flags] [program.bas [--run]]
+     * ib [flags] --restore FILE [--run]
+     * ib [flags] --jobs N [--manifest FILE] program.bas ...
+     *
+     * --debug        enables verbose logging.
+     * --batch        runs silently, with buffered output (see `is_batch_mode`).
+     * --lprint FILE  sends LPRINT output to FILE instead of lprint.out.
+     * --run          runs `program.bas` and exits, with no REPL at all.
+     * --profile      reports the hottest lines and commands after each RUN.
+     * --profile-csv FILE  writes that report to FILE, as CSV, instead.
+     * --lines N, --stack N, --arena-bytes N  set the memory sizes.
+     * --max-steps N, --timeout SECONDS  limit every RUN.
+     * --stats-json FILE  writes the STATS counters to FILE on exit.
+     * --trace        keeps a trace of the last statements of each RUN.
+     * --restore FILE restores a SNAPSHOT (and carries on running it).
+     * --jobs N       runs every program named (and listed in the
+     *                --manifest FILE, one per line), N at a time.
+     * We loop through all arguments, not just the first one.
+     */
+    int i;
+
+    /* The one interpreter: default sizes, until the options below */
+    context_init();
+
+    /* Memory sizes from the environment come first: the flags override them */
+    for (i = 0; i < 3; i++)
+    {
+        memory_value = getenv(memory_variables[i]);
+        if (memory_value != NULL && !memory_option(memory_variables[i], memory_value))
+        {
+            return 2;
+        }
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--debug") == 0)
+        {
+            is_debug_mode = 1;
+        }
+        else if (strcmp(argv[i], "--run") == 0)
+        {
+            run_and_exit = 1;
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            is_profile_mode = 1;
+        }
+        else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc)
+        {
+            is_profile_mode = 1;
+            profile_csv_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc)
+        {
+            stats_json_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            ctx->is_trace_mode = 1;
+        }
+        else if (strcmp(argv[i], "--batch") == 0)
+        {
+            is_batch_mode = 1;
+        }
+        else if (strcmp(argv[i], "--lprint") == 0 && i + 1 < argc)
+        {
+            ctx->lprint_path = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--lines") == 0 || strcmp(argv[i], "--stack") == 0 ||
+                  strcmp(argv[i], "--arena-bytes") == 0) && i + 1 < argc)
+        {
+            if (!memory_option(argv[i], argv[i + 1]))
+            {
+                return 2;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc)
+        {
+            if (!parse_limit(argv[i], argv[i + 1], 2147483647L, &ctx->max_steps))
+            {
+                return 2;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+        {
+            if (!parse_limit(argv[i], argv[i + 1], 2147483647L, &ctx->timeout_seconds))
+            {
+                return 2;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+        {
+            if (!parse_limit(argv[i], argv[i + 1], JOBS_LIMIT, &job_workers))
+            {
+                return 2;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc)
+        {
+            manifest_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc)
+        {
+            restore_file = argv[++i];
+        }
+        else if (argv[i][0] != '-')
+        {
+            /* Safe: this never overwrites an argument not yet read */
+            argv[++file_count] = argv[i];
+        }
+    }
+    if (file_count > 0)
+    {
+        program_file = argv[1];
+    }
+
+    /* Script and batch modes are always silent: they are meant for other programs */
+    if (((program_file != NULL || restore_file != NULL) && run_and_exit) ||
+        job_workers > 0 || manifest_file != NULL)
+    {
+        is_batch_mode = 1;
+    }
+    if ((job_workers > 0 || manifest_file != NULL) && is_profile_mode)
+    {
+        fprintf(stderr, "--jobs: cannot be combined with --profile\n");
+        return 2;
+    }
+
+    /*
+     * --- Console Buffering ---
+     * When nobody is watching the output as it appears (a file or a
+     * pipe), we give stdout a large buffer and stop flushing it after
+     * every line. This MUST happen before anything is printed.
+     */
+    if (is_batch_mode || !isatty(STDOUT_FILENO))
+    {
+        is_buffered_output = 1;
+        setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+    }
+
+    /* The same for data piped into INPUT (see `is_streamed_input`) */
+    if (!isatty(STDIN_FILENO))
+    {
+        is_streamed_input = 1;
+        setvbuf(stdin, input_stream_buffer, _IOFBF, sizeof(input_stream_buffer));
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Debug mode enabled.\n");
+    }
+
+    /* The one and only allocation (see `memory_init`) */
+    if (!memory_init())
+    {
+        fprintf(stderr, "Not enough memory for %d lines and %d GOSUB levels\n",
+                ctx->max_lines, ctx->stack_size);
+        return 2;
+    }
+#ifdef IB_COMPACT_STORAGE
+    total_program_bytes = ctx->arena_size;
+#else
+    total_program_bytes = (long)ctx->max_lines * (long)sizeof(Line);
+#endif
+    total_program_kb = total_program_bytes / 1024;
+
+
+    /* Build the keyword hash index, then clear memory for startup. */
+    init_keywords();
+    new_program();
+
+    /* From here on, every way out writes the statistics */
+    if (stats_json_path != NULL)
+    {
+        atexit(stats_write_json);
+    }
+
+    /*
+     * --- Script Mode ---
+     * "ib program.bas --run" is the same as typing LOAD and RUN,
+     * without the banner, the prompts, or the REPL. The exit status
+     * tells the caller how it went:
+     * 0 = the program ended normally (END, STOP, QUIT or its last line),
+     * 1 = an error was reported (while loading or running),
+     * 2 = the file could not be read.
+     * (2 is also returned, before anything else, for a bad memory
+     * size or limit option, or if its memory cannot be allocated.)
+     * Ctrl+C (BREAK), --max-steps and --timeout give 1.
+     * "ib --restore FILE --run" is the same for a snapshot (see
+     * `restore_snapshot`), which carries on where it was taken.
+     *
+     * --- Batch Mode ---
+     * "ib --jobs N a.bas b.bas ..." runs every program the same way,
+     * in one process, and exits with the highest of their statuses
+     * (see `run_jobs`).
+     */
+    if (job_workers > 0 || manifest_file != NULL)
+    {
+        return run_jobs((const char* const*)&argv[1], file_count,
+                        manifest_file, (int)job_workers);
+    }
+    if (restore_file != NULL && run_and_exit)
+    {
+        ctx->error_count = 0;
+        if (!restore_snapshot(restore_file))
+        {
+            return 2;
+        }
+        return (ctx->error_count > 0) ? 1 : 0;
+    }
+    if (program_file != NULL && run_and_exit)
+    {
+        return run_job(program_file);
+    }
+
+    /* --- Startup Banner --- */
+    /* Note: We use %ld for 'long' to be portable. */
+    if (!is_batch_mode)
+    {
+        fprintf(ctx->output, "BASIC++ (%s) v%s\n", current_dialect_name, current_version);
+        fprintf(ctx->output, "%ld kbytes Free\n", total_program_kb);
+        fprintf(ctx->output, "READY\n");
+    }
+
+    /* "ib program.bas" (without --run) loads it, then starts the REPL */
+    if (restore_file != NULL)
+    {
+        restore_snapshot(restore_file);
+    }
+    else if (program_file != NULL)
+    {
+        load_program(program_file);
+    }
+
+    /*
+     * --- Main REPL Loop ---
+     * This is the main Read-Evaluate-Print Loop.
+     * 1. READ:   It waits for user input (using fgets).
+     * 2. EVAL:   It figures out if it's a direct command or a stored line.
+     * 3. PRINT:  It executes the command (printing output) or stores the line.
+     * 4. LOOP:   It repeats.
+     */
+    while (1)
+    {
+        if (!is_batch_mode)
+        {
+            fprintf(ctx->output, "> ");
+            console_flush(); /* Ensure prompt is displayed before input */
+        }
+
+        if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+        {
+            /*
+             * User pressed Ctrl+D (end-of-file) or an error occurred.
+             * This is a clean way to exit the REPL.
+             */
+            if (!is_batch_mode)
+            {
+                fprintf(ctx->output, "\n"); /* Print a newline to make it clean */
+            }
+            break; /* Exit loop and terminate program */
+        }
+
+        /* Remove newline character (both \n and \r) from input */
+        input_buffer[strcspn(input_buffer, "\r\n")] = 0;
+
+        /* --- Direct Mode or Stored Line? --- */
+        ctx->parser_ptr = input_buffer;  /* MUST set parser_ptr before skip_whitespace() */
+        skip_whitespace();
+
+        if (isdigit((unsigned char)*ctx->parser_ptr))
+        {
+            /*
+             * 1. STORED LINE
+             * The line starts with a digit, so it's a program line
+             * that needs to be stored.
+             */
+            store_line(input_buffer);
+        }
+        else if (*ctx->parser_ptr != '\0')
+        {
+            /*
+             * 2. DIRECT MODE
+             * The line does NOT start with a digit, and it's not empty.
+             * This is a direct command to be executed immediately.
+             */
+
+            /*
+             * Compile the input line in place (the compiler never
+             * modifies its text), then point the runtime at its tokens.
+             */
+            compile_line(input_buffer, immediate_code, MAX_CODE_LEN);
+            ctx->code_ptr = immediate_code;
+
+            /*
+             * Set the `is_running` flag. This tells our functions
+             * (like `report_error`) that we are in "execution mode"
+             * (even though it's just one line).
+             */
+            ctx->is_running = 1;
+            ctx->loop_pointer = 0; /* A FOR loop only lasts one line here */
+
+            /*
+             * Call the main dispatch function to run this single line,
+             * one statement at a time ("PRINT A : PRINT B").
+             */
+            execute_statement();
+            while (ctx->is_running && *ctx->code_ptr == TOK_COLON)
+            {
+                ctx->code_ptr++;
+                execute_statement();
+            }
+
+            /*
+             * The line is done, so we clear the flag.
+             * If an error occurred, `is_running` will already be 0,
+             * but it's safe to set it again.
+             */
+            ctx->is_running = 0;
+            lprint_close();
+            if (!is_batch_mode)
+            {
+                fprintf(ctx->output, "OK\n"); /* "OK" is the standard response in direct mode */
+                fprintf(ctx->output, "READY\n");
+            }
+        }
+        else
+        {
+            /*
+             * 3. BLANK LINE
+             * The user just hit Enter. Do nothing and show the prompt.
+             */
+            if (!is_batch_mode)
+            {
+                fprintf(ctx->output, "READY\n");
+            }
+        }
+    }
+
+    lprint_close();
+    return 0; /* User exited the REPL */
+}
+#endif
+
+#ifdef IB_LIBRARY
+
+/*
+ * =============================================================================
+ * --- Library Interface ---
+ * =============================================================================
+ *
+ * The public API of the IB_LIBRARY build, declared in ib.h. Each call
+ * points this thread's `ctx` at the context it is given, does its work
+ * through the ordinary (static) interpreter functions, and puts `ctx`
+ * back before it returns.
+ */
+
+/**
+ * @brief keywords_ready
+ * Set once the first `ib_create` has built the keyword hash index,
+ * which every interpreter then shares (it is only ever read).
+ */
+static int keywords_ready = 0;
+
+#ifdef IB_STATIC_MEMORY
+/**
+ * @brief library_context, library_context_used
+ * With IB_STATIC_MEMORY there is no `malloc`, so there is exactly one
+ * context, which `ib_create` hands out while it is not in use.
+ */
+static IB_Context library_context;
+static int library_context_used = 0;
+#endif
+
+/**
+ * @brief ib_create
+ * Creates a new, independent interpreter, with an empty program and
+ * the default memory sizes (MAX_LINES lines, STACK_SIZE GOSUB levels).
+ * Its LPRINT output goes to "lprint.out".
+ *
+ * The first call also builds the shared keyword index, so it must
+ * return before other threads make theirs.
+ *
+ * @return The new context, or NULL if there is not enough memory.
+ */
+IB_Context* ib_create(void)
+{
+    IB_Context* previous = ctx;
+    IB_Context* context;
+
+#ifdef IB_STATIC_MEMORY
+    if (library_context_used)
+    {
+        return NULL;
+    }
+    library_context_used = 1;
+    context = &library_context;
+    memset(context, 0, sizeof(*context));
+#else
+    context = (IB_Context*)calloc(1, sizeof(IB_Context));
+    if (context == NULL)
+    {
+        return NULL;
+    }
+#endif
+
+    if (!keywords_ready)
+    {
+        init_keywords();
+        keywords_ready = 1;
+    }
+
+    ctx = context;
+    context_init();
+    if (!memory_init())
+    {
+        ctx = previous;
+#ifndef IB_STATIC_MEMORY
+        free(context);
+#endif
+        return NULL;
+    }
+    new_program();
+    ctx = previous;
+    return context;
+}
+
+/**
+ * @brief ib_load_string
+ * Replaces the program of `context` with the lines in `source`, one
+ * per line ("10 PRINT 1\n20 END\n"), exactly as LOAD reads a file.
+ * A bad line is reported (on stdout, as always) and skipped.
+ *
+ * @param context The interpreter.
+ * @param source  The program text, '\0'-terminated.
+ * @return 1 if every line was stored, 0 if any was refused.
+ */
+int ib_load_string(IB_Context* context, const char* source)
+{
+    IB_Context* previous = ctx;
+    char line_buffer[MAX_LINE_LEN + 20];
+    int highest_line = 0;
+    int is_sorted = 1;
+    int errors;
+    size_t length;
+
+    ctx = context;
+    errors = ctx->error_count;
+    new_program();
+    ctx->load_file_name = "";
+    ctx->load_file_line = 0;
+
+    while (*source != '\0')
+    {
+        /* Copy one line ("\n", "\r\n" or "\r" ends it) */
+        length = strcspn(source, "\r\n");
+        ctx->load_file_line++;
+        if (length > sizeof(line_buffer) - 1)
+        {
+            report_load_error("LINE TOO LONG");
+        }
+        else
+        {
+            memcpy(line_buffer, source, length);
+            line_buffer[length] = '\0';
+            if (line_buffer[0] != '\0')
+            {
+                load_line(line_buffer, &highest_line, &is_sorted);
+            }
+        }
+
+        source += length;
+        if (*source == '\r')
+        {
+            source++;
+        }
+        if (*source == '\n')
+        {
+            source++;
+        }
+    }
+    ctx->load_file_name = NULL;
+
+    if (!is_sorted)
+    {
+        sort_program_storage();
+    }
+
+    errors = ctx->error_count - errors;
+    ctx = previous;
+    return (errors == 0) ? 1 : 0;
+}
+
+/**
+ * @brief ib_run
+ * RUNs the program of `context`, from its first line, to the end.
+ * PRINT writes to stdout; LPRINT to the context's printer file.
+ * QUIT and EXIT only end the program: they never exit the host.
+ *
+ * @param context The interpreter.
+ * @return 0 if the program ended normally, 1 if an error stopped it
+ * (the same as the exit status of `ib program.bas --run`).
+ */
+int ib_run(IB_Context* context)
+{
+    IB_Context* previous = ctx;
+    int errors;
+
+    ctx = context;
+    errors = ctx->error_count;
+    run_program(0);
+    errors = ctx->error_count - errors;
+    ctx = previous;
+    return (errors > 0) ? 1 : 0;
+}
+
+/**
+ * @brief ib_destroy
+ * Closes the printer file of `context` and frees all of its memory.
+ * @param context The interpreter (NULL is ignored).
+ */
+void ib_destroy(IB_Context* context)
+{
+    IB_Context* previous = ctx;
+
+    if (context == NULL)
+    {
+        return;
+    }
+    ctx = context;
+    lprint_close();
+    ctx = previous;
+
+#ifdef IB_STATIC_MEMORY
+    library_context_used = 0;
+#else
+    free(context->memory_block);
+    free(context);
+#endif
+}
+
+#endif
+
+
+/**
+ * @brief execute_statement
+ * The main "dispatch" function for the interpreter.
+ *
+ * This function reads the *opcode* at the global `code_ptr`
+ * (the first token of a compiled statement) and then "dispatches"
+ * execution to the keyword's `cmd_...` handler function.
+ *
+ * The command word was already looked up once, when the line was
+ * compiled (see `compile_statement`), so no text is scanned here:
+ * the opcode is simply an index into `keyword_table`.
+ *
+ * To add a new command, see `keyword_table` (core commands) or
+ * `register_keyword` (module commands). Nothing here needs to change.
+ */
+static void execute_statement(void)
+{
+    unsigned char opcode;
+    const Keyword* keyword;
+
+    /* Ensure the `is_running` flag is checked before we do anything. */
+    if (!ctx->is_running) return;
+
+    /* 1. Fetch the opcode and point `code_ptr` at its arguments */
+    opcode = *ctx->code_ptr++;
+
+    if (opcode >= OP_LET_ADD && opcode <= OP_IF_GT)
+    {
+        /*
+         * A fused statement. For --debug and --profile, it still
+         * counts as the LET or IF that it was written as.
+         */
+        keyword = &keyword_table[(opcode == OP_LET_ADD ? OP_LET : OP_IF) - OP_BASE];
+        if (is_debug_mode)
+        {
+            fprintf(ctx->output, "[DEBUG] Executing command: '%s'\n", keyword->name);
+        }
+        if (is_profile_mode && ctx->is_program_mode)
+        {
+            ctx->profile_command_hits[keyword - keyword_table]++;
+        }
+
+        if (opcode == OP_LET_ADD)
+        {
+            cmd_let_add();
+        }
+        else
+        {
+            cmd_if_branch();
+        }
+        return;
+    }
+
+    if (opcode < OP_BASE)
+    {
+        /*
+         * Not a keyword. Either an empty statement (OP_NOP), or the
+         * compiler could not make sense of this statement (e.g., an
+         * unknown command) and left a deferred error for us to raise.
+         */
+        if (opcode == TOK_ERROR)
+        {
+            report_error(error_messages[*ctx->code_ptr]);
+        }
+        return;
+    }
+
+    /* 2. Look up the keyword. This is a direct array index. */
+    keyword = &keyword_table[opcode - OP_BASE];
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Executing command: '%s'\n", keyword->name);
+    }
+    if (is_profile_mode && ctx->is_program_mode)
+    {
+        ctx->profile_command_hits[opcode - OP_BASE]++;
+    }
+
+    /*
+     * 3. Direct-mode commands (RUN, LIST, ...) are refused inside a
+     * running program (this check prevents "10 RUN" from causing chaos).
+     */
+    if ((keyword->flags & KW_DIRECT_ONLY) && ctx->is_program_mode)
+    {
+        char message[COMMAND_MAX_LEN + 32];
+        sprintf(message, "CAN'T USE %s IN A PROGRAM", keyword->name);
+        report_error(message);
+        return;
+    }
+
+    /* 4. Dispatch */
+    keyword->handler();
+}
+
+/**
+ * @brief dispatch_program
+ * The fast execution loop used by `run_program` (when neither
+ * --debug nor --profile is on): runs statements until the program
+ * stops or runs off its end.
+ *
+ * Every handler leaves `code_ptr` just past its arguments, so a
+ * TOK_COLON there means another statement follows on the same line,
+ * with no trip back through the line table. A jump leaves it at
+ * `end_of_line` instead (and RETURN, possibly, in mid-line).
+ *
+ * `execute_statement` is general, but each statement costs it a
+ * function call, a keyword table lookup and a few flag tests. Here,
+ * the opcodes of the ordinary program statements go *straight* to
+ * their `cmd_...` handlers. Everything else (an empty statement, a
+ * deferred error, a direct-only command, or a module's keyword) is
+ * handed back to `execute_statement`, which deals with it as usual.
+ *
+ * With IB_THREADED_DISPATCH, the step from one statement to the next
+ * is a single indirect jump through `dispatch`, made from the end of
+ * each handler's label (so the CPU can predict each one separately).
+ * Otherwise, the same opcodes are a `switch` inside a `while` loop.
+ *
+ * @param is_prime 1 to only fill in the `dispatch` table, and return.
+ * `init_keywords` does this once, before any program (or thread) can
+ * run, so the table is never written while another thread jumps
+ * through it.
+ */
+static void dispatch_program(int is_prime)
+{
+#ifdef IB_THREADED_DISPATCH
+    static void* dispatch[256];
+    int i;
+
+    /*
+     * Label addresses (&&label) only exist inside this function,
+     * so the table is filled in here, when we are primed.
+     */
+    if (is_prime)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            dispatch[i] = &&op_other;
+        }
+        dispatch[OP_PRINT]  = &&op_print;
+        dispatch[OP_LPRINT] = &&op_lprint;
+        dispatch[OP_LET]    = &&op_let;
+        dispatch[OP_INPUT]  = &&op_input;
+        dispatch[OP_GOTO]   = &&op_goto;
+        dispatch[OP_GOSUB]  = &&op_gosub;
+        dispatch[OP_RETURN] = &&op_return;
+        dispatch[OP_IF]     = &&op_if;
+        dispatch[OP_REM]    = &&op_rem;
+        dispatch[OP_END]    = &&op_end;
+        dispatch[OP_STOP]   = &&op_end;
+        dispatch[OP_BEEP]   = &&op_beep;
+        dispatch[OP_FOR]    = &&op_for;
+        dispatch[OP_NEXT]   = &&op_next;
+        dispatch[OP_LET_ADD] = &&op_let_add;
+        dispatch[OP_IF_EQ]  = &&op_if_branch;
+        dispatch[OP_IF_NE]  = &&op_if_branch;
+        dispatch[OP_IF_LT]  = &&op_if_branch;
+        dispatch[OP_IF_GT]  = &&op_if_branch;
+        return;
+    }
+
+    /*
+     * Fetch the next statement and jump to its opcode's label: the
+     * one after the TOK_COLON, or else the first on the next line.
+     * As in `run_program`, the program counter is advanced *before*
+     * the line runs. END, STOP and errors clear `is_running`;
+     * Ctrl+C and the limits are seen by `poll_interrupts`.
+     */
+#define NEXT_STATEMENT()                                \
+    do                                                  \
+    {                                                   \
+        if (!ctx->is_running) return;                   \
+        if (*ctx->code_ptr == TOK_COLON)                \
+        {                                               \
+            ctx->code_ptr++;                            \
+        }                                               \
+        else                                            \
+        {                                               \
+            if (ctx->program_counter >= ctx->line_count) return; \
+            ctx->code_ptr = LINE_CODE(ctx->program_counter);      \
+            ctx->program_counter++;                     \
+        }                                               \
+        if (--ctx->poll_countdown < 0 && !poll_interrupts()) return; \
+        if (ctx->is_trace_mode) trace_record();         \
+        goto *dispatch[*ctx->code_ptr++];               \
+    } while (0)
+
+    NEXT_STATEMENT();
+
+op_print:  cmd_print();  NEXT_STATEMENT();
+op_lprint: cmd_lprint(); NEXT_STATEMENT();
+op_let:    cmd_let();    NEXT_STATEMENT();
+op_input:  cmd_input();  NEXT_STATEMENT();
+op_goto:   cmd_goto();   NEXT_STATEMENT();
+op_gosub:  cmd_gosub();  NEXT_STATEMENT();
+op_return: cmd_return(); NEXT_STATEMENT();
+op_if:     cmd_if();     NEXT_STATEMENT();
+op_rem:    cmd_rem();    NEXT_STATEMENT();
+op_end:    cmd_end();    NEXT_STATEMENT();
+op_beep:   cmd_beep();   NEXT_STATEMENT();
+op_for:    cmd_for();    NEXT_STATEMENT();
+op_next:   cmd_next();   NEXT_STATEMENT();
+op_let_add:   cmd_let_add();   NEXT_STATEMENT();
+op_if_branch: cmd_if_branch(); NEXT_STATEMENT();
+op_other:
+    ctx->code_ptr--; /* Give `execute_statement` its opcode back */
+    execute_statement();
+    NEXT_STATEMENT();
+
+#undef NEXT_STATEMENT
+#else
+    if (is_prime)
+    {
+        return; /* A `switch` has no table to fill in */
+    }
+
+    while (ctx->is_running)
+    {
+        if (*ctx->code_ptr == TOK_COLON)
+        {
+            ctx->code_ptr++;
+        }
+        else
+        {
+            if (ctx->program_counter >= ctx->line_count) return;
+            ctx->code_ptr = LINE_CODE(ctx->program_counter);
+            ctx->program_counter++;
+        }
+        if (--ctx->poll_countdown < 0 && !poll_interrupts()) return;
+        if (ctx->is_trace_mode) trace_record();
+
+        switch (*ctx->code_ptr++)
+        {
+            case OP_PRINT:  cmd_print();  break;
+            case OP_LPRINT: cmd_lprint(); break;
+            case OP_LET:    cmd_let();    break;
+            case OP_INPUT:  cmd_input();  break;
+            case OP_GOTO:   cmd_goto();   break;
+            case OP_GOSUB:  cmd_gosub();  break;
+            case OP_RETURN: cmd_return(); break;
+            case OP_IF:     cmd_if();     break;
+            case OP_REM:    cmd_rem();    break;
+            case OP_END:
+            case OP_STOP:   cmd_end();    break;
+            case OP_BEEP:   cmd_beep();   break;
+            case OP_FOR:    cmd_for();    break;
+            case OP_NEXT:   cmd_next();   break;
+            case OP_LET_ADD: cmd_let_add(); break;
+            case OP_IF_EQ:
+            case OP_IF_NE:
+            case OP_IF_LT:
+            case OP_IF_GT:  cmd_if_branch(); break;
+            default:
+                ctx->code_ptr--; /* Give `execute_statement` its opcode back */
+                execute_statement();
+                break;
+        }
+    }
+#endif
+}
+
+
+/*
+ * =============================================================================
+ * --- Core Functions ---
+ * =============================================================================
+ */
+
+/**
+ * @brief run_program
+ * Executes the stored BASIC program from the beginning.
+ *
+ * @param is_resume 1 to carry on, instead, from the line at
+ * `program_counter`, with the variables and the GOSUB and FOR stacks
+ * as they are (a restored snapshot; see `restore_snapshot`).
+ */
+static void run_program(int is_resume)
+{
+    int profiled_line;  /* --profile: the line being timed */
+    clock_t started;
+    double run_started = stats_clock(); /* The wall time, for STATS */
+#ifndef IB_LIBRARY
+    void (*previous_handler)(int);
+#endif
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] --- RUNNING PROGRAM ---\n");
+    }
+    if (is_profile_mode)
+    {
+        profile_reset();
+    }
+
+#ifndef IB_LIBRARY
+    /*
+     * Ctrl+C now stops the program (BREAK), not the interpreter.
+     * The old handler (normally: terminate) is back once it ends.
+     * (The library leaves signals to its host, and `run_jobs`
+     * installs the handler once, for all of its programs.)
+     */
+    previous_handler = SIG_DFL;
+    if (!is_job_mode)
+    {
+        previous_handler = install_interrupt_handler();
+        break_requested = 0;
+    }
+#endif
+    ctx->run_steps = 0;
+    ctx->poll_chunk = 0;
+    ctx->poll_countdown = 0;
+    ctx->trace_count = 0;   /* The trace starts afresh with each RUN */
+    if (ctx->timeout_seconds > 0)
+    {
+        ctx->run_started = run_clock();
+    }
+
+    /* 1. Initialize the "CPU" */
+    ctx->is_running = 1;       /* Set the run flag to ON */
+    ctx->is_program_mode = 1;  /* Direct-mode commands are now refused */
+    ctx->code_ptr = &end_of_line; /* Fetch the line at `program_counter` */
+    if (!is_resume)
+    {
+        ctx->program_counter = 0;  /* Start at the first line (index 0) */
+        ctx->stack_pointer = 0;    /* Clear the GOSUB stack */
+        ctx->loop_pointer = 0;     /* ...and the FOR loop stack */
+        memset(ctx->variables, 0, sizeof(ctx->variables)); /* Clear all variables */
+    }
+
+    /*
+     * 2. Main Execution Loop
+     * This loop is the "CPU" of our interpreter.
+     * It runs as long as `is_running` is true and we haven't
+     * run off the end of the program.
+     * Unless each line must be traced (--debug) or timed (--profile),
+     * `dispatch_program` runs the whole program instead, and this
+     * loop finds nothing left to do.
+     */
+    if (!is_debug_mode && !is_profile_mode)
+    {
+        dispatch_program(0);
+    }
+
+    while (ctx->is_running)
+    {
+        if (*ctx->code_ptr == TOK_COLON)
+        {
+            /* Another statement on the same line */
+            ctx->code_ptr++;
+        }
+        else
+        {
+            if (ctx->program_counter >= ctx->line_count)
+            {
+                break; /* We ran off the end of the program */
+            }
+
+            if (is_debug_mode)
+            {
+                fprintf(ctx->output, "[DEBUG] Running line %d: %s\n",
+                                     LINE_NUMBER(ctx->program_counter),
+                                     LINE_TEXT(ctx->program_counter));
+            }
+            if (is_profile_mode)
+            {
+                ctx->profile_line_hits[ctx->program_counter]++;
+            }
+
+            /*
+             * Point the runtime at the line's *tokens*.
+             * The line was compiled when it was stored, so there is
+             * no text to copy or re-scan here.
+             */
+            ctx->code_ptr = LINE_CODE(ctx->program_counter);
+
+            /*
+             * 3. Advance the Program Counter
+             * We advance it *before* executing, so it already points
+             * at the next line. A GOTO, GOSUB or RETURN just overwrites
+             * it (even with the current line, as in "10 GOTO 10").
+             */
+            ctx->program_counter++;
+        }
+
+        if (--ctx->poll_countdown < 0 && !poll_interrupts())
+        {
+            break;
+        }
+        if (ctx->is_trace_mode)
+        {
+            trace_record();
+        }
+
+        /* Execute the statement */
+        if (is_profile_mode)
+        {
+            profiled_line = ctx->program_counter - 1;
+            started = clock();
+            execute_statement();
+            ctx->profile_line_time[profiled_line] += clock() - started;
+        }
+        else
+        {
+            execute_statement();
+        }
+    }
+
+    /* 4. Program finished */
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] --- PROGRAM ENDED ---\n");
+    }
+    ctx->is_running = 0; /* Set the run flag to OFF */
+    ctx->is_program_mode = 0;
+    ctx->code_ptr = &end_of_line; /* A direct-mode "RUN : PRINT A" ends here */
+    stats_run_finished(run_started);
+#ifndef IB_LIBRARY
+    if (!is_job_mode)
+    {
+        signal(SIGINT, previous_handler);
+    }
+#endif
+
+    /* END, STOP, an error, or the last line: the printer run is over */
+    lprint_close();
+    fflush(ctx->output); /* ...and everything the program printed is shown */
+
+    if (is_profile_mode)
+    {
+        if (profile_csv_path != NULL)
+        {
+            profile_write_csv();
+        }
+        else
+        {
+            profile_report();
+        }
+    }
+}
+
+/**
+ * @brief poll_interrupts
+ * Called by the execution loops when `poll_countdown` runs out,
+ * i.e., before one statement in every POLL_INTERVAL (or sooner, to
+ * stop at exactly --max-steps). Checks, in order, for Ctrl+C, the
+ * --max-steps budget and the --timeout budget.
+ *
+ * The loops only pay for a decrement and a test per statement; the
+ * flag, the step count and the clock are only looked at here.
+ *
+ * @return 1 to carry on, 0 if the program was stopped.
+ */
+static int poll_interrupts(void)
+{
+    long chunk;
+
+    ctx->run_steps += ctx->poll_chunk; /* The statements since the last check */
+    ctx->poll_chunk = 0;     /* (If we stop here, `run_steps` is the count) */
+    ctx->poll_countdown = 0;
+
+    if (break_requested)
+    {
+        if (!is_job_mode)
+        {
+            break_requested = 0; /* (In a batch, every program stops) */
+        }
+        fprintf(ctx->output, "BREAK IN %d\n", LINE_NUMBER(ctx->program_counter - 1));
+        console_flush();
+        if (ctx->is_trace_mode)
+        {
+            trace_dump(stderr);
+        }
+        ctx->error_count++; /* `ib program.bas --run` exits with status 1 */
+        ctx->stats.errors++;
+        ctx->is_running = 0;
+        return 0;
+    }
+    if (ctx->max_steps > 0 && ctx->run_steps >= ctx->max_steps)
+    {
+        report_error("STEP LIMIT REACHED");
+        return 0;
+    }
+    if (ctx->timeout_seconds > 0 &&
+        run_clock() - ctx->run_started >= (double)ctx->timeout_seconds)
+    {
+        report_error("TIME LIMIT REACHED");
+        return 0;
+    }
+
+    /* Count down to the next check (this statement is the first) */
+    chunk = POLL_INTERVAL;
+    if (ctx->max_steps > 0 && ctx->max_steps - ctx->run_steps < chunk)
+    {
+        chunk = ctx->max_steps - ctx->run_steps;
+    }
+    ctx->poll_chunk = (int)chunk;
+    ctx->poll_countdown = (int)chunk - 1;
+    return 1;
+}
+
+/**
+ * @brief run_clock
+ * The processor time, in seconds, that --timeout measures. Where the
+ * system can tell, this is the time of the calling thread alone, so
+ * that each of the jobs running at once (--jobs, or a library host's
+ * threads) gets the whole of its budget; `clock` would charge every
+ * job for the time of all of them.
+ */
+static double run_clock(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0)
+    {
+        return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+    }
+#endif
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+#ifndef IB_LIBRARY
+/**
+ * @brief on_interrupt
+ * The SIGINT (Ctrl+C) handler, installed by `run_program` while a
+ * program runs. A signal handler may safely do very little, so this
+ * only sets `break_requested`, for `poll_interrupts` to act upon.
+ */
+static void on_interrupt(int signal_number)
+{
+    signal(signal_number, on_interrupt); /* Some systems reset it to SIG_DFL */
+    break_requested = 1;
+}
+
+/**
+ * @brief install_interrupt_handler
+ * Makes Ctrl+C set `break_requested`, unless SIGINT is ignored
+ * (e.g., in a background job), in which case it stays ignored.
+ * @return The handler to restore afterwards.
+ */
+static void (*install_interrupt_handler(void))(int)
+{
+    void (*previous_handler)(int) = signal(SIGINT, on_interrupt);
+
+    if (previous_handler == SIG_IGN)
+    {
+        signal(SIGINT, SIG_IGN);
+    }
+    else if (previous_handler == SIG_ERR)
+    {
+        previous_handler = SIG_DFL;
+    }
+    return previous_handler;
+}
+#endif
+
+/**
+ * @brief list_program
+ * Prints the lines currently in program storage whose numbers are
+ * from `first_line` to `last_line` (all of them: 0 to 65535).
+ */
+static void list_program(int first_line, int last_line)
+{
+    write_program_text(ctx->output, first_line, last_line);
+}
+
+/**
+ * @brief write_program_text
+ * Writes the lines numbered `first_line` to `last_line` to `file`, in
+ * the form "10 PRINT A": the one formatter shared by LIST and SAVE.
+ *
+ * The first line is found by binary search (see `find_insert_index`),
+ * so listing a small region of a large program costs no more than the
+ * lines listed. Each line number is converted by `format_line_number`,
+ * and the lines are collected in a LISTING_BUFFER_SIZE buffer which is
+ * written with a single `fwrite` whenever the next line might not fit:
+ * no format string is parsed, and the stream is not locked, per line.
+ *
+ * @return 1 if everything was written, 0 on a write error.
+ */
+static int write_program_text(FILE* file, int first_line, int last_line)
+{
+    char buffer[LISTING_BUFFER_SIZE];
+    char* out = buffer;
+    const char* text;
+    size_t length;
+    size_t written = 0;
+    size_t expected = 0;
+    int i;
+
+    for (i = find_insert_index(first_line);
+         i < ctx->line_count && LINE_NUMBER(i) <= last_line; i++)
+    {
+        /* The longest line: 5 digits, a space, the text and '\n' */
+        if ((size_t)(out - buffer) > sizeof(buffer) - (MAX_LINE_LEN + 8))
+        {
+            expected += (size_t)(out - buffer);
+            written += fwrite(buffer, 1, (size_t)(out - buffer), file);
+            out = buffer;
+        }
+
+        out = format_line_number(out, (unsigned int)LINE_NUMBER(i));
+        *out++ = ' ';
+        text = LINE_TEXT(i);
+        length = strlen(text);
+        memcpy(out, text, length);
+        out += length;
+        *out++ = '\n';
+    }
+
+    expected += (size_t)(out - buffer);
+    written += fwrite(buffer, 1, (size_t)(out - buffer), file);
+    return written == expected;
+}
+
+/**
+ * @brief new_program
+ * Clears the program, variables, and GOSUB stack.
+ * Resets the interpreter to a clean state.
+ */
+static void new_program(void)
+{
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Clearing all memory (NEW).\n");
+    }
+    /*
+     * We just set line_count to 0. This "orphans" all the
+     * data in `program_storage`, effectively clearing it
+     * without spending time zeroing the memory.
+     */
+    ctx->line_count = 0;
+    ctx->include_count = 0; /* $INCLUDE may read every file again */
+    ctx->program_counter = 0;
+    ctx->stack_pointer = 0;
+    ctx->loop_pointer = 0;
+
+    /* We *must*, however, zero the variable and stack memory. */
+    memset(ctx->variables, 0, sizeof(ctx->variables));
+    memset(ctx->gosub_stack, 0, ctx->stack_size * sizeof(ctx->gosub_stack[0]));
+}
+
+/**
+ * @brief save_program
+ * Saves the current program to a text file.
+ * @param filename The name of the file to save.
+ */
+static void save_program(const char* filename)
+{
+    FILE *file;
+
+    /*
+     * The `filename` pointer comes from `parser_ptr`,
+     * which is already pointing at the filename.
+     * We just need to check if it's empty.
+     */
+    if (filename == NULL || *filename == '\0')
+    {
+        report_error("FILENAME REQUIRED");
+        return;
+    }
+    /*
+     * NOTE: We are not trimming whitespace from the filename
+     * for simplicity. "SAVE my file.bas" will fail.
+     * The user must type "SAVE myfile.bas".
+     */
+
+    if (is_image_file(filename))
+    {
+        save_image(filename);
+        return;
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Saving program to '%s'\n", filename);
+    }
+
+    file = fopen(filename, "w"); /* "w" = Write mode (create/overwrite) */
+    if (file == NULL)
+    {
+        report_error("CANNOT OPEN FILE");
+        return;
+    }
+
+    /* Write every line to the file (see `write_program_text`) */
+    if (!write_program_text(file, 0, 65535) || ferror(file))
+    {
+        fclose(file);
+        report_error("CANNOT WRITE FILE");
+        return;
+    }
+
+    if (fclose(file) != 0)
+    {
+        report_error("CANNOT WRITE FILE");
+    }
+}
+
+/**
+ * @brief load_program
+ * Loads a program from a text file, replacing the current one.
+ *
+ * Instead of inserting each line through `store_line` (which would
+ * shuffle the array on every out-of-order line), we *append* every
+ * line and sort once at the end. A file written by SAVE is already
+ * in order, which we detect, so it is loaded in a single pass.
+ *
+ * @param filename The name of the file to load.
+ * @return 1 if the file was read, 0 if it could not be opened
+ * (the error has already been reported).
+ */
+static int load_program(const char* filename)
+{
+    FILE *file;
+    int highest_line = 0;  /* The highest line number appended so far */
+    int is_sorted = 1;     /* Still strictly ascending? */
+
+    if (filename == NULL || *filename == '\0')
+    {
+        report_error("FILENAME REQUIRED");
+        return 0;
+    }
+
+    if (is_image_file(filename))
+    {
+        return load_image(filename);
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Loading program from '%s'\n", filename);
+    }
+
+    file = fopen(filename, "r"); /* "r" = Read mode */
+    if (file == NULL)
+    {
+        report_error("FILE NOT FOUND");
+        return 0;
+    }
+
+    /* 1. Clear the old program */
+    new_program();
+    remember_file(filename);
+
+    /*
+     * 2. Read every line from the file, appending each one
+     * ($MERGE and $INCLUDE lines read their files in place).
+     */
+    read_lines(file, filename, &highest_line, &is_sorted);
+    fclose(file);
+
+    /* 3. Put the lines in order, if the file was not already */
+    if (!is_sorted)
+    {
+        sort_program_storage();
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Loaded %d lines (%s).\n", ctx->line_count,
+                             is_sorted ? "already in order" : "sorted");
+    }
+    return 1;
+}
+
+/**
+ * @brief read_lines
+ * Reads a program file to its end, handing each line to `load_line`.
+ * Shared by `load_program` and `merge_file`.
+ *
+ * With IB_MAPPED_LOAD, the whole file is mapped into memory and split
+ * into lines by `scan_lines`, in one pass, with no stdio call per
+ * line. Otherwise (or if the file cannot be mapped) each line is read
+ * with `fgets`. Either way, a line too long for the line buffer is
+ * reported, by its position in the file, and skipped whole: it is
+ * never cut short or split into two lines.
+ *
+ * @param filename The name of the file, for error messages.
+ */
+static void read_lines(FILE* file, const char* filename,
+                       int* highest_line, int* is_sorted)
+{
+    /*
+     * Buffer for reading lines *from the file*.
+     * It must be large enough to hold the line number, space,
+     * and the line text.
+     */
+    char file_line_buffer[MAX_LINE_LEN + 20];
+    size_t length;
+#ifdef IB_MAPPED_LOAD
+    struct stat info;
+    char* text;
+#endif
+
+    /* A nested $MERGE reports its own file, then this one again */
+    const char* outer_name = ctx->load_file_name;
+    long outer_line = ctx->load_file_line;
+
+    ctx->load_file_name = filename;
+    ctx->load_file_line = 0;
+
+#ifdef IB_MAPPED_LOAD
+    if (fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size > 0 && (off_t)(size_t)info.st_size == info.st_size)
+    {
+        text = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (text != MAP_FAILED)
+        {
+            scan_lines(text, (size_t)info.st_size, highest_line, is_sorted);
+            munmap(text, (size_t)info.st_size);
+
+            ctx->load_file_name = outer_name;
+            ctx->load_file_line = outer_line;
+            return;
+        }
+    }
+#endif
+
+    /* `fgets` reads one line at a time into `file_line_buffer`. */
+    while (fgets(file_line_buffer, sizeof(file_line_buffer), file) != NULL)
+    {
+        ctx->load_file_line++;
+        length = strcspn(file_line_buffer, "\n");
+
+        if (file_line_buffer[length] != '\n' && !feof(file))
+        {
+            /* The buffer is full, and the line goes on: skip the rest */
+            report_load_error("LINE TOO LONG");
+            while (strchr(file_line_buffer, '\n') == NULL &&
+                   fgets(file_line_buffer, sizeof(file_line_buffer), file) != NULL)
+            {
+                /* Nothing: just read up to the end of the line */
+            }
+            continue;
+        }
+
+        /* Remove newline character */
+        file_line_buffer[strcspn(file_line_buffer, "\r\n")] = 0;
+
+        load_line(file_line_buffer, highest_line, is_sorted);
+    }
+
+    ctx->load_file_name = outer_name;
+    ctx->load_file_line = outer_line;
+}
+
+#ifdef IB_MAPPED_LOAD
+
+/**
+ * @brief scan_lines
+ * Splits a program file held in memory (see `read_lines`) into
+ * lines, and hands each one to `load_line`: each line is found with a
+ * single `memchr` for its newline, and copied once, into a buffer of
+ * the same size as `fgets` would have used, to be '\0'-terminated.
+ *
+ * @param text   The contents of the file (not '\0'-terminated).
+ * @param length The size of the file, in bytes.
+ */
+static void scan_lines(const char* text, size_t length,
+                       int* highest_line, int* is_sorted)
+{
+    char line_buffer[MAX_LINE_LEN + 20];
+    const char* end = text + length;
+    const char* line_end;
+    size_t line_length;
+
+    while (text < end)
+    {
+        line_end = memchr(text, '\n', (size_t)(end - text));
+        if (line_end == NULL)
+        {
+            line_end = end; /* The last line has no newline */
+        }
+        ctx->load_file_line++;
+
+        /* The line ends at its first '\r' (or '\n'), as with `fgets` */
+        line_length = (size_t)(line_end - text);
+        if (line_length >= sizeof(line_buffer))
+        {
+            report_load_error("LINE TOO LONG");
+        }
+        else
+        {
+            memcpy(line_buffer, text, line_length);
+            line_buffer[line_length] = '\0';
+            line_buffer[strcspn(line_buffer, "\r")] = '\0';
+
+            load_line(line_buffer, highest_line, is_sorted);
+        }
+
+        text = line_end + 1;
+    }
+}
+
+#endif
+
+/**
+ * @brief merge_program
+ * Handler for the direct-mode $MERGE and $INCLUDE: reads a program
+ * file into the program already in memory (see `merge_file`).
+ *
+ * @param is_include 1 for $INCLUDE: a file already read is skipped.
+ * @return 1 on success, 0 if the file could not be read.
+ */
+static int merge_program(const char* filename, int is_include)
+{
+    int highest_line = 0;
+    int is_sorted = 1;
+    int merged;
+
+    if (ctx->line_count > 0)
+    {
+        highest_line = LINE_NUMBER(ctx->line_count - 1);
+    }
+
+    merged = merge_file(filename, is_include, &highest_line, &is_sorted);
+
+    /*
+     * If every line came after the old program, they were simply
+     * appended. Otherwise this is one sort (for the fixed storage,
+     * a single pass which merges the two ordered runs).
+     */
+    if (!is_sorted)
+    {
+        sort_program_storage();
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Merged '%s': %d lines (%s).\n", filename,
+                             ctx->line_count, is_sorted ? "appended" : "merged");
+    }
+    return merged;
+}
+
+/**
+ * @brief merge_file
+ * Reads a program file's lines into the program in memory, as LOAD
+ * does but without a NEW first: each line is appended, and a line
+ * whose number is already in use replaces the old line once the
+ * caller sorts (the last copy wins, exactly as in a LOAD). There are
+ * no separate insertions, so the cost is one read of the file plus,
+ * at most, one sort at the end.
+ *
+ * This is $MERGE and $INCLUDE, both as direct-mode commands and as
+ * lines (with no line number) inside a file being read.
+ *
+ * @param is_include 1 for $INCLUDE: a file already read into this
+ * program (see `included_files`) is skipped, at no cost.
+ * @return 1 on success (or a skipped file), 0 on an error.
+ */
+static int merge_file(const char* filename, int is_include,
+                      int* highest_line, int* is_sorted)
+{
+    FILE *file;
+    int i;
+
+    if (filename == NULL || *filename == '\0')
+    {
+        report_error("FILENAME REQUIRED");
+        return 0;
+    }
+    if (is_image_file(filename))
+    {
+        report_error("CANNOT MERGE A PROGRAM IMAGE");
+        return 0;
+    }
+
+    if (is_include)
+    {
+        for (i = 0; i < ctx->include_count; i++)
+        {
+            if (strcmp(ctx->included_files[i], filename) == 0)
+            {
+                if (is_debug_mode)
+                {
+                    fprintf(ctx->output, "[DEBUG] '%s' is already included.\n", filename);
+                }
+                return 1;
+            }
+        }
+    }
+
+    if (ctx->include_depth >= INCLUDE_DEPTH_LIMIT)
+    {
+        report_error("MERGE NESTED TOO DEEPLY");
+        return 0;
+    }
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        report_error("FILE NOT FOUND");
+        return 0;
+    }
+    remember_file(filename);
+
+    ctx->include_depth++;
+    read_lines(file, filename, highest_line, is_sorted);
+    ctx->include_depth--;
+
+    fclose(file);
+    return 1;
+}
+
+/**
+ * @brief remember_file
+ * Adds a file name to `included_files`, unless it is already there
+ * (or the list is full, or the name is too long to keep).
+ */
+static void remember_file(const char* filename)
+{
+    int i;
+
+    if (ctx->include_count >= INCLUDE_LIMIT || strlen(filename) >= MAX_LINE_LEN)
+    {
+        return;
+    }
+    for (i = 0; i < ctx->include_count; i++)
+    {
+        if (strcmp(ctx->included_files[i], filename) == 0)
+        {
+            return;
+        }
+    }
+    strcpy(ctx->included_files[ctx->include_count], filename);
+    ctx->include_count++;
+}
+
+/**
+ * @brief load_line
+ * Adds one line of a program being loaded (by `load_program` or
+ * `ib_load_string`), with the same rules (and error messages) as a
+ * typed line, but *appended*: lines that arrive in order cost no
+ * search and no moving of other lines at all.
+ *
+ * @param line         The line, without its newline.
+ * @param highest_line The highest line number appended so far (updated).
+ * @param is_sorted    Whether the lines are still strictly ascending
+ *                     (cleared here; the caller sorts them at the end).
+ */
+static void load_line(const char* line, int* highest_line, int* is_sorted)
+{
+    int line_number;
+    const char *text_part;
+    int is_include;
+
+    /*
+     * A "$MERGE file" or "$INCLUDE file" line (with no line number)
+     * reads that file's lines in, right here.
+     */
+    text_part = line + strspn(line, " \t");
+    is_include = (ib_stricmp(text_part, "$INCLUDE") == 0);
+    if (is_include || ib_stricmp(text_part, "$MERGE") == 0)
+    {
+        text_part += is_include ? 8 : 6;
+        text_part += strspn(text_part, " \t");
+        merge_file(text_part, is_include, highest_line, is_sorted);
+        return;
+    }
+
+    if (!split_line(line, &line_number, &text_part))
+    {
+        return;
+    }
+
+    /* A typed line is cut short, but a loaded one is refused */
+    if (strlen(text_part) >= MAX_LINE_LEN)
+    {
+        report_load_error("LINE TOO LONG");
+        return;
+    }
+
+    if (line_number > *highest_line && *text_part == '\0')
+    {
+        /* Deleting a line that cannot exist yet: nothing to do. */
+        return;
+    }
+
+    /*
+     * Deletions ("10" on its own) are appended too, with empty
+     * text, and are applied by `sort_program_storage`.
+     */
+    if (append_line(line_number, text_part))
+    {
+        if (line_number <= *highest_line)
+        {
+            *is_sorted = 0;
+        }
+        else
+        {
+            *highest_line = line_number;
+        }
+        return;
+    }
+
+    /*
+     * The storage is full, but some of it may be duplicates
+     * or deletions still waiting to be applied. Apply them,
+     * then let `store_line` handle this line (a replacement
+     * still fits, a new line reports "PROGRAM MEMORY FULL").
+     */
+    if (!*is_sorted)
+    {
+        sort_program_storage();
+        *is_sorted = 1;
+    }
+    store_line(line);
+    if (ctx->line_count > 0)
+    {
+        *highest_line = LINE_NUMBER(ctx->line_count - 1);
+    }
+}
+
+
+/*
+ * =============================================================================
+ * --- Program Storage Functions ---
+ * =============================================================================
+ */
+
+/**
+ * @brief find_insert_index
+ * Finds where a line number is, or would be, in `program_storage`.
+ * Uses a binary search, since the array is kept sorted.
+ *
+ * @param line_number The BASIC line number to find (e.g., 100).
+ * @return The index of the first line >= `line_number`
+ * (`line_count` if every line is smaller).
+ */
+static int find_insert_index(int line_number)
+{
+    int low = 0;
+    int high = ctx->line_count; /* The answer is always in [low, high] */
+    int middle;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (LINE_NUMBER(middle) < line_number)
+        {
+            low = middle + 1;  /* The answer is to the right */
+        }
+        else
+        {
+            high = middle;     /* The answer is here, or to the left */
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief find_line_index
+ * Finds the array index for a given line number.
+ * Uses a binary search (see `find_insert_index`).
+ *
+ * @param line_number The BASIC line number to find (e.g., 100).
+ * @return The array index (0 to line_count-1), or -1 if not found.
+ */
+static int find_line_index(int line_number)
+{
+    int index = find_insert_index(line_number);
+
+    ctx->stats.line_lookups++;
+
+    if (index < ctx->line_count && LINE_NUMBER(index) == line_number)
+    {
+        return index; /* Found it */
+    }
+    return -1; /* Not found */
+}
+
+/**
+ * @brief resolve_jump_targets
+ * Fills in the cached line index of every GOTO/GOSUB target
+ * (TOK_LINE) in the program, all in one pass.
+ *
+ * A running program does not need this: `cmd_goto` checks each
+ * cached index as it jumps, and looks up (and re-caches) only the
+ * targets which are stale. This is for `save_image`, so that a
+ * loaded image never has to search at all.
+ */
+static void resolve_jump_targets(void)
+{
+    int i;
+    int index;
+    int line_num;
+    unsigned char* token;
+
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        /* Walk the tokens of each line, looking for TOK_LINE */
+        token = LINE_CODE(i);
+        while (*token != TOK_EOL)
+        {
+            if (*token == TOK_LINE)
+            {
+                line_num = token[1] | (token[2] << 8);
+                index = find_line_index(line_num);
+                if (index == -1)
+                {
+                    index = TARGET_MISSING;
+                }
+                token[3] = (unsigned char)(index & 0xFF);
+                token[4] = (unsigned char)((index >> 8) & 0xFF);
+            }
+            token += token_length(token);
+        }
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Resolved jump targets for %d lines.\n", ctx->line_count);
+    }
+}
+
+/**
+ * @brief token_length
+ * Returns the size, in bytes, of the token at `token`
+ * (the token byte itself plus its operands).
+ * This lets us walk a compiled line one token at a time.
+ */
+static int token_length(const unsigned char* token)
+{
+    switch (*token)
+    {
+        case TOK_NUM:   return VALUE_LEN;
+        case TOK_STR:   return 2 + token[1];
+        case TOK_LINE:  return 5;
+        case TOK_ERROR: return 2;
+        default:        return 1;
+    }
+}
+
+/**
+ * @brief split_line
+ * Splits a numbered line (e.g., "10 PRINT A") into its line
+ * number and the text that follows it.
+ *
+ * @param line_str    The full text of the line.
+ * @param line_number Receives the line number.
+ * @param text_part   Receives a pointer to the text ("PRINT A").
+ * @return 1 on success, 0 if the line number is invalid
+ * (the error has already been reported).
+ */
+static int split_line(const char* line_str, int* line_number, const char** text_part)
+{
+    /* 1. Parse the line number */
+    *line_number = atoi(line_str);
+    if (*line_number <= 0 || *line_number > 65535)
+    {
+        report_error("INVALID LINE NUMBER");
+        return 0;
+    }
+
+    /* 2. Find where the actual text begins */
+    *text_part = line_str;
+    while (isdigit((unsigned char)**text_part)) (*text_part)++; /* Skip line number */
+    while (isspace((unsigned char)**text_part)) (*text_part)++; /* Skip spaces */
+
+    return 1;
+}
+
+#ifndef IB_COMPACT_STORAGE
+
+/**
+ * @brief set_line
+ * Writes a line's number and text into a slot of `program_storage`,
+ * and tokenizes it.
+ *
+ * @param index       The slot to write.
+ * @param line_number The BASIC line number.
+ * @param text        The text of the line (without the number).
+ * @return 1 (a fixed-size slot always has room).
+ */
+static int set_line(int index, int line_number, const char* text)
+{
+    ctx->program_storage[index].line_number = line_number;
+
+    /*
+     * We MUST clear the buffer *before* copying,
+     * to ensure it's always null-terminated.
+     */
+    memset(ctx->program_storage[index].text, 0, MAX_LINE_LEN);
+    strncpy(ctx->program_storage[index].text, text, MAX_LINE_LEN - 1);
+
+    /*
+     * Tokenize the stored text.
+     * We compile from the stored copy so the tokens always match
+     * what LIST shows (including any truncation).
+     */
+    compile_line(ctx->program_storage[index].text, ctx->program_storage[index].code,
+                 LINE_CODE_LEN);
+    return 1;
+}
+
+/**
+ * @brief open_slot
+ * Makes room for a new line at `index` by moving all lines from
+ * `index` to the end down one slot (a single `memmove`).
+ * The caller must then fill the slot with `set_line`.
+ */
+static void open_slot(int index)
+{
+    memmove(&ctx->program_storage[index + 1], &ctx->program_storage[index],
+            (ctx->line_count - index) * sizeof(Line));
+    ctx->line_count++; /* The program is now one line longer */
+}
+
+/**
+ * @brief close_slot
+ * Removes the line at `index` by moving all subsequent lines up
+ * one slot (a single `memmove`) to overwrite it.
+ */
+static void close_slot(int index)
+{
+    memmove(&ctx->program_storage[index], &ctx->program_storage[index + 1],
+            (ctx->line_count - index - 1) * sizeof(Line));
+    ctx->line_count--; /* The program is now one line shorter */
+}
+
+#else
+
+/**
+ * @brief set_line
+ * Writes a line's number and text into a slot of the compact
+ * storage, and tokenizes it.
+ *
+ * The line is compiled into a scratch buffer first, so that we
+ * know the exact size of its record. The records after it are then
+ * moved up or down (a single `memmove`) so that the new record fits
+ * exactly, with no gap: the arena is always compact.
+ *
+ * @param index       The slot to write (an existing line, or one
+ *                    just opened by `open_slot`).
+ * @param line_number The BASIC line number.
+ * @param text        The text of the line (without the number).
+ * @return 1 on success, 0 if the arena is full (nothing is changed).
+ */
+static int set_line(int index, int line_number, const char* text)
+{
+    char text_copy[MAX_LINE_LEN];
+    unsigned char code[MAX_CODE_LEN];
+    unsigned char* record;
+    int text_len;
+    int code_len;
+    long new_size;
+    long old_size = ctx->line_index[index].size;
+
+    /* The same truncation as a fixed slot, so LIST looks the same */
+    memset(text_copy, 0, sizeof(text_copy));
+    strncpy(text_copy, text, MAX_LINE_LEN - 1);
+    text_len = (int)strlen(text_copy);
+
+    compile_line(text_copy, code, MAX_CODE_LEN);
+    code_len = code_length(code);
+
+    /* [length] [text] '\0' [tokens] */
+    new_size = 1 + text_len + 1 + code_len;
+    if ((long)ctx->arena_used - old_size + new_size > ctx->arena_size)
+    {
+        return 0;
+    }
+
+    shift_records(index, new_size - old_size);
+
+    record = &ctx->program_arena[ctx->line_index[index].offset];
+    record[0] = (unsigned char)text_len;
+    memcpy(&record[1], text_copy, text_len + 1);
+    memcpy(&record[2 + text_len], code, code_len);
+
+    ctx->line_index[index].line_number = (unsigned short)line_number;
+    ctx->line_index[index].size = (unsigned short)new_size;
+    return 1;
+}
+
+/**
+ * @brief shift_records
+ * Moves every record *after* slot `index` by `delta` bytes (up to
+ * make room, down to close a gap), and corrects their index entries.
+ */
+static void shift_records(int index, long delta)
+{
+    unsigned int from = ctx->line_index[index].offset + ctx->line_index[index].size;
+    int i;
+
+    if (delta == 0)
+    {
+        return;
+    }
+    memmove(&ctx->program_arena[from + delta], &ctx->program_arena[from], ctx->arena_used - from);
+    ctx->arena_used += delta;
+
+    for (i = index + 1; i < ctx->line_count; i++)
+    {
+        ctx->line_index[i].offset += delta;
+    }
+}
+
+/**
+ * @brief open_slot
+ * Makes room for a new line at `index` in `line_index`.
+ * The new slot has an empty (0-byte) record at the position where
+ * its record belongs; the caller must then fill it with `set_line`.
+ */
+static void open_slot(int index)
+{
+    memmove(&ctx->line_index[index + 1], &ctx->line_index[index],
+            (ctx->line_count - index) * sizeof(LineIndex));
+    ctx->line_count++; /* The program is now one line longer */
+
+    ctx->line_index[index].offset = (index + 1 < ctx->line_count)
+        ? ctx->line_index[index + 1].offset
+        : ctx->arena_used;
+    ctx->line_index[index].size = 0;
+}
+
+/**
+ * @brief close_slot
+ * Removes the line at `index`: its record is squeezed out of the
+ * arena (compaction), then its index entry is removed.
+ */
+static void close_slot(int index)
+{
+    shift_records(index, -(long)ctx->line_index[index].size);
+    memmove(&ctx->line_index[index], &ctx->line_index[index + 1],
+            (ctx->line_count - index - 1) * sizeof(LineIndex));
+    ctx->line_count--; /* The program is now one line shorter */
+}
+
+#endif
+
+/**
+ * @brief append_line
+ * Adds a line at the *end* of the program storage, without looking
+ * at its line number (see `load_program`).
+ *
+ * @return 1 on success, 0 if the storage is full (nothing is changed).
+ */
+static int append_line(int line_number, const char* text)
+{
+    if (ctx->line_count >= ctx->max_lines)
+    {
+        return 0;
+    }
+    open_slot(ctx->line_count);
+    if (!set_line(ctx->line_count - 1, line_number, text))
+    {
+        close_slot(ctx->line_count - 1);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief store_line
+ * Inserts or replaces a line in the program storage.
+ * This function is the core of the line editor. It handles
+ * adding, replacing, and deleting lines.
+ *
+ * It also keeps the program storage sorted by line number.
+ *
+ * @param line_str The full text of the line, e.g., "10 PRINT A".
+ */
+static void store_line(const char* line_str)
+{
+    int line_number;
+    const char *text_part;
+    int index;
+    int exists;
+
+    /* 1. Parse the line number and find where the text begins */
+    if (!split_line(line_str, &line_number, &text_part))
+    {
+        return;
+    }
+
+    /* `text_part` now points to the "PRINT A" part */
+
+    /*
+     * An edit can move lines to new indices, which leaves some of the
+     * cached GOTO/GOSUB targets stale. Nothing is done about them
+     * here: only the edited line is (re)compiled, and `cmd_goto`
+     * notices a stale target, and fixes it, when it is next used.
+     */
+
+    /*
+     * 2. Find the line, or where it would go, with one binary search.
+     */
+    index = find_insert_index(line_number);
+    exists = (index < ctx->line_count && LINE_NUMBER(index) == line_number);
+
+    /*
+     * 3. Handle "Delete Line"
+     * If the user typed just "10" (with no text after it),
+     * `text_part` will point to an empty string.
+     */
+    if (*text_part == '\0')
+    {
+        if (exists)
+        {
+            /* Line "10" exists, and the user wants to delete it. */
+            if (is_debug_mode)
+            {
+                fprintf(ctx->output, "[DEBUG] Deleting line %d at index %d.\n", line_number, index);
+            }
+            close_slot(index);
+        }
+        /* If it doesn't exist, the user tried to delete a line
+         * that isn't there, so we do nothing.
+         */
+        return;
+    }
+
+    /*
+     * 4. Handle "Replace Line"
+     * The line number *was* found, and there is text.
+     * This is a simple replacement.
+     */
+    if (exists)
+    {
+        if (is_debug_mode)
+        {
+            fprintf(ctx->output, "[DEBUG] Replacing line %d at index %d.\n", line_number, index);
+        }
+        if (!set_line(index, line_number, text_part))
+        {
+            /* Only the compact storage can run out of room here */
+            report_error("PROGRAM MEMORY FULL");
+        }
+        return;
+    }
+
+    /*
+     * 5. Handle "Insert New Line"
+     * The line number was *not* found. `index` is already the
+     * sorted position where it belongs.
+     */
+    if (ctx->line_count >= ctx->max_lines)
+    {
+        report_error("PROGRAM MEMORY FULL");
+        return;
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Inserting line %d at index %d.\n", line_number, index);
+    }
+
+    /* 6. Open an empty slot at `index`, and fill it */
+    open_slot(index);
+    if (!set_line(index, line_number, text_part))
+    {
+        close_slot(index);
+        report_error("PROGRAM MEMORY FULL");
+    }
+}
+
+#ifndef IB_COMPACT_STORAGE
+
+/**
+ * @brief compare_load_order
+ * `qsort` comparison for `sort_program_storage`.
+ * Orders slots by line number, then by their position in the file,
+ * so the sort is stable (a later copy of a line must win).
+ */
+static int compare_load_order(const void* a, const void* b)
+{
+    int slot_a = *(const int*)a;
+    int slot_b = *(const int*)b;
+    int number_a = ctx->program_storage[slot_a].line_number;
+    int number_b = ctx->program_storage[slot_b].line_number;
+
+    if (number_a != number_b)
+    {
+        return (number_a < number_b) ? -1 : 1;
+    }
+    return (slot_a < slot_b) ? -1 : (slot_a > slot_b);
+}
+
+/**
+ * @brief sort_program_storage
+ * Sorts lines that were appended out of order (see `load_program`
+ * and `merge_file`), then applies duplicates and deletions exactly as `store_line`
+ * would have: for each line number, the *last* copy wins, and a
+ * last copy with empty text deletes the line.
+ *
+ * We sort an array of slot numbers (`sort_order`), not the Line
+ * structures themselves, then move each Line just once.
+ */
+static void sort_program_storage(void)
+{
+    Line temp;
+    int i, j, source;
+    int kept;
+    int split, descents;
+
+    /*
+     * A $MERGE usually leaves two ordered runs: the old program, then
+     * the merged file. Those are merged in a single pass (the earlier
+     * run first on equal numbers, so the sort stays stable); anything
+     * else goes to `qsort`.
+     */
+    split = 0;
+    descents = 0;
+    for (i = 1; i < ctx->line_count && descents < 2; i++)
+    {
+        if (LINE_NUMBER(i) < LINE_NUMBER(i - 1))
+        {
+            split = i;
+            descents++;
+        }
+    }
+
+    if (descents == 1)
+    {
+        i = 0;
+        j = split;
+        for (kept = 0; kept < ctx->line_count; kept++)
+        {
+            if (j >= ctx->line_count || (i < split && LINE_NUMBER(i) <= LINE_NUMBER(j)))
+            {
+                ctx->sort_order[kept] = i++;
+            }
+            else
+            {
+                ctx->sort_order[kept] = j++;
+            }
+        }
+    }
+    else
+    {
+        for (i = 0; i < ctx->line_count; i++)
+        {
+            ctx->sort_order[i] = i;
+        }
+        qsort(ctx->sort_order, ctx->line_count, sizeof(ctx->sort_order[0]), compare_load_order);
+    }
+
+    /*
+     * Slot `i` must receive the line currently in `sort_order[i]`.
+     * We apply this permutation one cycle at a time, marking each
+     * finished slot with -1, so only one temporary Line is needed.
+     */
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        if (ctx->sort_order[i] < 0 || ctx->sort_order[i] == i)
+        {
+            continue; /* Already in place */
+        }
+        temp = ctx->program_storage[i];
+        j = i;
+        while (1)
+        {
+            source = ctx->sort_order[j];
+            ctx->sort_order[j] = -1;
+            if (source == i)
+            {
+                ctx->program_storage[j] = temp;
+                break;
+            }
+            ctx->program_storage[j] = ctx->program_storage[source];
+            j = source;
+        }
+    }
+
+    /* Keep only the last copy of each line, and drop deletions */
+    kept = 0;
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        if (i + 1 < ctx->line_count &&
+            ctx->program_storage[i + 1].line_number == ctx->program_storage[i].line_number)
+        {
+            continue; /* A later copy replaces this one */
+        }
+        if (ctx->program_storage[i].text[0] == '\0')
+        {
+            continue; /* The line was deleted */
+        }
+        if (kept != i)
+        {
+            ctx->program_storage[kept] = ctx->program_storage[i];
+        }
+        kept++;
+    }
+    ctx->line_count = kept;
+}
+
+#else
+
+/**
+ * @brief compare_load_order
+ * `qsort` comparison for `sort_program_storage`.
+ * Orders index entries by line number, then by the position of their
+ * record in the arena. Lines are appended in file order, so this
+ * keeps the sort stable (a later copy of a line must win).
+ */
+static int compare_load_order(const void* a, const void* b)
+{
+    const LineIndex* entry_a = (const LineIndex*)a;
+    const LineIndex* entry_b = (const LineIndex*)b;
+
+    if (entry_a->line_number != entry_b->line_number)
+    {
+        return (entry_a->line_number < entry_b->line_number) ? -1 : 1;
+    }
+    return (entry_a->offset < entry_b->offset) ? -1 : (entry_a->offset > entry_b->offset);
+}
+
+/**
+ * @brief sort_program_storage
+ * The compact-storage version: sorts lines that were appended out of
+ * order (see `load_program`), with the same duplicate and deletion
+ * rules as the fixed-slot version. It always uses `qsort`: the
+ * records have to be moved one by one afterwards in any case.
+ *
+ * Only the small index entries are sorted. The records are then
+ * moved, one by one, into line-number order, so that LIST and RUN
+ * walk the arena front to back.
+ */
+static void sort_program_storage(void)
+{
+    unsigned char temp[1 + MAX_LINE_LEN + MAX_CODE_LEN];
+    unsigned int position;
+    unsigned int offset;
+    unsigned int size;
+    int i, j;
+    int kept;
+
+    qsort(ctx->line_index, ctx->line_count, sizeof(ctx->line_index[0]), compare_load_order);
+
+    /* Keep only the last copy of each line, and drop deletions */
+    kept = 0;
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        if (i + 1 < ctx->line_count &&
+            ctx->line_index[i + 1].line_number == ctx->line_index[i].line_number)
+        {
+            continue; /* A later copy replaces this one */
+        }
+        if (ctx->program_arena[ctx->line_index[i].offset] == 0)
+        {
+            continue; /* The line was deleted (its text is empty) */
+        }
+        ctx->line_index[kept++] = ctx->line_index[i];
+    }
+    ctx->line_count = kept;
+
+    /*
+     * Everything before `position` is already in its final order.
+     * The next line's record is always at or after `position`, so we
+     * lift it out, slide the records in between up over its old
+     * place, and drop it in at `position`. Records of dropped lines
+     * are slid along too, and end up past the last kept record.
+     */
+    position = 0;
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        offset = ctx->line_index[i].offset;
+        size = ctx->line_index[i].size;
+        if (offset != position)
+        {
+            memcpy(temp, &ctx->program_arena[offset], size);
+            memmove(&ctx->program_arena[position + size], &ctx->program_arena[position],
+                    offset - position);
+            memcpy(&ctx->program_arena[position], temp, size);
+
+            for (j = i + 1; j < ctx->line_count; j++)
+            {
+                if (ctx->line_index[j].offset < offset)
+                {
+                    ctx->line_index[j].offset += size;
+                }
+            }
+            ctx->line_index[i].offset = position;
+        }
+        position += size;
+    }
+    ctx->arena_used = position;
+}
+
+#endif
+
+
+/*
+ * =============================================================================
+ * --- Memory Functions ---
+ * =============================================================================
+ */
+
+/**
+ * @brief MemoryAlign
+ * A type with the strictest alignment of any we store. Every area
+ * `memory_init` carves out starts at a multiple of its size.
+ */
+typedef union
+{
+    long l;
+    double d;
+    void* p;
+    clock_t c;
+} MemoryAlign;
+
+/**
+ * @brief context_init
+ * Gives a new interpreter context its default memory sizes, LPRINT
+ * file and console (stdout and stdin). Everything else in it starts out zero (`main_context`
+ * is static; `ib_create` allocates with `calloc`). The sizes may then
+ * be changed (`memory_option`) until `memory_init` is called.
+ */
+static void context_init(void)
+{
+    ctx->max_lines = MAX_LINES;
+    ctx->stack_size = STACK_SIZE;
+#ifdef IB_COMPACT_STORAGE
+    ctx->arena_size = PROGRAM_ARENA_SIZE;
+#endif
+    ctx->lprint_path = "lprint.out";
+    ctx->output = stdout;
+    ctx->input = stdin;
+}
+
+/**
+ * @brief memory_init
+ * Sets up the program storage, the GOSUB stack and (with --profile)
+ * the line counters of `ctx`, once, at startup (or in `ib_create`).
+ *
+ * Without IB_STATIC_MEMORY, their sizes follow `max_lines`,
+ * `stack_size` and `arena_size`, and they are all carved out of a
+ * single `malloc` block, laid out as:
+ *
+ * [line storage] [sort order | line index] [GOSUB stack] [profile counters]
+ *
+ * Nothing is allocated (or freed) after this, so a program that
+ * starts can never run out of memory half-way through a RUN: it can
+ * only fill the storage it was given ("PROGRAM MEMORY FULL").
+ *
+ * @return 1 on success, 0 if the block could not be allocated.
+ */
+static int memory_init(void)
+{
+#ifdef IB_STATIC_MEMORY
+    return 1; /* The static arrays are already in place */
+#else
+    size_t sizes[5];
+    size_t total = 0;
+    unsigned char* block;
+    int area;
+
+    /* 1. The size of each area, rounded up to keep the next aligned */
+#ifdef IB_COMPACT_STORAGE
+    sizes[0] = (size_t)ctx->arena_size;
+    sizes[1] = (size_t)ctx->max_lines * sizeof(LineIndex);
+#else
+    sizes[0] = (size_t)ctx->max_lines * sizeof(Line);
+    sizes[1] = (size_t)ctx->max_lines * sizeof(int);
+#endif
+    sizes[2] = (size_t)ctx->stack_size * sizeof(GosubFrame);
+    sizes[3] = is_profile_mode ? (size_t)ctx->max_lines * sizeof(unsigned long) : 0;
+    sizes[4] = is_profile_mode ? (size_t)ctx->max_lines * sizeof(clock_t) : 0;
+
+    for (area = 0; area < 5; area++)
+    {
+        sizes[area] = (sizes[area] + sizeof(MemoryAlign) - 1) /
+                      sizeof(MemoryAlign) * sizeof(MemoryAlign);
+        total += sizes[area];
+    }
+
+    /* 2. The one allocation */
+    block = (unsigned char*)malloc(total);
+    if (block == NULL)
+    {
+        return 0;
+    }
+    ctx->memory_block = block;
+
+    /* 3. Hand out the areas, in order */
+#ifdef IB_COMPACT_STORAGE
+    ctx->program_arena = block;
+    ctx->line_index = (LineIndex*)(block + sizes[0]);
+#else
+    ctx->program_storage = (Line*)block;
+    ctx->sort_order = (int*)(block + sizes[0]);
+#endif
+    block += sizes[0] + sizes[1];
+    ctx->gosub_stack = (GosubFrame*)block;
+    block += sizes[2];
+    ctx->profile_line_hits = is_profile_mode ? (unsigned long*)block : NULL;
+    block += sizes[3];
+    ctx->profile_line_time = is_profile_mode ? (clock_t*)block : NULL;
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Allocated %lu bytes: %d lines, %d GOSUB levels.\n",
+                             (unsigned long)total, ctx->max_lines, ctx->stack_size);
+    }
+    return 1;
+#endif
+}
+
+#ifndef IB_LIBRARY
+/**
+ * @brief memory_option
+ * Applies one memory size option, from the command line (--lines,
+ * --stack, --arena-bytes) or the environment (IB_LINES, IB_STACK,
+ * IB_ARENA_BYTES). It must be called before `memory_init`.
+ *
+ * @param name The option or variable name.
+ * @param text Its value.
+ * @return 1 on success, 0 if it was refused (the reason is on stderr).
+ */
+static int memory_option(const char* name, const char* text)
+{
+#ifdef IB_STATIC_MEMORY
+    (void)text;
+    fprintf(stderr, "%s: not available (compiled with IB_STATIC_MEMORY)\n", name);
+    return 0;
+#else
+    long value;
+
+    if (strcmp(name, "--lines") == 0 || strcmp(name, "IB_LINES") == 0)
+    {
+        if (!parse_limit(name, text, LINES_LIMIT, &value)) return 0;
+        ctx->max_lines = (int)value;
+    }
+    else if (strcmp(name, "--stack") == 0 || strcmp(name, "IB_STACK") == 0)
+    {
+        if (!parse_limit(name, text, STACK_LIMIT, &value)) return 0;
+        ctx->stack_size = (int)value;
+    }
+    else
+    {
+#ifdef IB_COMPACT_STORAGE
+        if (!parse_limit(name, text, ARENA_BYTES_LIMIT, &value)) return 0;
+        ctx->arena_size = value;
+#else
+        (void)value;
+        fprintf(stderr, "%s: only available with IB_COMPACT_STORAGE\n", name);
+        return 0;
+#endif
+    }
+    return 1;
+#endif
+}
+
+/**
+ * @brief parse_limit
+ * Reads the value of a size or limit option (e.g., "--lines 2000").
+ * Reports a bad value on stderr.
+ *
+ * @param name  The option or variable name, for the message.
+ * @param text  The value, as typed.
+ * @param limit The largest value allowed (the smallest is 1).
+ * @param value Receives the value.
+ * @return 1 on success, 0 if the value is not a number from 1 to `limit`.
+ */
+static int parse_limit(const char* name, const char* text, long limit, long* value)
+{
+    char* end_ptr;
+    long parsed = strtol(text, &end_ptr, 10);
+
+    if (end_ptr == text || *end_ptr != '\0' || parsed < 1 || parsed > limit)
+    {
+        fprintf(stderr, "%s: expected a number from 1 to %ld, not '%s'\n",
+                name, limit, text);
+        return 0;
+    }
+    *value = parsed;
+    return 1;
+}
+#endif
+
+
+#ifndef IB_LIBRARY
+
+/*
+ * =============================================================================
+ * --- Batch Job Functions ---
+ * =============================================================================
+ */
+
+/**
+ * @brief run_job
+ * Runs one program file in script mode (LOAD, then RUN) in the
+ * current context, `ctx`.
+ *
+ * @param filename The program to run.
+ * @return 0 if it ended normally, 1 if an error was reported, 2 if
+ * the file could not be read (the exit statuses of script mode).
+ */
+static int run_job(const char* filename)
+{
+    ctx->error_count = 0;
+    if (!load_program(filename))
+    {
+        return 2;
+    }
+    run_program(0);
+    return (ctx->error_count > 0) ? 1 : 0;
+}
+
+/**
+ * @brief job_finished
+ * Notes the status of a finished job in the batch's status (the
+ * highest so far), and names the program on stderr if it failed.
+ */
+static void job_finished(const char* filename, int job_status, int* status)
+{
+    if (job_status != 0)
+    {
+        fflush(stdout); /* Its own messages come first */
+        fprintf(stderr, "%s: exit status %d\n", filename, job_status);
+    }
+    if (job_status > *status)
+    {
+        *status = job_status;
+    }
+}
+
+/**
+ * @brief read_manifest_line
+ * Reads the next program file name from a --manifest file: one per
+ * line, with surrounding spaces removed and blank lines skipped.
+ *
+ * @param file   The manifest.
+ * @param buffer Receives the name.
+ * @param size   The size of `buffer`.
+ * @return 1 if a name was read, 0 at the end of the file.
+ */
+static int read_manifest_line(FILE* file, char* buffer, int size)
+{
+    char* start;
+    size_t length;
+
+    while (fgets(buffer, size, file) != NULL)
+    {
+        start = buffer;
+        while (isspace((unsigned char)*start)) start++;
+        length = strlen(start);
+        while (length > 0 && isspace((unsigned char)start[length - 1])) length--;
+        if (length > 0)
+        {
+            memmove(buffer, start, length);
+            buffer[length] = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifdef IB_THREADS
+
+/**
+ * @brief job_worker
+ * The body of each worker thread. It creates its own interpreter (the
+ * same sizes and limits as the main one), then runs jobs until none
+ * are left. A job's console is its `output` file, it has no INPUT,
+ * and its LPRINTs go to its `lprint` file.
+ *
+ * @param arg The JobQueue.
+ * @return NULL.
+ */
+static void* job_worker(void* arg)
+{
+    JobQueue* queue = (JobQueue*)arg;
+    IB_Context* context;
+    Job* job;
+    int has_memory = 0;
+
+    /* 1. This thread's own interpreter */
+    context = (IB_Context*)calloc(1, sizeof(IB_Context));
+    if (context != NULL)
+    {
+        ctx = context;
+        context_init();
+        ctx->max_lines = main_context.max_lines;
+        ctx->stack_size = main_context.stack_size;
+#ifdef IB_COMPACT_STORAGE
+        ctx->arena_size = main_context.arena_size;
+#endif
+        ctx->max_steps = main_context.max_steps;
+        ctx->timeout_seconds = main_context.timeout_seconds;
+        ctx->is_trace_mode = main_context.is_trace_mode;
+        has_memory = memory_init();
+    }
+
+    /* 2. Take jobs until there are none left */
+    while (1)
+    {
+        pthread_mutex_lock(&queue->lock);
+        job = (queue->next < queue->count) ? &queue->jobs[queue->next++] : NULL;
+        pthread_mutex_unlock(&queue->lock);
+        if (job == NULL)
+        {
+            break;
+        }
+
+        job->output = tmpfile();
+        job->lprint = tmpfile();
+        if (!has_memory || job->output == NULL || job->lprint == NULL)
+        {
+            fprintf(stderr, "%s: not enough memory to run it\n", job->filename);
+            job->status = 2;
+        }
+        else
+        {
+            ctx->output = job->output;
+            ctx->input = NULL;
+            ctx->lprint_sink = job->lprint;
+            job->status = run_job(job->filename);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&queue->finished);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    /* 3. Count its work in the totals, and free the interpreter */
+    if (context != NULL)
+    {
+        pthread_mutex_lock(&queue->lock);
+        stats_merge(&main_context.stats, &context->stats);
+        pthread_mutex_unlock(&queue->lock);
+        free(context->memory_block);
+        free(context);
+    }
+    return NULL;
+}
+
+/**
+ * @brief show_file
+ * Copies a job's temporary file (from its start) to `out`.
+ * @return The number of bytes copied.
+ */
+static long show_file(FILE* file, FILE* out)
+{
+    char buffer[4096];
+    size_t count;
+    long total = 0;
+
+    rewind(file);
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        fwrite(buffer, 1, count, out);
+        total += (long)count;
+    }
+    return total;
+}
+
+/**
+ * @brief add_job
+ * Appends a copy of a program file name to a growing list of jobs.
+ * @return 1 on success, 0 if there is not enough memory (the list
+ * is left as it was).
+ */
+static int add_job(Job** jobs, int* count, int* capacity, const char* filename)
+{
+    Job* grown;
+    int grown_capacity;
+
+    if (*count == *capacity)
+    {
+        /* The list (and `capacity`) only change if it could grow */
+        grown_capacity = (*capacity > 0) ? *capacity * 2 : 16;
+        grown = (Job*)realloc(*jobs, (size_t)grown_capacity * sizeof(Job));
+        if (grown == NULL)
+        {
+            return 0;
+        }
+        *jobs = grown;
+        *capacity = grown_capacity;
+    }
+    memset(&(*jobs)[*count], 0, sizeof(Job));
+    (*jobs)[*count].filename = (char*)malloc(strlen(filename) + 1);
+    if ((*jobs)[*count].filename == NULL)
+    {
+        return 0;
+    }
+    strcpy((*jobs)[*count].filename, filename);
+    (*count)++;
+    return 1;
+}
+
+#endif
+
+/**
+ * @brief run_jobs
+ * Batch mode (ib --jobs N): runs every program named on the command
+ * line and in the --manifest file, each exactly as `ib program.bas
+ * --run` would, but in this one process, so no job pays for starting
+ * an interpreter.
+ *
+ * With IB_THREADS, N worker threads run the jobs at the same time,
+ * each in its own context. Each job's output is kept apart, and shown
+ * (PRINT output on stdout, LPRINT output appended to the --lprint
+ * file) whole, as soon as it and every job before it have finished:
+ * the results are exactly those of running them one after another,
+ * which is what happens without IB_THREADS (or with --jobs 1).
+ *
+ * @param files        The program files named on the command line.
+ * @param file_count   How many there are.
+ * @param manifest     A file listing more of them, or NULL.
+ * @param worker_count The number of jobs to run at once (N).
+ * @return The highest exit status of any job (0, 1 or 2), or 2 if the
+ * manifest could not be read.
+ */
+static int run_jobs(const char* const* files, int file_count,
+                    const char* manifest, int worker_count)
+{
+    char name_buffer[FILENAME_MAX];
+    FILE* manifest_file = NULL;
+    int status = 0;
+    int i;
+#ifdef IB_THREADS
+    Job* jobs = NULL;
+    int job_count = 0;
+    int job_capacity = 0;
+    JobQueue queue;
+    pthread_t workers[JOBS_LIMIT];
+    int started = 0;
+    FILE* printer;
+    void (*previous_handler)(int);
+#endif
+
+    if (manifest != NULL)
+    {
+        manifest_file = fopen(manifest, "r");
+        if (manifest_file == NULL)
+        {
+            fprintf(stderr, "%s: cannot read the manifest\n", manifest);
+            return 2;
+        }
+    }
+
+    is_job_mode = 1;
+    break_requested = 0;
+
+#ifdef IB_THREADS
+    if (worker_count > 1)
+    {
+        /* 1. The list of jobs (one that does not fit fails, the rest still run) */
+        for (i = 0; i < file_count; i++)
+        {
+            if (!add_job(&jobs, &job_count, &job_capacity, files[i]))
+            {
+                fprintf(stderr, "%s: not enough memory for the job\n", files[i]);
+                status = 2;
+            }
+        }
+        while (manifest_file != NULL &&
+               read_manifest_line(manifest_file, name_buffer, sizeof(name_buffer)))
+        {
+            if (!add_job(&jobs, &job_count, &job_capacity, name_buffer))
+            {
+                fprintf(stderr, "%s: not enough memory for the job\n", name_buffer);
+                status = 2;
+            }
+        }
+
+        /* 2. Start the workers (no more than there are jobs) */
+        previous_handler = install_interrupt_handler();
+        queue.jobs = jobs;
+        queue.count = job_count;
+        queue.next = 0;
+        pthread_mutex_init(&queue.lock, NULL);
+        pthread_cond_init(&queue.finished, NULL);
+        while (started < worker_count && started < job_count &&
+               pthread_create(&workers[started], NULL, job_worker, &queue) == 0)
+        {
+            started++;
+        }
+        if (started == 0 && job_count > 0)
+        {
+            job_worker(&queue); /* No threads at all: do the work here */
+        }
+
+        /* 3. Show each job's output, in order, as soon as it is done */
+        for (i = 0; i < job_count; i++)
+        {
+            pthread_mutex_lock(&queue.lock);
+            while (!jobs[i].done)
+            {
+                pthread_cond_wait(&queue.finished, &queue.lock);
+            }
+            pthread_mutex_unlock(&queue.lock);
+
+            if (jobs[i].output != NULL)
+            {
+                show_file(jobs[i].output, stdout);
+                fclose(jobs[i].output);
+            }
+            if (jobs[i].lprint != NULL)
+            {
+                /* Like LPRINT itself, only create the file if it is used */
+                if (ftell(jobs[i].lprint) > 0)
+                {
+                    printer = fopen(main_context.lprint_path, "a");
+                    if (printer != NULL)
+                    {
+                        show_file(jobs[i].lprint, printer);
+                        fclose(printer);
+                    }
+                }
+                fclose(jobs[i].lprint);
+            }
+            job_finished(jobs[i].filename, jobs[i].status, &status);
+        }
+
+        /* 4. Clean up */
+        for (i = 0; i < started; i++)
+        {
+            pthread_join(workers[i], NULL);
+        }
+        pthread_mutex_destroy(&queue.lock);
+        pthread_cond_destroy(&queue.finished);
+        signal(SIGINT, previous_handler);
+        for (i = 0; i < job_count; i++)
+        {
+            free(jobs[i].filename);
+        }
+        free(jobs);
+    }
+    else
+#endif
+    {
+        /* One at a time, in the main context, straight to stdout */
+        (void)worker_count;
+        ctx->input = NULL; /* As in a threaded batch: no console input */
+        install_interrupt_handler();
+        for (i = 0; i < file_count; i++)
+        {
+            job_finished(files[i], run_job(files[i]), &status);
+        }
+        while (manifest_file != NULL &&
+               read_manifest_line(manifest_file, name_buffer, sizeof(name_buffer)))
+        {
+            job_finished(name_buffer, run_job(name_buffer), &status);
+        }
+    }
+
+    if (manifest_file != NULL)
+    {
+        fclose(manifest_file);
+    }
+    fflush(stdout);
+    return status;
+}
+
+#endif
+
+
+/*
+ * =============================================================================
+ * --- Profiler Functions ---
+ * =============================================================================
+ */
+
+/*
+ * With --profile, every RUN counts how many times each line was
+ * executed and how much processor time (`clock`) it took, and how many
+ * times each command was executed (including those after THEN).
+ * A line's time includes everything it does, so a GOSUB line is charged
+ * only for the jump, and an INPUT line includes the wait for the user.
+ */
+
+/**
+ * @brief profile_reset
+ * Clears all the --profile counters, at the start of each RUN.
+ */
+static void profile_reset(void)
+{
+    memset(ctx->profile_line_hits, 0, ctx->max_lines * sizeof(ctx->profile_line_hits[0]));
+    memset(ctx->profile_line_time, 0, ctx->max_lines * sizeof(ctx->profile_line_time[0]));
+    memset(ctx->profile_command_hits, 0, sizeof(ctx->profile_command_hits));
+}
+
+/**
+ * @brief profile_report
+ * Prints the --profile report to stderr (so it never mixes with the
+ * program's own output): the PROFILE_TOP_LINES lines that took the
+ * most time (then the most hits), and the count of every command used.
+ *
+ * The lines are picked by repeated passes for the largest remaining
+ * line, which needs no extra memory for sorting; a pass that picks
+ * a line clears its hit count, so that it is not picked again.
+ */
+static void profile_report(void)
+{
+    unsigned long total_hits = 0;
+    clock_t total_time = 0;
+    int i, rank, best;
+
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        total_hits += ctx->profile_line_hits[i];
+        total_time += ctx->profile_line_time[i];
+    }
+
+    fprintf(stderr, "--- PROFILE: %lu lines executed, %.3f ms ---\n",
+            total_hits, (double)total_time * 1000.0 / CLOCKS_PER_SEC);
+    fprintf(stderr, "%8s %12s %12s %7s  %s\n", "LINE", "HITS", "TIME (ms)", "TIME %", "TEXT");
+
+    for (rank = 0; rank < PROFILE_TOP_LINES; rank++)
+    {
+        best = -1;
+        for (i = 0; i < ctx->line_count; i++)
+        {
+            if (ctx->profile_line_hits[i] == 0)
+            {
+                continue;
+            }
+            if (best < 0 ||
+                ctx->profile_line_time[i] > ctx->profile_line_time[best] ||
+                (ctx->profile_line_time[i] == ctx->profile_line_time[best] &&
+                 ctx->profile_line_hits[i] > ctx->profile_line_hits[best]))
+            {
+                best = i;
+            }
+        }
+        if (best < 0)
+        {
+            break; /* Every line that ran has been listed */
+        }
+
+        fprintf(stderr, "%8d %12lu %12.3f %6.1f%%  %s\n",
+                LINE_NUMBER(best), ctx->profile_line_hits[best],
+                (double)ctx->profile_line_time[best] * 1000.0 / CLOCKS_PER_SEC,
+                total_time > 0 ? 100.0 * ctx->profile_line_time[best] / total_time : 0.0,
+                LINE_TEXT(best));
+        ctx->profile_line_hits[best] = 0;
+    }
+
+    fprintf(stderr, "%8s %12s\n", "COMMAND", "HITS");
+    for (i = 0; i < keyword_count; i++)
+    {
+        if (ctx->profile_command_hits[i] > 0)
+        {
+            fprintf(stderr, "%8s %12lu\n", keyword_table[i].name, ctx->profile_command_hits[i]);
+        }
+    }
+}
+
+/**
+ * @brief profile_write_csv
+ * Writes the --profile counters to `profile_csv_path`, one row per
+ * line that ran and per command used, in program/table order:
+ *
+ * kind,name,hits,ms
+ * line,20,10000,1.234
+ * command,PRINT,10000,
+ */
+static void profile_write_csv(void)
+{
+    FILE* file;
+    int i;
+
+    file = fopen(profile_csv_path, "w");
+    if (file == NULL)
+    {
+        report_error("CANNOT OPEN PROFILE FILE");
+        return;
+    }
+
+    fprintf(file, "kind,name,hits,ms\n");
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        if (ctx->profile_line_hits[i] > 0)
+        {
+            fprintf(file, "line,%d,%lu,%.3f\n", LINE_NUMBER(i), ctx->profile_line_hits[i],
+                    (double)ctx->profile_line_time[i] * 1000.0 / CLOCKS_PER_SEC);
+        }
+    }
+    for (i = 0; i < keyword_count; i++)
+    {
+        if (ctx->profile_command_hits[i] > 0)
+        {
+            fprintf(file, "command,%s,%lu,\n", keyword_table[i].name, ctx->profile_command_hits[i]);
+        }
+    }
+    fclose(file);
+}
+
+
+/*
+ * =============================================================================
+ * --- Statistics Functions ---
+ * =============================================================================
+ */
+
+/**
+ * @brief stats_clock
+ * The wall-clock time, in seconds, for timing a RUN. (Unlike `clock`,
+ * this includes the time spent waiting, e.g. for INPUT.)
+ */
+static double stats_clock(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+}
+
+/**
+ * @brief stats_run_finished
+ * Adds a finished RUN to the counters: its statements, which
+ * `poll_interrupts` has been counting all along (the ones since its
+ * last check are those its countdown has used up), and its time.
+ *
+ * @param started When the RUN started (`stats_clock`).
+ */
+static void stats_run_finished(double started)
+{
+    double seconds = stats_clock() - started;
+    unsigned long statements;
+
+    statements = (unsigned long)(ctx->run_steps + ctx->poll_chunk - ctx->poll_countdown);
+    ctx->stats.runs++;
+    ctx->stats.statements += statements;
+    ctx->stats.last_statements = statements;
+    ctx->stats.last_seconds = (seconds > 0.0) ? seconds : 0.0;
+    ctx->stats.total_seconds += ctx->stats.last_seconds;
+}
+
+#ifndef IB_LIBRARY
+#ifdef IB_THREADS
+/**
+ * @brief stats_merge
+ * Adds a --jobs worker's counters into the main interpreter's, so
+ * that --stats-json covers every job (called under the queue lock).
+ */
+static void stats_merge(RunStats* total, const RunStats* part)
+{
+    total->runs += part->runs;
+    total->statements += part->statements;
+    total->last_statements = part->last_statements;
+    total->jumps += part->jumps;
+    total->gosubs += part->gosubs;
+    total->line_lookups += part->line_lookups;
+    total->lprint_writes += part->lprint_writes;
+    total->errors += part->errors;
+    if (part->max_gosub_depth > total->max_gosub_depth)
+    {
+        total->max_gosub_depth = part->max_gosub_depth;
+    }
+    total->last_seconds = part->last_seconds;
+    total->total_seconds += part->total_seconds;
+}
+#endif
+
+/**
+ * @brief stats_write_json
+ * Writes the counters of `main_context` to `stats_json_path`, as one
+ * JSON object. Registered with `atexit` by --stats-json, so that it
+ * runs however the interpreter exits (the end of the input, QUIT,
+ * or the end of a script or a batch).
+ */
+static void stats_write_json(void)
+{
+    const RunStats* stats = &main_context.stats;
+    FILE* file;
+
+    file = fopen(stats_json_path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "%s: cannot write the statistics\n", stats_json_path);
+        return;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"dialect\": \"%s\",\n", current_dialect_name);
+    fprintf(file, "  \"runs\": %lu,\n", stats->runs);
+    fprintf(file, "  \"statements\": %lu,\n", stats->statements);
+    fprintf(file, "  \"last_run_statements\": %lu,\n", stats->last_statements);
+    fprintf(file, "  \"gotos\": %lu,\n", stats->jumps - stats->gosubs);
+    fprintf(file, "  \"gosubs\": %lu,\n", stats->gosubs);
+    fprintf(file, "  \"max_gosub_depth\": %d,\n", stats->max_gosub_depth);
+    fprintf(file, "  \"stack_size\": %d,\n", main_context.stack_size);
+    fprintf(file, "  \"line_lookups\": %lu,\n", stats->line_lookups);
+    fprintf(file, "  \"lprint_writes\": %lu,\n", stats->lprint_writes);
+    fprintf(file, "  \"errors\": %lu,\n", stats->errors);
+    fprintf(file, "  \"last_run_seconds\": %.6f,\n", stats->last_seconds);
+    fprintf(file, "  \"total_run_seconds\": %.6f\n", stats->total_seconds);
+    fprintf(file, "}\n");
+    fclose(file);
+}
+#endif
+
+
+/*
+ * =============================================================================
+ * --- Trace Functions ---
+ * =============================================================================
+ */
+
+/**
+ * @brief trace_record
+ * Notes the statement about to run (at `code_ptr`, on the line before
+ * `program_counter`) in the next slot of the `trace` ring. Called by
+ * the execution loops, before each statement, while `is_trace_mode`
+ * is set. It only stores three fields: there is no I/O until a
+ * `trace_dump`.
+ */
+static void trace_record(void)
+{
+    TraceEntry* entry = &ctx->trace[ctx->trace_count % TRACE_SIZE];
+
+    entry->line_index = ctx->program_counter - 1;
+    entry->opcode = *ctx->code_ptr;
+    entry->variable = -1;
+    ctx->trace_count++;
+}
+
+/**
+ * @brief trace_variable
+ * Adds an assignment (LET, INPUT, FOR, NEXT) to the statement last
+ * noted by `trace_record`. A statement which assigns several
+ * variables (INPUT A, B) keeps the last of them.
+ */
+static void trace_variable(int var_index, Value value)
+{
+    TraceEntry* entry;
+
+    if (ctx->trace_count == 0 || !ctx->is_program_mode)
+    {
+        return; /* A direct-mode statement is not traced */
+    }
+    entry = &ctx->trace[(ctx->trace_count - 1) % TRACE_SIZE];
+    entry->variable = (signed char)var_index;
+    entry->value = value;
+}
+
+/**
+ * @brief trace_opcode_name
+ * The name of a traced statement's command, for `trace_dump`.
+ */
+static const char* trace_opcode_name(unsigned char opcode)
+{
+    if (opcode >= OP_BASE && opcode < OP_BASE + keyword_count)
+    {
+        return keyword_table[opcode - OP_BASE].name;
+    }
+    if (opcode == OP_LET_ADD)
+    {
+        return "LET";
+    }
+    if (opcode >= OP_IF_EQ && opcode <= OP_IF_GT)
+    {
+        return "IF";
+    }
+    if (opcode == TOK_ERROR)
+    {
+        return "(ERROR)";
+    }
+    return "(EMPTY)";
+}
+
+/**
+ * @brief trace_dump
+ * Writes the `trace` ring, oldest statement first, one per line:
+ * its line number, its command and the assignment it made, if any.
+ * Called for TRACE (to the console), and when an error or a BREAK
+ * stops a traced program (to stderr, apart from its output).
+ *
+ * A line index which no longer exists (the program has been edited
+ * since the RUN) is shown as "?".
+ */
+static void trace_dump(FILE* file)
+{
+    const TraceEntry* entry;
+    unsigned long first;
+    unsigned long i;
+
+    first = 0;
+    if (ctx->trace_count > TRACE_SIZE)
+    {
+        first = ctx->trace_count - TRACE_SIZE;
+    }
+
+    fprintf(file, "TRACE: LAST %lu OF %lu STATEMENTS\n",
+                  ctx->trace_count - first, ctx->trace_count);
+    for (i = first; i < ctx->trace_count; i++)
+    {
+        entry = &ctx->trace[i % TRACE_SIZE];
+        if (entry->line_index >= 0 && entry->line_index < ctx->line_count)
+        {
+            fprintf(file, "%5d ", LINE_NUMBER(entry->line_index));
+        }
+        else
+        {
+            fprintf(file, "%5s ", "?");
+        }
+
+        if (entry->variable >= 0)
+        {
+            fprintf(file, "%-8s %c = %ld\n", trace_opcode_name(entry->opcode),
+                          'A' + entry->variable, (long)entry->value);
+        }
+        else
+        {
+            fprintf(file, "%s\n", trace_opcode_name(entry->opcode));
+        }
+    }
+    fflush(file);
+}
+
+
+/*
+ * =============================================================================
+ * --- Program Image Functions ---
+ * =============================================================================
+ */
+
+/*
+ * A program image (.ibc file) is the program exactly as it sits in
+ * memory after LOAD: every line's text *and* its tokens, with all
+ * GOTO/GOSUB targets already resolved. Loading one skips the
+ * line-number parsing, the tokenizer and the target resolution.
+ *
+ * All numbers are little-endian, written byte by byte, so an image
+ * can be moved between machines (and between the fixed and compact
+ * storage builds).
+ *
+ * [header, IMAGE_HEADER_LEN bytes]
+ *   'I' 'B' 'C' 0x1A       Magic number
+ *   version                IMAGE_FORMAT (IMAGE_VERSION and the value width)
+ *   keyword count          The opcodes depend on the keyword table
+ *   line count             2 bytes
+ *   record bytes           4 bytes (the size of the record area)
+ *   checksum               4 bytes (FNV-1a of the table and records)
+ * [line table, 4 bytes per line]
+ *   line number            2 bytes
+ *   record size            2 bytes
+ * [record area, one record per line, in order]
+ *   [text length] [text ...] '\0' [tokens ...] TOK_EOL
+ *
+ * (The record is the same layout the compact storage keeps in its
+ * arena, so a compact build reads the whole area in one `fread`.)
+ */
+
+/**
+ * @brief is_image_file
+ * Returns 1 if `filename` ends in ".ibc" (in any case): SAVE and
+ * LOAD then use the program image format instead of text.
+ */
+static int is_image_file(const char* filename)
+{
+    size_t length = strlen(filename);
+
+    if (length < 4)
+    {
+        return 0;
+    }
+    return ib_stricmp(filename + length - 4, IMAGE_EXTENSION) == 0;
+}
+
+/**
+ * @brief image_checksum
+ * Adds `length` bytes to a running 32-bit FNV-1a checksum
+ * (the same hash `keyword_hash_of` uses). Start with IMAGE_CHECKSUM_SEED.
+ */
+static unsigned long image_checksum(unsigned long sum, const unsigned char* data,
+                                    unsigned long length)
+{
+    while (length-- > 0)
+    {
+        sum ^= *data++;
+        sum = (sum * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    return sum;
+}
+
+/**
+ * @brief put_le
+ * Stores `value` into `bytes` bytes at `out`, low byte first.
+ */
+static void put_le(unsigned char* out, unsigned long value, int bytes)
+{
+    while (bytes-- > 0)
+    {
+        *out++ = (unsigned char)(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+/**
+ * @brief get_le
+ * Reads a `bytes`-byte, low-byte-first number from `in`.
+ */
+static unsigned long get_le(const unsigned char* in, int bytes)
+{
+    unsigned long value = 0;
+
+    while (bytes-- > 0)
+    {
+        value = (value << 8) | in[bytes];
+    }
+    return value;
+}
+
+/**
+ * @brief code_length
+ * Returns the size, in bytes, of a compiled line, *including*
+ * its TOK_EOL.
+ */
+static int code_length(const unsigned char* code)
+{
+    const unsigned char* token = code;
+
+    while (*token != TOK_EOL)
+    {
+        token += token_length(token);
+    }
+    return (int)(token - code) + 1;
+}
+
+/**
+ * @brief is_valid_code
+ * Checks the tokens of a record read from an image: an image is
+ * never compiled again, so RUN would otherwise trust whatever bytes
+ * it holds (and the checksum only guards against damage, not a file
+ * made by hand). Every opcode must be one the interpreter knows, every
+ * TOK_ERROR must carry an ERR_* code, every operand must lie inside
+ * the record, and the tokens must end with its final TOK_EOL.
+ *
+ * @param code     The compiled line.
+ * @param code_len Its size in the record, TOK_EOL included.
+ * @return 1 if the tokens are sound, 0 if not.
+ */
+static int is_valid_code(const unsigned char* code, int code_len)
+{
+    int position = 0;
+    unsigned char token;
+
+    while (position < code_len - 1)
+    {
+        token = code[position];
+        if (token == TOK_EOL ||
+            (token > TOK_VAR + NUM_VARIABLES - 1 && token < OP_LET_ADD) ||
+            (token > OP_IF_GT && token != OP_NOP && token < OP_BASE) ||
+            token >= OP_BASE + keyword_count)
+        {
+            return 0;
+        }
+        /* A TOK_STR's length byte must itself be inside the record */
+        if ((token == TOK_STR || token == TOK_ERROR) && position + 1 >= code_len - 1)
+        {
+            return 0;
+        }
+        if (token == TOK_ERROR &&
+            code[position + 1] >= sizeof(error_messages) / sizeof(error_messages[0]))
+        {
+            return 0;
+        }
+        position += token_length(&code[position]);
+    }
+    return position == code_len - 1 && code[position] == TOK_EOL;
+}
+
+/**
+ * @brief save_image
+ * Writes the program to `filename` as a program image
+ * (see `write_image`).
+ */
+static void save_image(const char* filename)
+{
+    FILE *file;
+
+    file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        report_error("CANNOT OPEN FILE");
+        return;
+    }
+
+    if (!write_image(file))
+    {
+        report_error("CANNOT WRITE FILE");
+    }
+    fclose(file);
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Saved image of %d lines.\n", ctx->line_count);
+    }
+}
+
+/**
+ * @brief write_image
+ * Writes the program to `file`, from its start, as a program image;
+ * the file is left positioned at the end of the image (a snapshot
+ * continues there; see `save_snapshot`).
+ * The file is written in two passes over the program: the line table
+ * (from which the checksum and sizes are known), then the records.
+ *
+ * @return 1 on success, 0 on a write error.
+ */
+static int write_image(FILE* file)
+{
+    unsigned char header[IMAGE_HEADER_LEN];
+    unsigned char entry[4];
+    unsigned char text_len;
+    unsigned long record_bytes = 0;
+    unsigned long sum = IMAGE_CHECKSUM_SEED;
+    int code_len;
+    int i;
+
+    /* The cached targets are part of the image, so make them correct */
+    resolve_jump_targets();
+
+    /* Reserve the header; it is filled in at the end */
+    memset(header, 0, sizeof(header));
+    fwrite(header, 1, sizeof(header), file);
+
+    /* 1. The line table */
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        code_len = code_length(LINE_CODE(i));
+        put_le(&entry[0], (unsigned long)LINE_NUMBER(i), 2);
+        put_le(&entry[2], (unsigned long)(1 + strlen(LINE_TEXT(i)) + 1 + code_len), 2);
+        record_bytes += get_le(&entry[2], 2);
+        sum = image_checksum(sum, entry, 4);
+        fwrite(entry, 1, 4, file);
+    }
+
+    /* 2. The records */
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        text_len = (unsigned char)strlen(LINE_TEXT(i));
+        code_len = code_length(LINE_CODE(i));
+
+        sum = image_checksum(sum, &text_len, 1);
+        sum = image_checksum(sum, (const unsigned char*)LINE_TEXT(i), text_len + 1);
+        sum = image_checksum(sum, LINE_CODE(i), code_len);
+
+        fputc(text_len, file);
+        fwrite(LINE_TEXT(i), 1, text_len + 1, file);
+        fwrite(LINE_CODE(i), 1, code_len, file);
+    }
+
+    /* 3. Now that everything is known, write the real header */
+    header[0] = 'I';
+    header[1] = 'B';
+    header[2] = 'C';
+    header[3] = 0x1A;
+    header[4] = IMAGE_FORMAT;
+    header[5] = (unsigned char)keyword_count;
+    put_le(&header[6], (unsigned long)ctx->line_count, 2);
+    put_le(&header[8], record_bytes, 4);
+    put_le(&header[12], sum, 4);
+    fseek(file, 0L, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+    fseek(file, 0L, SEEK_END);
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Wrote image of %d lines (%lu record bytes).\n",
+                             ctx->line_count, record_bytes);
+    }
+    return !ferror(file);
+}
+
+/**
+ * @brief read_image_records
+ * Reads the record area of an image into the program storage,
+ * whose index (line numbers and record sizes) has already been set
+ * up from the line table by `load_image`.
+ *
+ * @param sum Receives the checksum, continued over the record area.
+ * @return 1 on success, 0 if the records are damaged (error reported).
+ */
+#ifdef IB_COMPACT_STORAGE
+static int read_image_records(FILE* file, unsigned long record_bytes,
+                              unsigned long* sum)
+{
+    int i;
+    unsigned int size;
+    unsigned int text_len;
+
+    /* The records go straight into the arena, in a single read */
+    if (record_bytes > (unsigned long)ctx->arena_size)
+    {
+        report_error("PROGRAM MEMORY FULL");
+        return 0;
+    }
+    if (fread(ctx->program_arena, 1, record_bytes, file) != record_bytes)
+    {
+        report_error("BAD PROGRAM IMAGE");
+        return 0;
+    }
+    ctx->arena_used = record_bytes;
+
+    /* Check each record's shape and tokens, so that LIST and RUN can trust it */
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        /* The smallest record is a length byte, a '\0' and a TOK_EOL */
+        size = ctx->line_index[i].size;
+        if (size < 3)
+        {
+            report_error("BAD PROGRAM IMAGE");
+            return 0;
+        }
+        text_len = ctx->program_arena[ctx->line_index[i].offset];
+        if (text_len >= MAX_LINE_LEN || size < text_len + 3 ||
+            size - text_len - 2 > MAX_CODE_LEN ||
+            ctx->program_arena[ctx->line_index[i].offset + text_len + 1] != '\0' ||
+            !is_valid_code(&ctx->program_arena[ctx->line_index[i].offset + text_len + 2],
+                           (int)(size - text_len - 2)))
+        {
+            report_error("BAD PROGRAM IMAGE");
+            return 0;
+        }
+    }
+    *sum = image_checksum(*sum, ctx->program_arena, record_bytes);
+    return 1;
+}
+#else
+static int read_image_records(FILE* file, unsigned long record_bytes,
+                              unsigned long* sum)
+{
+    int i;
+    int text_len;
+    int code_len;
+    unsigned long total = 0;
+    unsigned char length_byte;
+
+    for (i = 0; i < ctx->line_count; i++)
+    {
+        /* `sort_order` holds each record's size (see `load_image`) */
+        text_len = fgetc(file);
+        code_len = ctx->sort_order[i] - text_len - 2;
+        total += ctx->sort_order[i];
+        if (text_len == EOF || text_len >= MAX_LINE_LEN ||
+            code_len < 1 || code_len > LINE_CODE_LEN ||
+            fread(ctx->program_storage[i].text, 1, text_len + 1, file) != (size_t)text_len + 1 ||
+            fread(ctx->program_storage[i].code, 1, code_len, file) != (size_t)code_len ||
+            ctx->program_storage[i].text[text_len] != '\0' ||
+            !is_valid_code(ctx->program_storage[i].code, code_len))
+        {
+            report_error("BAD PROGRAM IMAGE");
+            return 0;
+        }
+
+        length_byte = (unsigned char)text_len;
+        *sum = image_checksum(*sum, &length_byte, 1);
+        *sum = image_checksum(*sum, (const unsigned char*)ctx->program_storage[i].text, text_len + 1);
+        *sum = image_checksum(*sum, ctx->program_storage[i].code, code_len);
+    }
+    if (total != record_bytes)
+    {
+        report_error("BAD PROGRAM IMAGE");
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+/**
+ * @brief load_image
+ * Loads a program image written by `save_image`, replacing the
+ * current program (see `read_image`).
+ *
+ * @return 1 if the image was loaded, 0 if not (error reported).
+ */
+static int load_image(const char* filename)
+{
+    FILE *file;
+    int loaded;
+
+    file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        report_error("FILE NOT FOUND");
+        return 0;
+    }
+
+    loaded = read_image(file);
+    fclose(file);
+
+    if (loaded && is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Loaded image of %d lines.\n", ctx->line_count);
+    }
+    return loaded;
+}
+
+/**
+ * @brief read_image
+ * Reads a program image (see `write_image`) from `file`, replacing
+ * the current program. Nothing is tokenized: the lines are ready to
+ * RUN. If the image is damaged (or was made by an incompatible
+ * version), the program is cleared and "BAD PROGRAM IMAGE" is
+ * reported. The file is left just after the image.
+ *
+ * @return 1 if the image was read, 0 if not (error reported).
+ */
+static int read_image(FILE* file)
+{
+    unsigned char header[IMAGE_HEADER_LEN];
+    unsigned char entry[4];
+    unsigned long record_bytes;
+    unsigned long expected_sum;
+    unsigned long sum = IMAGE_CHECKSUM_SEED;
+    unsigned long offset = 0;
+    int count;
+    int number;
+    int previous = 0;
+    int i;
+
+    new_program();
+
+    /* 1. The header */
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        header[0] != 'I' || header[1] != 'B' || header[2] != 'C' || header[3] != 0x1A ||
+        header[4] != IMAGE_FORMAT || header[5] != (unsigned char)keyword_count)
+    {
+        report_error("BAD PROGRAM IMAGE");
+        return 0;
+    }
+    count = (int)get_le(&header[6], 2);
+    record_bytes = get_le(&header[8], 4);
+    expected_sum = get_le(&header[12], 4);
+
+    if (count > ctx->max_lines)
+    {
+        report_error("PROGRAM MEMORY FULL");
+        return 0;
+    }
+
+    /* 2. The line table (line numbers must be strictly ascending) */
+    for (i = 0; i < count; i++)
+    {
+        if (fread(entry, 1, 4, file) != 4)
+        {
+            break;
+        }
+        number = (int)get_le(&entry[0], 2);
+        if (number <= previous)
+        {
+            break;
+        }
+        previous = number;
+        sum = image_checksum(sum, entry, 4);
+#ifdef IB_COMPACT_STORAGE
+        ctx->line_index[i].line_number = (unsigned short)number;
+        ctx->line_index[i].size = (unsigned short)get_le(&entry[2], 2);
+        ctx->line_index[i].offset = (unsigned int)offset;
+#else
+        ctx->program_storage[i].line_number = number;
+        ctx->sort_order[i] = (int)get_le(&entry[2], 2); /* Free scratch space */
+#endif
+        offset += get_le(&entry[2], 2);
+    }
+    if (i < count || offset != record_bytes)
+    {
+        report_error("BAD PROGRAM IMAGE");
+        return 0;
+    }
+    ctx->line_count = count;
+
+    /* 3. The records, and the checksum over everything */
+    if (!read_image_records(file, record_bytes, &sum))
+    {
+        new_program();
+        return 0;
+    }
+    if (sum != expected_sum)
+    {
+        report_error("BAD PROGRAM IMAGE");
+        new_program();
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * =============================================================================
+ * --- Snapshot Functions ---
+ * =============================================================================
+ */
+
+/*
+ * A snapshot (SNAPSHOT file) is a program image, exactly as SAVE
+ * writes one (tokens and resolved jump targets included), followed by
+ * the state of the run: the variables, the GOSUB and FOR stacks, and
+ * where to carry on. RESTORE (or --restore) reads the whole file back
+ * and resumes the program there, so a job whose setup has been done
+ * once, ahead of time, starts with no LOAD, no tokenizing and no
+ * setup at all.
+ *
+ * [program image, as written by `write_image`]
+ * [state, after the image]
+ *   'I' 'B' 'S' 0x1A       Magic number
+ *   resume line            4 bytes: the index of the line to carry
+ *                          on at, or SNAPSHOT_NO_RESUME
+ *   GOSUB depth            2 bytes (`stack_pointer`)
+ *   FOR depth              1 byte (`loop_pointer`)
+ *   variables              NUM_VARIABLES values, VALUE_BYTES each
+ *   GOSUB frames           line (4 bytes), offset (2 bytes)
+ *   FOR frames             line (4 bytes), body offset (2 bytes),
+ *                          depth (2 bytes), variable (1 byte),
+ *                          limit and step (VALUE_BYTES each)
+ *   checksum               4 bytes (FNV-1a of the state above)
+ *
+ * Line indexes stay valid, because the program comes back exactly
+ * as it was. Code positions (a FOR's `body`) are stored as offsets
+ * into their line's tokens, so the same snapshot can be restored by
+ * the fixed and the compact storage builds.
+ */
+
+/**
+ * @brief put_state
+ * Writes a `bytes`-byte number of a snapshot's state, low byte
+ * first, and adds it to the running checksum.
+ */
+static void put_state(FILE* file, unsigned long value, int bytes, unsigned long* sum)
+{
+    unsigned char data[4];
+
+    put_le(data, value, bytes);
+    *sum = image_checksum(*sum, data, (unsigned long)bytes);
+    fwrite(data, 1, (size_t)bytes, file);
+}
+
+/**
+ * @brief get_state
+ * Reads `bytes` bytes of a snapshot's state into `data`, and adds
+ * them to the running checksum.
+ * @return 1 on success, 0 at the end of the file.
+ */
+static int get_state(FILE* file, unsigned char* data, int bytes, unsigned long* sum)
+{
+    if (fread(data, 1, (size_t)bytes, file) != (size_t)bytes)
+    {
+        return 0;
+    }
+    *sum = image_checksum(*sum, data, (unsigned long)bytes);
+    return 1;
+}
+
+/**
+ * @brief save_snapshot
+ * Handler for SNAPSHOT: writes the program and the state of the run
+ * to `filename`. Inside a program, RESTORE carries on with the line
+ * after the SNAPSHOT (which always ends its line); in direct mode,
+ * only the program and the variables are kept.
+ */
+static void save_snapshot(const char* filename)
+{
+    static const unsigned char magic[4] = { 'I', 'B', 'S', 0x1A };
+    unsigned long sum = IMAGE_CHECKSUM_SEED;
+    const LoopFrame* loop;
+    int stack_depth = 0;
+    int loop_depth = 0;
+    int written;
+    int i;
+    FILE *file;
+
+    if (filename == NULL || *filename == '\0')
+    {
+        report_error("FILENAME REQUIRED");
+        return;
+    }
+
+    file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        report_error("CANNOT OPEN FILE");
+        return;
+    }
+
+    /* 1. The program, as a program image */
+    written = write_image(file);
+
+    /* 2. The state: the stacks only mean something in a running program */
+    if (ctx->is_program_mode)
+    {
+        stack_depth = ctx->stack_pointer;
+        loop_depth = ctx->loop_pointer;
+    }
+    sum = image_checksum(sum, magic, 4);
+    fwrite(magic, 1, 4, file);
+    put_state(file, ctx->is_program_mode ? (unsigned long)ctx->program_counter
+                                         : SNAPSHOT_NO_RESUME, 4, &sum);
+    put_state(file, (unsigned long)stack_depth, 2, &sum);
+    put_state(file, (unsigned long)loop_depth, 1, &sum);
+    for (i = 0; i < NUM_VARIABLES; i++)
+    {
+        put_state(file, (unsigned long)ctx->variables[i], VALUE_BYTES, &sum);
+    }
+    for (i = 0; i < stack_depth; i++)
+    {
+        put_state(file, (unsigned long)ctx->gosub_stack[i].line, 4, &sum);
+        put_state(file, (unsigned long)ctx->gosub_stack[i].offset, 2, &sum);
+    }
+    for (i = 0; i < loop_depth; i++)
+    {
+        loop = &ctx->loop_stack[i];
+        put_state(file, (unsigned long)loop->line, 4, &sum);
+        put_state(file, (unsigned long)(loop->body - LINE_CODE(loop->line - 1)), 2, &sum);
+        put_state(file, (unsigned long)loop->depth, 2, &sum);
+        put_state(file, (unsigned long)loop->variable, 1, &sum);
+        put_state(file, (unsigned long)loop->limit, VALUE_BYTES, &sum);
+        put_state(file, (unsigned long)loop->step, VALUE_BYTES, &sum);
+    }
+    put_state(file, sum, 4, &sum);
+
+    if (!written || ferror(file))
+    {
+        report_error("CANNOT WRITE FILE");
+    }
+    fclose(file);
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Saved snapshot of %d lines (GOSUB depth %d, FOR depth %d).\n",
+                             ctx->line_count, stack_depth, loop_depth);
+    }
+}
+
+/**
+ * @brief is_resume_point
+ * Checks a position read from a snapshot: `line` must be the index
+ * of a line after a stored line (as `program_counter` is), and
+ * `offset` 0 (carry on with that line) or an offset into the tokens
+ * of the line before it, at a TOK_COLON or its TOK_EOL.
+ */
+static int is_resume_point(int line, int offset)
+{
+    const unsigned char* code;
+
+    if (line < 1 || line > ctx->line_count)
+    {
+        return 0;
+    }
+    code = LINE_CODE(line - 1);
+    if (offset >= code_length(code))
+    {
+        return 0;
+    }
+    return offset == 0 || code[offset] == TOK_COLON || code[offset] == TOK_EOL;
+}
+
+/**
+ * @brief read_state
+ * Reads the state of a snapshot (see `save_snapshot`), which follows
+ * its program image, into the variables and the GOSUB and FOR stacks.
+ * Every position is checked, so that RUN can trust it.
+ *
+ * @param resume_line Receives the line to carry on at, or
+ * SNAPSHOT_NO_RESUME.
+ * @return 1 on success, 0 if the state is damaged (error reported).
+ */
+static int read_state(FILE* file, unsigned long* resume_line)
+{
+    unsigned char data[4];
+    unsigned long sum = IMAGE_CHECKSUM_SEED;
+    unsigned long expected_sum;
+    LoopFrame* loop;
+    int stack_depth;
+    int loop_depth;
+    int offset;
+    int i;
+
+    if (!get_state(file, data, 4, &sum) ||
+        data[0] != 'I' || data[1] != 'B' || data[2] != 'S' || data[3] != 0x1A ||
+        !get_state(file, data, 4, &sum))
+    {
+        report_error("BAD SNAPSHOT");
+        return 0;
+    }
+    *resume_line = get_le(data, 4);
+    if (*resume_line != SNAPSHOT_NO_RESUME && *resume_line > (unsigned long)ctx->line_count)
+    {
+        report_error("BAD SNAPSHOT");
+        return 0;
+    }
+
+    if (!get_state(file, data, 2, &sum))
+    {
+        report_error("BAD SNAPSHOT");
+        return 0;
+    }
+    stack_depth = (int)get_le(data, 2);
+    if (stack_depth > ctx->stack_size)
+    {
+        report_error("GOSUB STACK OVERFLOW");
+        return 0;
+    }
+    if (!get_state(file, data, 1, &sum) || data[0] > LOOP_STACK_SIZE)
+    {
+        report_error("BAD SNAPSHOT");
+        return 0;
+    }
+    loop_depth = data[0];
+
+    /* 1. The variables */
+    for (i = 0; i < NUM_VARIABLES; i++)
+    {
+        if (!get_state(file, data, VALUE_BYTES, &sum))
+        {
+            report_error("BAD SNAPSHOT");
+            return 0;
+        }
+        ctx->variables[i] = GET_VALUE(data);
+    }
+
+    /* 2. The GOSUB stack */
+    for (i = 0; i < stack_depth; i++)
+    {
+        if (!get_state(file, data, 4, &sum))
+        {
+            break;
+        }
+        ctx->gosub_stack[i].line = (int)get_le(data, 4);
+        if (!get_state(file, data, 2, &sum))
+        {
+            break;
+        }
+        ctx->gosub_stack[i].offset = (int)get_le(data, 2);
+        if (!is_resume_point(ctx->gosub_stack[i].line, ctx->gosub_stack[i].offset))
+        {
+            break;
+        }
+    }
+    if (i < stack_depth)
+    {
+        report_error("BAD SNAPSHOT");
+        return 0;
+    }
+    ctx->stack_pointer = stack_depth;
+
+    /* 3. The FOR stack */
+    for (i = 0; i < loop_depth; i++)
+    {
+        loop = &ctx->loop_stack[i];
+        if (!get_state(file, data, 4, &sum))
+        {
+            break;
+        }
+        loop->line = (int)get_le(data, 4);
+        if (!get_state(file, data, 2, &sum))
+        {
+            break;
+        }
+        offset = (int)get_le(data, 2);
+        if (offset == 0 || !is_resume_point(loop->line, offset))
+        {
+            break;
+        }
+        loop->body = LINE_CODE(loop->line - 1) + offset;
+        if (!get_state(file, data, 2, &sum))
+        {
+            break;
+        }
+        loop->depth = (int)get_le(data, 2);
+        if (loop->depth > stack_depth || !get_state(file, data, 1, &sum) ||
+            data[0] >= NUM_VARIABLES)
+        {
+            break;
+        }
+        loop->variable = data[0];
+        if (!get_state(file, data, VALUE_BYTES, &sum))
+        {
+            break;
+        }
+        loop->limit = GET_VALUE(data);
+        if (!get_state(file, data, VALUE_BYTES, &sum))
+        {
+            break;
+        }
+        loop->step = GET_VALUE(data);
+    }
+    if (i < loop_depth)
+    {
+        report_error("BAD SNAPSHOT");
+        return 0;
+    }
+    ctx->loop_pointer = loop_depth;
+
+    /* 4. The checksum, over all of the state */
+    expected_sum = sum;
+    if (fread(data, 1, 4, file) != 4 || get_le(data, 4) != expected_sum)
+    {
+        report_error("BAD SNAPSHOT");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief restore_snapshot
+ * Handler for RESTORE and --restore: replaces the program and the
+ * state of the run with the snapshot in `filename`, in one read of
+ * the file, then carries on running the program where the SNAPSHOT
+ * was taken (unless it was taken in direct mode).
+ * If the snapshot is damaged, the program is cleared.
+ *
+ * @return 1 if the snapshot was restored (and its program has run),
+ * 0 if it could not be read (the error has been reported).
+ */
+static int restore_snapshot(const char* filename)
+{
+    unsigned long resume_line = SNAPSHOT_NO_RESUME;
+    int restored;
+    FILE *file;
+
+    if (filename == NULL || *filename == '\0')
+    {
+        report_error("FILENAME REQUIRED");
+        return 0;
+    }
+
+    file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        report_error("FILE NOT FOUND");
+        return 0;
+    }
+
+    /*
+     * The image clears everything (see `new_program`) and checks its
+     * tokens (see `is_valid_code`), then the state is checked against it
+     */
+    restored = read_image(file) && read_state(file, &resume_line);
+    fclose(file);
+    if (!restored)
+    {
+        new_program();
+        return 0;
+    }
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Restored snapshot of %d lines.\n", ctx->line_count);
+    }
+
+    if (resume_line != SNAPSHOT_NO_RESUME)
+    {
+        ctx->program_counter = (int)resume_line;
+        run_program(1);
+    }
+    return 1;
+}
+
+
+/*
+ * =============================================================================
+ * --- Keyword Table Functions ---
+ * =============================================================================
+ */
+
+/**
+ * @brief init_keywords
+ * Builds the hash index for the core keywords in `keyword_table`.
+ * Must be called once at startup, before any line is compiled.
+ */
+static void init_keywords(void)
+{
+    int count = keyword_count;
+
+    memset(keyword_hash, 0, sizeof(keyword_hash));
+
+    /*
+     * We index the statically-defined core keywords by
+     * "re-registering" each one in place.
+     */
+    keyword_count = 0;
+    while (keyword_count < count)
+    {
+        const Keyword* keyword = &keyword_table[keyword_count];
+        register_keyword(keyword->name, keyword->compile,
+                         keyword->handler, keyword->flags);
+    }
+
+    /* The execution loop's jump table is shared in the same way */
+    dispatch_program(1);
+}
+
+/**
+ * @brief register_keyword
+ * Adds a new command to the interpreter.
+ *
+ * This is the hook for Modules (README Section 6.3): a module calls
+ * this at startup for each keyword it provides, and from then on the
+ * compiler recognizes the word and `execute_statement` dispatches to
+ * its handler. No other part of the interpreter needs to be edited.
+ *
+ * @param name    The command word, in upper case (e.g., "PSET").
+ * @param compile Compiles the arguments (NULL if there are none).
+ * @param handler Executes the command.
+ * @param flags   KW_DIRECT_ONLY, or 0.
+ * @return The keyword's opcode, or -1 if the table is full.
  */
-static void execute_statement(void)
+static int register_keyword(const char* name, void (*compile)(void),
+                            void (*handler)(void), unsigned char flags)
+{
+    unsigned int slot;
+
+    if (keyword_count >= MAX_KEYWORDS)
+    {
+        return -1;
+    }
+
+    keyword_table[keyword_count].name = name;
+    keyword_table[keyword_count].compile = compile;
+    keyword_table[keyword_count].handler = handler;
+    keyword_table[keyword_count].flags = flags;
+
+    /* Linear probing: take the first empty slot from the hash position. */
+    slot = keyword_hash_of(name);
+    while (keyword_hash[slot] != 0)
+    {
+        slot = (slot + 1) & (KEYWORD_HASH_SIZE - 1);
+    }
+    keyword_hash[slot] = (unsigned char)(keyword_count + 1);
+
+    keyword_count++;
+    return OP_BASE + keyword_count - 1;
+}
+
+/**
+ * @brief find_keyword
+ * Looks up a command word in the keyword hash index.
+ * @param name The command word, already in upper case.
+ * @return The keyword's table entry, or NULL if it is not known.
+ */
+static const Keyword* find_keyword(const char* name)
+{
+    unsigned int slot = keyword_hash_of(name);
+
+    /* Probe until we find the name, or an empty slot (not found). */
+    while (keyword_hash[slot] != 0)
+    {
+        const Keyword* keyword = &keyword_table[keyword_hash[slot] - 1];
+        if (strcmp(keyword->name, name) == 0)
+        {
+            return keyword;
+        }
+        slot = (slot + 1) & (KEYWORD_HASH_SIZE - 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief keyword_hash_of
+ * A small string hash (FNV-1a) reduced to a `keyword_hash` slot.
+ * @param name The command word.
+ * @return A slot index, 0 to KEYWORD_HASH_SIZE-1.
+ */
+static unsigned int keyword_hash_of(const char* name)
+{
+    unsigned long hash = 2166136261UL;
+
+    while (*name)
+    {
+        hash ^= (unsigned char)*name;
+        hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+        name++;
+    }
+    return (unsigned int)(hash & (KEYWORD_HASH_SIZE - 1));
+}
+
+
+/*
+ * =============================================================================
+ * --- Compiler Functions ---
+ * =============================================================================
+ */
+
+/*
+ * The compiler turns the text of a line into tokens (see "Token Codes").
+ * It walks the text with `parser_ptr`, following exactly the same
+ * grammar that the command handlers expect, and appends tokens
+ * with `emit`.
+ *
+ * Wherever the text cannot be understood, the compiler emits a
+ * TOK_ERROR and stops. The error is raised at run time, so a bad
+ * line is still reported only when it is executed.
+ */
+
+/**
+ * @brief compile_line
+ * Compiles a single line of text into its tokenized form: each of its
+ * ':'-separated statements, with a TOK_COLON between them.
+ *
+ * @param text The text of the line, *without* its line number.
+ * @param code The output buffer.
+ * @param size Its size (MAX_CODE_LEN, or a slot's LINE_CODE_LEN).
+ */
+static void compile_line(const char* text, unsigned char* code, int size)
+{
+    ctx->parser_ptr = text;
+    ctx->emit_ptr = code;
+    ctx->emit_end = code + size - 1; /* Keep one byte for TOK_EOL */
+    ctx->compile_failed = 0;
+    ctx->compile_overflow = 0;
+
+    compile_statement();
+    while (*ctx->parser_ptr == ':' && !ctx->compile_failed)
+    {
+        ctx->parser_ptr++; /* Consume the ':' */
+        emit(TOK_COLON);
+        compile_statement();
+    }
+
+    if (ctx->compile_overflow)
+    {
+        /*
+         * The tokens did not fit. Replace the whole line with
+         * an error, so it fails cleanly if it is ever executed.
+         */
+        ctx->emit_ptr = code;
+        emit(TOK_ERROR);
+        emit(ERR_LINE_TOO_COMPLEX);
+    }
+    *ctx->emit_ptr = TOK_EOL;
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] Compiled '%s' to %d token bytes.\n",
+                             text, (int)(ctx->emit_ptr - code));
+    }
+}
+
+/**
+ * @brief compile_statement
+ * Compiles one statement: the command word, then its arguments.
+ *
+ * This is the compile-time half of `execute_statement`. It reads the
+ * *first word* from `parser_ptr`, looks it up with `find_keyword`,
+ * emits its opcode and then calls the keyword's `compile` function
+ * for the arguments.
+ *
+ * The arguments end at the next ':' which is not inside a "string"
+ * (unless the keyword is KW_WHOLE_LINE). They are compiled from a
+ * copy which ends there, so that no `compile_...` function has to
+ * know about ':'. `parser_ptr` is then left at the ':' (or at the
+ * end of the line), for `compile_line`.
+ */
+static void compile_statement(void)
 {
     /*
      * A small, local buffer to hold the parsed command.
      * We use a fixed size for simplicity (COMMAND_MAX_LEN).
      */
     char command[COMMAND_MAX_LEN];
+    char arguments[MAX_LINE_LEN + 20]; /* As long as any input line */
+    const char* end;
+    const Keyword* keyword;
+    int in_string;
     int i = 0;
 
-    /* Ensure the `is_running` flag is checked before we do anything. */
-    if (!is_running) return;
-
     /* 1. Get the command (the first "token") */
     skip_whitespace();
 
@@ -533,14 +6154,12 @@ static void execute_statement(void)
      * Parse the command token manually.
      * We use `toupper` to make the command case-insensitive
      * *as we read it*.
-     *
-     * We don't use `strtok` here because it's destructive and can
-     * cause issues. A simple loop is safer and cleaner.
      */
-    while (*parser_ptr && !isspace((unsigned char)*parser_ptr) && i < (COMMAND_MAX_LEN - 1))
+    while (*ctx->parser_ptr && *ctx->parser_ptr != ':' &&
+           !isspace((unsigned char)*ctx->parser_ptr) && i < (COMMAND_MAX_LEN - 1))
     {
-        command[i] = toupper((unsigned char)*parser_ptr);
-        parser_ptr++;
+        command[i] = toupper((unsigned char)*ctx->parser_ptr);
+        ctx->parser_ptr++;
         i++;
     }
     command[i] = '\0'; /* Null-terminate the command string */
@@ -548,586 +6167,708 @@ static void execute_statement(void)
     /* 2. Skip whitespace *after* the command to point to its arguments */
     skip_whitespace();
 
-    if (is_debug_mode)
-    {
-        printf("[DEBUG] Executing command: '%s', Args: '%s'\n", command, parser_ptr);
-    }
-
-    /*
-     * --- COMMAND DISPATCH TABLE ---
-     *
-     * This is the "switchboard" of the interpreter. It compares the
-     * parsed `command` string to our list of known commands and
-     * calls the appropriate function.
-     *
-     * TO ADD A NEW COMMAND:
-     * 1. Write a `cmd_mycommand(void)` function.
-     * 2. Add its prototype to the "Forward Declarations" section.
-     * 3. Add an `else if (strcmp(command, "MYCOMMAND") == 0)`
-     * block here to call your new function.
-     */
-
     if (command[0] == '\0')
     {
-        /* Empty line (or just a line number), do nothing. */
+        /* Empty line (or just "THEN"), do nothing. */
+        emit(OP_NOP);
         return;
     }
-    else if (strcmp(command, "PRINT") == 0)
-    {
-        cmd_print();
-    }
-    else if (strcmp(command, "LPRINT") == 0)
+
+    /* 3. Look the command up */
+    keyword = find_keyword(command);
+    if (keyword == NULL)
     {
-        cmd_lprint();
+        /* If the command is not in our list, it's an error. */
+        emit_error(ERR_UNKNOWN_COMMAND);
+        return;
     }
-    else if (strcmp(command, "LET") == 0)
+
+    emit((unsigned char)(OP_BASE + (keyword - keyword_table)));
+
+    /* 4. Find where the arguments end */
+    if (keyword->flags & KW_WHOLE_LINE)
     {
-        cmd_let();
+        end = ctx->parser_ptr + strlen(ctx->parser_ptr);
     }
-    else if (strcmp(command, "INPUT") == 0)
+    else
     {
-        cmd_input();
+        in_string = 0;
+        for (end = ctx->parser_ptr; *end && (*end != ':' || in_string); end++)
+        {
+            if (*end == '"')
+            {
+                in_string = !in_string;
+            }
+        }
     }
-    else if (strcmp(command, "GOTO") == 0)
+
+    /*
+     * 5. Compile the arguments this command expects.
+     * Commands without a `compile` function (REM, END, RUN, ...)
+     * take no arguments; anything after them is ignored.
+     */
+    if (keyword->compile != NULL)
     {
-        cmd_goto();
+        i = (int)(end - ctx->parser_ptr);
+        if (i > (int)sizeof(arguments) - 1)
+        {
+            i = (int)sizeof(arguments) - 1;
+        }
+        memcpy(arguments, ctx->parser_ptr, (size_t)i);
+        arguments[i] = '\0';
+
+        ctx->parser_ptr = arguments;
+        keyword->compile();
     }
-    else if (strcmp(command, "GOSUB") == 0)
+    ctx->parser_ptr = end;
+}
+
+/**
+ * @brief compile_print
+ * Arguments for: PRINT "[string]", PRINT [expression], or a bare PRINT
+ */
+static void compile_print(void)
+{
+    skip_whitespace();
+    if (*ctx->parser_ptr == '"')
     {
-        cmd_gosub();
+        compile_string();
     }
-    else if (strcmp(command, "RETURN") == 0)
+    else if (*ctx->parser_ptr != '\0')
     {
-        cmd_return();
+        compile_expression();
     }
-    else if (strcmp(command, "IF") == 0)
+}
+
+/**
+ * @brief compile_lprint
+ * Arguments for: LPRINT [expression], a bare LPRINT, or LPRINT FLUSH
+ */
+static void compile_lprint(void)
+{
+    if (ib_stricmp(ctx->parser_ptr, "FLUSH") == 0)
     {
-        cmd_if();
+        emit(TOK_FLUSH);
+        ctx->parser_ptr += 5; /* Move parser past "FLUSH" */
     }
-    else if (strcmp(command, "REM") == 0)
+    else if (*ctx->parser_ptr != '\0')
     {
-        cmd_rem(); /* Does nothing, just a comment */
+        compile_expression();
     }
-    else if (strcmp(command, "END") == 0)
+}
+
+/**
+ * @brief compile_input
+ * Arguments for: INPUT [variable], [variable], ...
+ */
+static void compile_input(void)
+{
+    while (1)
     {
-        cmd_end();
+        skip_whitespace();
+        if (!isalpha((unsigned char)*ctx->parser_ptr))
+        {
+            emit_error(ERR_EXPECTED_VARIABLE_INPUT);
+            return;
+        }
+        compile_term();
+        if (ctx->compile_failed) return;
+
+        /* One TOK_VAR per variable: "INPUT A, B, C" */
+        skip_whitespace();
+        if (*ctx->parser_ptr != ',')
+        {
+            return;
+        }
+        ctx->parser_ptr++;
     }
-    else if (strcmp(command, "STOP") == 0)
+}
+
+/**
+ * @brief compile_let
+ * Arguments for: LET [variable] = [expression]
+ */
+static void compile_let(void)
+{
+    unsigned char* code = ctx->emit_ptr - 1; /* The OP_LET opcode */
+
+    skip_whitespace();
+    if (!isalpha((unsigned char)*ctx->parser_ptr))
     {
-        /* STOP is an alias for END in our simple dialect */
-        cmd_end();
+        emit_error(ERR_EXPECTED_VARIABLE_LET);
+        return;
     }
-    else if (strcmp(command, "BEEP") == 0)
+    compile_term();
+    if (ctx->compile_failed) return;
+
+    skip_whitespace();
+    if (*ctx->parser_ptr != '=')
     {
-        cmd_beep();
+        emit_error(ERR_EXPECTED_EQUALS_LET);
+        return;
     }
-    else if (strcmp(command, "RUN") == 0)
+    ctx->parser_ptr++; /* Consume '=' */
+    compile_expression();
+    if (ctx->compile_failed) return;
+
+    /*
+     * "LET X = X + k" (or "X - k") compiled to the postfix tokens
+     * [X] [X] [TOK_NUM k] [TOK_ADD]: fuse it into a single
+     * OP_LET_ADD [X] [TOK_NUM k], adding -k for a subtraction
+     * (which wraps to the same result).
+     */
+    if (ctx->emit_ptr == code + 4 + VALUE_LEN && code[0] == OP_LET && code[2] == code[1] &&
+        code[3] == TOK_NUM &&
+        (code[3 + VALUE_LEN] == TOK_ADD || code[3 + VALUE_LEN] == TOK_SUB))
     {
-        /*
-         * Special case: RUN is a direct-mode command.
-         * If we are *already* running, it's an error.
-         * (This check prevents "10 RUN" from causing chaos).
-         */
-        if (is_running && program_counter > 0)
-        {
-            report_error("CAN'T USE RUN IN A PROGRAM");
-        }
-        else
-        {
-            run_program();
-        }
+        Value k = GET_VALUE(code + 4);
+
+        code[0] = OP_LET_ADD;
+        code[2] = TOK_NUM;
+        put_le(code + 3, (unsigned long)(code[3 + VALUE_LEN] == TOK_ADD ? k : VALUE_SUB(0, k)),
+               VALUE_BYTES);
+        ctx->emit_ptr = code + 2 + VALUE_LEN;
     }
-    else if (strcmp(command, "LIST") == 0)
+}
+
+/**
+ * @brief compile_if
+ * Arguments for: IF [expr] [op] [expr] THEN [statement or line_number]
+ */
+static void compile_if(void)
+{
+    unsigned char* code = ctx->emit_ptr - 1; /* The OP_IF opcode */
+
+    compile_expression();
+    if (ctx->compile_failed) return;
+
+    skip_whitespace();
+    if (*ctx->parser_ptr == '=')
     {
-        /* Same as RUN, this is a direct-mode command. */
-        if (is_running && program_counter > 0)
-        {
-            report_error("CAN'T USE LIST IN A PROGRAM");
-        }
-        else
-        {
-            list_program();
-        }
+        emit(TOK_EQ);
+        ctx->parser_ptr++;
     }
-    else if (strcmp(command, "NEW") == 0)
+    else if (*ctx->parser_ptr == '<')
     {
-        /* Same as RUN, this is a direct-mode command. */
-        if (is_running && program_counter > 0)
+        ctx->parser_ptr++;
+        if (*ctx->parser_ptr == '>')
         {
-            report_error("CAN'T USE NEW IN A PROGRAM");
+            emit(TOK_NE); /* "<>" operator */
+            ctx->parser_ptr++;
         }
         else
         {
-            new_program();
+            emit(TOK_LT); /* "<" operator */
         }
     }
-    else if (strcmp(command, "SAVE") == 0)
+    else if (*ctx->parser_ptr == '>')
     {
-        if (is_running && program_counter > 0)
-        {
-            report_error("CAN'T USE SAVE IN A PROGRAM");
-        }
-        else
-        {
-            /*
-             * We pass the `parser_ptr` (which now points
-             * to the filename) to the save function.
-             */
-            save_program(parser_ptr);
-        }
+        emit(TOK_GT);
+        ctx->parser_ptr++;
     }
-    else if (strcmp(command, "LOAD") == 0)
+    else
     {
-        if (is_running && program_counter > 0)
-        {
-            report_error("CAN'T USE LOAD IN A PROGRAM");
-        }
-        else
-        {
-            load_program(parser_ptr);
-        }
+        emit_error(ERR_EXPECTED_OPERATOR_IF);
+        return;
     }
-    else if (strcmp(command, "SYSTEM") == 0)
+
+    compile_expression();
+    if (ctx->compile_failed) return;
+
+    skip_whitespace();
+    if (ib_stricmp(ctx->parser_ptr, "THEN") != 0)
     {
-        cmd_system();
+        emit_error(ERR_EXPECTED_THEN);
+        return;
     }
-    else if (strcmp(command, "QUIT") == 0)
+    ctx->parser_ptr += 4; /* Move parser past "THEN" */
+    skip_whitespace();
+    emit(TOK_THEN);
+
+    /*
+     * Special implicit GOTO: "IF A=1 THEN 100"
+     * If the token after THEN is a number, we compile a GOTO.
+     * Otherwise we compile the remainder of the line as a
+     * nested statement.
+     */
+    if (isdigit((unsigned char)*ctx->parser_ptr))
     {
-        /*
-         * QUIT is a direct-mode command, but we also allow
-         * "10 QUIT" as a way to exit a program.
-         */
-        cmd_quit();
+        emit(OP_GOTO);
+        compile_line_target();
     }
-    else if (strcmp(command, "EXIT") == 0)
+    else
     {
-        /* EXIT is an alias for QUIT */
-        cmd_exit();
+        compile_statement();
+        return;
     }
+
     /*
-     * --- Module Extension Stubs ---
-     * These commands are reserved for future modules.
-     * They are handled by a simple "stub" function.
+     * "IF X < k THEN n" compiled to [X] [TOK_LT] [TOK_NUM k]
+     * [TOK_THEN] [OP_GOTO] [TOK_LINE n]: fuse the test into the
+     * opcode, giving OP_IF_LT [X] [TOK_NUM k] [OP_GOTO] [TOK_LINE n].
      */
-    else if (strcmp(command, "$IMPORT") == 0)
+    if (ctx->emit_ptr == code + 10 + VALUE_LEN && code[0] == OP_IF &&
+        code[1] >= TOK_VAR && code[1] < TOK_VAR + NUM_VARIABLES &&
+        code[2] >= TOK_EQ && code[2] <= TOK_GT && code[3] == TOK_NUM &&
+        code[3 + VALUE_LEN] == TOK_THEN && code[4 + VALUE_LEN] == OP_GOTO &&
+        code[5 + VALUE_LEN] == TOK_LINE)
+    {
+        code[0] = (unsigned char)(OP_IF_EQ + (code[2] - TOK_EQ));
+        code[2] = TOK_NUM;
+        memmove(code + 3, code + 4, VALUE_BYTES);
+        memmove(code + 2 + VALUE_LEN, code + 4 + VALUE_LEN, 6);
+        ctx->emit_ptr = code + 8 + VALUE_LEN;
+    }
+}
+
+/**
+ * @brief compile_for
+ * Arguments for: FOR [variable] = [expr] TO [expr] [STEP [expr]]
+ */
+static void compile_for(void)
+{
+    skip_whitespace();
+    if (!isalpha((unsigned char)*ctx->parser_ptr))
     {
-        cmd_stub("$IMPORT");
+        emit_error(ERR_EXPECTED_VARIABLE_FOR);
+        return;
     }
-    else if (strcmp(command, "$INCLUDE") == 0)
+    compile_term();
+    if (ctx->compile_failed) return;
+
+    skip_whitespace();
+    if (*ctx->parser_ptr != '=')
     {
-        cmd_stub("$INCLUDE");
+        emit_error(ERR_EXPECTED_EQUALS_FOR);
+        return;
     }
-    else if (strcmp(command, "$MERGE") == 0)
+    ctx->parser_ptr++; /* Consume '=' */
+    compile_expression();
+    if (ctx->compile_failed) return;
+
+    skip_whitespace();
+    if (ib_stricmp(ctx->parser_ptr, "TO") != 0)
     {
-        cmd_stub("$MERGE");
+        emit_error(ERR_EXPECTED_TO);
+        return;
     }
-    else
+    ctx->parser_ptr += 2; /* Move parser past "TO" */
+    emit(TOK_TO);
+    compile_expression();
+    if (ctx->compile_failed) return;
+
+    /* The STEP is optional: "FOR I = 1 TO 10" counts by 1 */
+    skip_whitespace();
+    if (ib_stricmp(ctx->parser_ptr, "STEP") == 0)
     {
-        /*
-         * If the command is not in our list, it's an error.
-         * We pass the buffer we parsed for a clean error message.
-         */
-        report_error("UNKNOWN COMMAND");
+        ctx->parser_ptr += 4; /* Move parser past "STEP" */
+        emit(TOK_STEP);
+        compile_expression();
     }
 }
 
-
-/*
- * =============================================================================
- * --- Core Functions ---
- * =============================================================================
- */
-
 /**
- * @brief run_program
- * Executes the stored BASIC program from the beginning.
+ * @brief compile_next
+ * Arguments for: NEXT, NEXT [variable], NEXT [variable], [variable], ...
  */
-static void run_program(void)
+static void compile_next(void)
 {
-    /*
-     * A temporary buffer for the line being executed.
-     * We *must* copy the line from `program_storage` before
-     * parsing, because the parser (`execute_statement`)
-     * modifies the string it is parsing.
-     */
-    char line_buffer[MAX_LINE_LEN];
-
-    if (is_debug_mode)
+    skip_whitespace();
+    if (*ctx->parser_ptr == '\0')
     {
-        printf("[DEBUG] --- RUNNING PROGRAM ---\n");
+        return; /* A bare NEXT: the innermost loop */
     }
 
-    /* 1. Initialize the "CPU" */
-    is_running = 1;       /* Set the run flag to ON */
-    program_counter = 0;  /* Start at the first line (index 0) */
-    stack_pointer = 0;    /* Clear the GOSUB stack */
-    memset(variables, 0, sizeof(variables)); /* Clear all variables */
-
-    /*
-     * 2. Main Execution Loop
-     * This loop is the "CPU" of our interpreter.
-     * It runs as long as `is_running` is true and we haven't
-     * run off the end of the program.
-     */
-    while (is_running && program_counter < line_count)
+    while (1)
     {
-        /*
-         * We store the *current* line index.
-         * This lets us detect if a GOTO or GOSUB
-         * has changed the `program_counter`.
-         */
-        int current_line_index = program_counter;
+        if (!isalpha((unsigned char)*ctx->parser_ptr))
+        {
+            emit_error(ERR_EXPECTED_VARIABLE_NEXT);
+            return;
+        }
+        compile_term();
+        if (ctx->compile_failed) return;
 
-        if (is_debug_mode)
+        /* One TOK_VAR per variable: "NEXT J, I" */
+        skip_whitespace();
+        if (*ctx->parser_ptr != ',')
         {
-            printf("[DEBUG] Running line %d: %s\n",
-                   program_storage[program_counter].line_number,
-                   program_storage[program_counter].text);
+            return;
         }
+        ctx->parser_ptr++;
+        skip_whitespace();
+    }
+}
 
-        /*
-         * Copy the line text to our temporary buffer.
-         * This is CRITICAL. We must not let the parser
-         * modify our original program code in `program_storage`.
-         */
-        strncpy(line_buffer, program_storage[program_counter].text, MAX_LINE_LEN);
-        line_buffer[MAX_LINE_LEN - 1] = '\0'; /* Ensure null-termination */
+/**
+ * @brief compile_expression
+ * Compiles a simple mathematical expression (e.g., A + 10 - B) into
+ * *postfix* order: each operator follows the two values it combines,
+ * so "A + 10 - B" becomes "A 10 + B -". The evaluator then needs no
+ * recursion and no parentheses (see `eval_expression`).
+ *
+ * Since the dialect works strictly left-to-right, with no operator
+ * precedence, this is simply: the first term, then for each operator,
+ * the next term followed by the operator. A (sub-expression) term is
+ * compiled recursively, and its parentheses disappear.
+ *
+ * **Constant folding:** as long as everything so far is a number,
+ * each step is worked out *now*, with the same wraparound as at
+ * run time (`apply_operator`), so "(4 * 5) + A" runs as "20 A +".
+ * Only a *leading* run of numbers can fold: "A + 4 * 5" means
+ * "(A + 4) * 5", so its 4 and 5 are not combined. A division by a
+ * constant zero is left in place, to be reported when it is reached.
+ */
+static void compile_expression(void)
+{
+    char op;
+    unsigned char op_token;
+    unsigned char* start;   /* Where this expression's tokens begin */
+    unsigned char* right;   /* Where the latest term's tokens begin */
+
+    /* 1. Get the first term (e.g., "A" or "10" or "(...") */
+    start = ctx->emit_ptr;
+    compile_term();
+
+    /* 2. Loop for more terms (e.g., "+ 10", "- B") */
+    while (!ctx->compile_failed)
+    {
+        skip_whitespace();
+        op = *ctx->parser_ptr; /* Peek at the next char */
 
-        /* Set the global parser pointer to the start of this line */
-        parser_ptr = line_buffer;
+        if (op == '+')      op_token = TOK_ADD;
+        else if (op == '-') op_token = TOK_SUB;
+        else if (op == '*') op_token = TOK_MUL;
+        else if (op == '/') op_token = TOK_DIV;
+        else return; /* No more operators. The expression is done. */
 
-        /* Execute the statement(s) on this line */
-        execute_statement();
+        ctx->parser_ptr++; /* Consume the operator */
+
+        /* 3. Get the next term */
+        right = ctx->emit_ptr;
+        compile_term();
+        if (ctx->compile_failed) return;
 
         /*
-         * 3. Advance the Program Counter
-         * If the `program_counter` *was not* changed by the statement
-         * (e.g., it was not a GOTO, GOSUB, or RETURN),
-         * then we manually advance it to the next line.
+         * 4. Fold "number number op" into one number, if the whole
+         * expression so far (from `start`) is the single number on
+         * the left.
          */
-        if (is_running && program_counter == current_line_index)
+        if (right == start + VALUE_LEN && start[0] == TOK_NUM &&
+            ctx->emit_ptr == right + VALUE_LEN && right[0] == TOK_NUM &&
+            !(op_token == TOK_DIV && GET_VALUE(right + 1) == 0))
         {
-            program_counter++;
+            put_le(start + 1, (unsigned long)apply_operator(op_token,
+                GET_VALUE(start + 1), GET_VALUE(right + 1)), VALUE_BYTES);
+            ctx->emit_ptr = right; /* Drop the right-hand number */
+        }
+        else
+        {
+            emit(op_token); /* Postfix: the operator follows its term */
         }
     }
-
-    /* 4. Program finished */
-    if (is_debug_mode)
-    {
-        printf("[DEBUG] --- PROGRAM ENDED ---\n");
-    }
-    is_running = 0; /* Set the run flag to OFF */
 }
 
 /**
- * @brief list_program
- * Prints all lines currently in program storage.
+ * @brief compile_term
+ * Compiles a single "term" in an expression.
+ * A term is either a number, a variable, or a (sub-expression).
  */
-static void list_program(void)
+static void compile_term(void)
 {
-    int i;
-    for (i = 0; i < line_count; i++)
+    if (ctx->compile_failed) return; /* Guard clause */
+    skip_whitespace();
+
+    if (isalpha((unsigned char)*ctx->parser_ptr))
     {
-        printf("%d %s\n", program_storage[i].line_number, program_storage[i].text);
+        /*
+         * 1. Term is a Variable (A-Z)
+         * The variable's index is folded into the token itself.
+         */
+        char var_name = toupper((unsigned char)*ctx->parser_ptr);
+        ctx->parser_ptr++; /* Consume the variable name */
+        if (var_name < 'A' || var_name > 'Z')
+        {
+            emit_error(ERR_INVALID_VARIABLE);
+            return;
+        }
+        emit((unsigned char)(TOK_VAR + (var_name - 'A')));
     }
-}
+    else if (*ctx->parser_ptr == '(')
+    {
+        /* 2. Term is a Sub-Expression, e.g., (A + 5) */
+        ctx->parser_ptr++; /* Consume the '(' */
+        compile_expression(); /* Recursively compile the expression inside */
+        if (ctx->compile_failed) return;
 
-/**
- * @brief new_program
- * Clears the program, variables, and GOSUB stack.
- * Resets the interpreter to a clean state.
- */
-static void new_program(void)
-{
-    if (is_debug_mode)
+        skip_whitespace();
+        if (*ctx->parser_ptr != ')')
+        {
+            emit_error(ERR_EXPECTED_RPAREN);
+            return;
+        }
+        ctx->parser_ptr++; /* Consume the ')' */
+    }
+    else
     {
-        printf("[DEBUG] Clearing all memory (NEW).\n");
+        /* 3. Term is a Number */
+        compile_number();
     }
-    /*
-     * We just set line_count to 0. This "orphans" all the
-     * data in `program_storage`, effectively clearing it
-     * without spending time zeroing the memory.
-     */
-    line_count = 0;
-    program_counter = 0;
-    stack_pointer = 0;
-
-    /* We *must*, however, zero the variable and stack memory. */
-    memset(variables, 0, sizeof(variables));
-    memset(gosub_stack, 0, sizeof(gosub_stack));
 }
 
 /**
- * @brief save_program
- * Saves the current program to a text file.
- * @param filename The name of the file to save.
+ * @brief compile_number
+ * Reads a decimal (base 10) number from the `parser_ptr` string
+ * and emits it as a TOK_NUM with its (wrapped) value.
  */
-static void save_program(const char* filename)
+static void compile_number(void)
 {
-    FILE *file;
+    long value;
+    char *end_ptr;
+    unsigned char number[VALUE_BYTES];
     int i;
 
+    skip_whitespace();
+
     /*
-     * The `filename` pointer comes from `parser_ptr`,
-     * which is already pointing at the filename.
-     * We just need to check if it's empty.
+     * We use `strtol` (string-to-long) to parse the number.
+     * `strtol` will set `end_ptr` to point *after* the parsed number.
      */
-    if (filename == NULL || *filename == '\0')
+    value = strtol(ctx->parser_ptr, &end_ptr, 10);
+
+    /* Check 1: Did `strtol` parse *anything*? */
+    if (ctx->parser_ptr == end_ptr)
     {
-        report_error("FILENAME REQUIRED");
+        emit_error(ERR_EXPECTED_NUMBER);
         return;
     }
+
     /*
-     * NOTE: We are not trimming whitespace from the filename
-     * for simplicity. "SAVE my file.bas" will fail.
-     * The user must type "SAVE myfile.bas".
+     * Check 2: Did `strtol` parse a *valid* number?
+     * If it is followed by a letter, the user typed "100ABC".
      */
-
-    if (is_debug_mode)
-    {
-        printf("[DEBUG] Saving program to '%s'\n", filename);
-    }
-
-    file = fopen(filename, "w"); /* "w" = Write mode (create/overwrite) */
-    if (file == NULL)
+    if (*end_ptr != '\0' && !isspace((unsigned char)*end_ptr) && *end_ptr != ')')
     {
-        report_error("CANNOT OPEN FILE");
+        emit_error(ERR_INVALID_NUMBER);
         return;
     }
 
-    /* Iterate through program storage and print each line to the file */
-    for (i = 0; i < line_count; i++)
+    ctx->parser_ptr = end_ptr;
+
+    /*
+     * Cast the `long` value to a `Value` *now*.
+     * This is where the wraparound happens!
+     * `(signed char)128` automatically becomes -128.
+     */
+    emit(TOK_NUM);
+    put_le(number, (unsigned long)(Value)value, VALUE_BYTES);
+    for (i = 0; i < VALUE_BYTES; i++)
     {
-        fprintf(file, "%d %s\n", program_storage[i].line_number, program_storage[i].text);
+        emit(number[i]);
     }
-
-    fclose(file);
 }
 
 /**
- * @brief load_program
- * Loads a program from a text file, replacing the current one.
- * @param filename The name of the file to load.
+ * @brief compile_line_target
+ * Compiles the line number argument of GOTO and GOSUB.
+ *
+ * Unlike an expression literal, a line number is *not* wrapped to
+ * 8 bits: it is stored as a full 16-bit value, so "GOTO 200" works.
+ * Out-of-range numbers are stored as 0, which never matches a line.
  */
-static void load_program(const char* filename)
+static void compile_line_target(void)
 {
-    FILE *file;
-    /*
-     * Buffer for reading lines *from the file*.
-     * It must be large enough to hold the line number, space,
-     * and the line text.
-     */
-    char file_line_buffer[MAX_LINE_LEN + 20];
+    long value;
+    char *end_ptr;
 
-    if (filename == NULL || *filename == '\0')
-    {
-        report_error("FILENAME REQUIRED");
-        return;
-    }
+    skip_whitespace();
+    value = strtol(ctx->parser_ptr, &end_ptr, 10);
 
-    if (is_debug_mode)
+    if (ctx->parser_ptr == end_ptr)
     {
-        printf("[DEBUG] Loading program from '%s'\n", filename);
+        emit_error(ERR_EXPECTED_NUMBER);
+        return;
     }
-
-    file = fopen(filename, "r"); /* "r" = Read mode */
-    if (file == NULL)
+    if (*end_ptr != '\0' && !isspace((unsigned char)*end_ptr) && *end_ptr != ')')
     {
-        report_error("FILE NOT FOUND");
+        emit_error(ERR_INVALID_NUMBER);
         return;
     }
+    ctx->parser_ptr = end_ptr;
 
-    /* 1. Clear the old program */
-    new_program();
-
-    /*
-     * 2. Read every line from the file
-     * `fgets` reads one line at a time into `file_line_buffer`.
-     */
-    while (fgets(file_line_buffer, sizeof(file_line_buffer), file) != NULL)
+    if (value <= 0 || value > 65535)
     {
-        /* Remove newline character */
-        file_line_buffer[strcspn(file_line_buffer, "\r\n")] = 0;
-
-        /*
-         * 3. Store the line
-         * We pass the freshly-read line to `store_line`,
-         * which will parse the line number and add it to
-         * our `program_storage`.
-         */
-        store_line(file_line_buffer);
+        value = 0;
     }
+    emit(TOK_LINE);
+    emit((unsigned char)(value & 0xFF));
+    emit((unsigned char)((value >> 8) & 0xFF));
 
-    fclose(file);
+    /* The cached index is filled in by the first jump (see `cmd_goto`) */
+    emit((unsigned char)(TARGET_UNRESOLVED & 0xFF));
+    emit((unsigned char)(TARGET_UNRESOLVED >> 8));
 }
 
-
-/*
- * =============================================================================
- * --- Program Storage Functions ---
- * =============================================================================
- */
-
 /**
- * @brief find_line_index
- * Finds the array index for a given line number.
- * Uses a simple linear search.
- *
- * @param line_number The BASIC line number to find (e.g., 100).
- * @return The array index (0 to line_count-1), or -1 if not found.
+ * @brief compile_string
+ * Compiles a "quoted" string literal into a TOK_STR.
+ * `parser_ptr` must be pointing at the opening quote.
  */
-static int find_line_index(int line_number)
+static void compile_string(void)
 {
-    int i;
-    for (i = 0; i < line_count; i++)
+    const char* str_end;
+    int length;
+
+    ctx->parser_ptr++; /* Consume the opening quote */
+
+    /* Find the closing quote */
+    str_end = strchr(ctx->parser_ptr, '"');
+    if (str_end == NULL)
     {
-        if (program_storage[i].line_number == line_number)
-        {
-            return i; /* Found it */
-        }
-        if (program_storage[i].line_number > line_number)
-        {
-            /*
-             * The list is sorted, so if we've passed it,
-             * it doesn't exist. Stop early.
-             */
-            return -1;
-        }
+        /* No closing quote found. This is a syntax error. */
+        emit_error(ERR_UNTERMINATED_STRING);
+        return;
     }
-    return -1; /* Not found */
+
+    length = (int)(str_end - ctx->parser_ptr);
+    emit(TOK_STR);
+    emit((unsigned char)length);
+    while (ctx->parser_ptr < str_end)
+    {
+        emit((unsigned char)*ctx->parser_ptr);
+        ctx->parser_ptr++;
+    }
+    ctx->parser_ptr++; /* Consume the closing quote */
 }
 
 /**
- * @brief store_line
- * Inserts or replaces a line in the program storage.
- * This function is the core of the line editor. It handles
- * adding, replacing, and deleting lines.
- *
- * It also keeps the `program_storage` array sorted by line number.
- *
- * @param line_str The full text of the line, e.g., "10 PRINT A".
+ * @brief compile_rest_of_line
+ * Compiles everything left on the line, unchanged, into a TOK_STR.
+ * Used for arguments that are not BASIC syntax, such as filenames.
  */
-static void store_line(const char* line_str)
+static void compile_rest_of_line(void)
 {
-    int line_number;
-    const char *text_part;
-    int index;
-    int i;
-    char first_char;
+    int length = (int)strlen(ctx->parser_ptr);
 
-    /* 1. Parse the line number */
-    line_number = atoi(line_str);
-    if (line_number <= 0 || line_number > 65535)
+    emit(TOK_STR);
+    emit((unsigned char)length);
+    while (*ctx->parser_ptr)
     {
-        report_error("INVALID LINE NUMBER");
-        return;
+        emit((unsigned char)*ctx->parser_ptr);
+        ctx->parser_ptr++;
     }
+}
 
-    /* 2. Find where the actual text begins */
-    text_part = line_str;
-    while (isdigit((unsigned char)*text_part)) text_part++; /* Skip line number */
-    while (isspace((unsigned char)*text_part)) text_part++; /* Skip spaces */
-
-    /* `text_part` now points to the "PRINT A" part */
-
-    /* 3. Find the existing index for this line, if any */
-    index = find_line_index(line_number);
+/**
+ * @brief compile_list
+ * Arguments for: LIST, LIST n, LIST n-m, LIST n- or LIST -m
+ *
+ * The range is stored as two TOK_LINE tokens, the first and the last
+ * line number to list (a missing bound lists from 0, or to 65535).
+ * Their cached line indexes are never used: LIST finds its first
+ * line by binary search (see `write_program_text`).
+ */
+static void compile_list(void)
+{
+    long first_line = 0;
+    long last_line = 65535;
 
-    /*
-     * 4. Handle "Delete Line"
-     * If the user typed just "10" (with no text after it),
-     * `text_part` will point to an empty string.
-     */
-    first_char = *text_part;
-    if (first_char == '\0')
+    skip_whitespace();
+    if (*ctx->parser_ptr != '-' && *ctx->parser_ptr != '\0')
     {
-        if (index != -1)
+        /* "LIST n" lists that one line, unless a '-' follows */
+        if (!compile_list_bound(&first_line))
         {
-            /*
-             * Line "10" exists, and the user wants to delete it.
-             * We do this by "shuffling up" all subsequent lines
-             * to overwrite the one at `index`.
-             */
-            if (is_debug_mode)
-            {
-                printf("[DEBUG] Deleting line %d at index %d.\n", line_number, index);
-            }
-            for (i = index; i < line_count - 1; i++)
-            {
-                program_storage[i] = program_storage[i + 1];
-            }
-            line_count--; /* The program is now one line shorter */
+            return;
         }
-        /* If index == -1, the user tried to delete a line
-         * that doesn't exist, so we do nothing.
-         */
-        return;
+        last_line = first_line;
     }
 
-    /*
-     * 5. Handle "Replace Line"
-     * The line number *was* found (index is not -1),
-     * and there is text. This is a simple replacement.
-     */
-    if (index != -1)
+    if (*ctx->parser_ptr == '-')
     {
-        if (is_debug_mode)
+        ctx->parser_ptr++;
+        skip_whitespace();
+        last_line = 65535;
+        if (*ctx->parser_ptr != '\0' && !compile_list_bound(&last_line))
         {
-            printf("[DEBUG] Replacing line %d at index %d.\n", line_number, index);
+            return;
         }
-        /*
-         * We MUST clear the buffer *before* copying,
-         * to ensure it's always null-terminated.
-         */
-        memset(program_storage[index].text, 0, MAX_LINE_LEN);
-        strncpy(program_storage[index].text, text_part, MAX_LINE_LEN - 1);
-        return;
     }
 
-    /*
-     * 6. Handle "Insert New Line"
-     * The line number was *not* found (index == -1).
-     * We need to find the correct sorted position and insert it.
-     */
-    if (line_count >= MAX_LINES)
+    if (*ctx->parser_ptr != '\0')
     {
-        report_error("PROGRAM MEMORY FULL");
+        emit_error(ERR_INVALID_NUMBER);
         return;
     }
 
-    /* Find the insertion point (the first line > our new line) */
-    for (i = 0; i < line_count; i++)
+    emit(TOK_LINE);
+    emit((unsigned char)(first_line & 0xFF));
+    emit((unsigned char)((first_line >> 8) & 0xFF));
+    emit((unsigned char)(TARGET_UNRESOLVED & 0xFF));
+    emit((unsigned char)(TARGET_UNRESOLVED >> 8));
+
+    emit(TOK_LINE);
+    emit((unsigned char)(last_line & 0xFF));
+    emit((unsigned char)((last_line >> 8) & 0xFF));
+    emit((unsigned char)(TARGET_UNRESOLVED & 0xFF));
+    emit((unsigned char)(TARGET_UNRESOLVED >> 8));
+}
+
+/**
+ * @brief compile_list_bound
+ * Reads one line number of a LIST range (see `compile_list`), and
+ * the spaces after it. Numbers above 65535 are taken as 65535.
+ *
+ * @param line_number Receives the line number.
+ * @return 1 on success, 0 if a deferred error was emitted.
+ */
+static int compile_list_bound(long* line_number)
+{
+    char *end_ptr;
+
+    if (!isdigit((unsigned char)*ctx->parser_ptr))
     {
-        if (program_storage[i].line_number > line_number)
-        {
-            break;
-        }
+        emit_error(ERR_EXPECTED_NUMBER);
+        return 0;
     }
-    /* `i` is now the index where we need to insert */
 
-    if (is_debug_mode)
+    *line_number = strtol(ctx->parser_ptr, &end_ptr, 10);
+    if (*line_number > 65535)
     {
-        printf("[DEBUG] Inserting line %d at index %d.\n", line_number, i);
+        *line_number = 65535;
     }
+    ctx->parser_ptr = end_ptr;
+    skip_whitespace();
+    return 1;
+}
 
-    /*
-     * "Shuffle down" all lines from `i` to the end
-     * to make room for the new line.
-     */
-    int j;
-    for (j = line_count; j > i; j--)
+/**
+ * @brief emit
+ * Appends one byte to the code buffer being compiled.
+ * If the buffer is full, the byte is dropped and
+ * `compile_overflow` is set (see `compile_line`).
+ */
+static void emit(unsigned char byte)
+{
+    if (ctx->emit_ptr >= ctx->emit_end)
     {
-        program_storage[j] = program_storage[j - 1];
+        ctx->compile_overflow = 1;
+        ctx->compile_failed = 1;
+        return;
     }
+    *ctx->emit_ptr++ = byte;
+}
 
-    /* 7. Insert the new line into the empty slot */
-    program_storage[i].line_number = line_number;
-    /*
-     * We MUST clear the buffer *before* copying.
-     */
-    memset(program_storage[i].text, 0, MAX_LINE_LEN);
-    strncpy(program_storage[i].text, text_part, MAX_LINE_LEN - 1);
-    line_count++; /* The program is now one line longer */
+/**
+ * @brief emit_error
+ * Emits a deferred syntax error and stops compiling the line.
+ * @param error_code The ERR_* code to raise at run time.
+ */
+static void emit_error(unsigned char error_code)
+{
+    emit(TOK_ERROR);
+    emit(error_code);
+    ctx->compile_failed = 1;
 }
 
 
@@ -1140,152 +6881,174 @@ static void store_line(const char* line_str)
 /**
  * @brief cmd_print
  * Handler for: PRINT [expression] OR PRINT "[string]"
- * Parses and prints the value of an expression or a string literal.
+ * Prints the value of an expression or a string literal.
  */
 static void cmd_print(void)
 {
-    signed char value;
-    char* str_end;
-
-    skip_whitespace();
+    Value value;
 
-    /* Check if the first argument is a string literal */
-    if (*parser_ptr == '"')
+    /* Check if the argument is a string literal */
+    if (*ctx->code_ptr == TOK_STR)
     {
-        parser_ptr++; /* Consume the opening quote */
-
-        /* Find the closing quote */
-        str_end = strchr(parser_ptr, '"');
-
-        if (str_end == NULL)
-        {
-            /* No closing quote found. This is a syntax error. */
-            report_error("UNTERMINATED STRING");
-        }
-        else
-        {
-            /*
-             * A closing quote was found.
-             * Temporarily replace it with a null terminator
-             * to "cut" the string.
-             */
-            *str_end = '\0';
-            printf("%s\n", parser_ptr); /* Print the cut string */
-            *str_end = '"'; /* Restore the quote (good practice) */
-
-            /* Move the parser to just after the closing quote */
-            parser_ptr = str_end + 1;
-        }
+        /*
+         * The string's length is stored in front of it, so we
+         * print exactly that many characters, with no copying.
+         */
+        int length = ctx->code_ptr[1];
+        fprintf(ctx->output, "%.*s\n", length, (const char*)(ctx->code_ptr + 2));
+        ctx->code_ptr += 2 + length;
     }
-    else if (*parser_ptr == '\0')
+    else if (*ctx->code_ptr == TOK_EOL || *ctx->code_ptr == TOK_COLON)
     {
         /*
-         * Check if the line is just "PRINT".
+         * Check if the statement is just "PRINT".
          * If so, print a blank line (a value of 0).
          */
-        printf("0\n");
+        fprintf(ctx->output, "0\n");
     }
     else
     {
         /*
-         * It's not a string, so we assume it's an expression.
+         * It's not a string, so it must be an expression.
          */
-        value = parse_expression();
-        if (is_running) /* parse_expression might have set is_running=0 on error */
+        value = eval_expression();
+        if (ctx->is_running) /* eval_expression might have set is_running=0 on error */
         {
-            printf("%d\n", value);
+            fprintf(ctx->output, "%d\n", value);
         }
     }
 }
 
 /**
  * @brief cmd_lprint
- * Handler for: LPRINT [expression]
+ * Handler for: LPRINT [expression], LPRINT FLUSH
  *
- * Parses an expression and "prints" it to a file `lprint.out`.
- * This simulates a line printer (LPT1).
+ * Evaluates an expression and "prints" it to a file (`lprint.out`,
+ * unless changed with --lprint). This simulates a line printer (LPT1).
  *
  * Per the project specification, this is the fallback for systems
  * without a physical printer. It appends to the file, so multiple
  * LPRINT commands will build up the file.
+ *
+ * The file stays open (and buffered) until the program stops; see
+ * `lprint_close`. "LPRINT FLUSH" writes out what is buffered so far.
  */
 static void cmd_lprint(void)
 {
-    signed char value;
-    FILE *lpr_file;
+    Value value;
+
+    if (*ctx->code_ptr == TOK_FLUSH)
+    {
+        ctx->code_ptr++;
+        if (ctx->lprint_file != NULL)
+        {
+            fflush(ctx->lprint_file);
+        }
+        ctx->lprint_count = 0;
+        return;
+    }
 
-    if (*parser_ptr == '\0')
+    if (*ctx->code_ptr == TOK_EOL || *ctx->code_ptr == TOK_COLON)
     {
         value = 0; /* LPRINT with no expression prints 0 */
     }
     else
     {
-        value = parse_expression();
+        value = eval_expression();
     }
 
-    if (!is_running) return; /* Error during parsing */
+    if (!ctx->is_running) return; /* Error during evaluation */
 
-    /* Open the printer file in "append" mode */
-    lpr_file = fopen("lprint.out", "a");
-    if (lpr_file == NULL)
+    /*
+     * Open the printer file in "append" mode, once per program run
+     * (a --jobs job prints to its `lprint_sink` instead).
+     */
+    if (ctx->lprint_file == NULL)
     {
-        /* We report an error, but this is not a fatal
-         * error for the BASIC program itself.
-         */
-        report_error("COULD NOT OPEN LPRINT.OUT FILE");
-        return;
+        ctx->lprint_file = (ctx->lprint_sink != NULL) ? ctx->lprint_sink
+                                                      : fopen(ctx->lprint_path, "a");
+        if (ctx->lprint_file == NULL)
+        {
+            /* We report an error, but this is not a fatal
+             * error for the BASIC program itself.
+             */
+            report_error("COULD NOT OPEN LPRINT FILE");
+            return;
+        }
     }
 
-    fprintf(lpr_file, "%d\n", value);
-    fclose(lpr_file);
+    fprintf(ctx->lprint_file, "%d\n", value);
+    ctx->stats.lprint_writes++;
+
+    if (LPRINT_FLUSH_INTERVAL > 0 && ++ctx->lprint_count >= LPRINT_FLUSH_INTERVAL)
+    {
+        fflush(ctx->lprint_file);
+        ctx->lprint_count = 0;
+    }
 }
 
 /**
  * @brief cmd_input
- * Handler for: INPUT [variable]
- * Prompts the user for a value and stores it in a variable.
+ * Handler for: INPUT [variable], [variable], ...
+ * Prompts the user for a line of values, separated by commas, and
+ * stores them in the variables, in order (see `read_input_field`).
  */
 static void cmd_input(void)
-{
-    char var_name;
-    char input_buffer[20]; /* Small buffer for user's number */
-    signed char value;
-
-    skip_whitespace();
-    if (!isalpha((unsigned char)*parser_ptr))
-    {
-        report_error("EXPECTED VARIABLE FOR INPUT");
-        return;
-    }
-    var_name = toupper((unsigned char)*parser_ptr);
+{
+    const unsigned char* token;
+    Value value;
+    int ended = '\n'; /* What ended the last value read: a new line is due */
+    int is_first = 1;
 
     /*
-     * We must check the variable *before* asking for input,
+     * We must check the variables *before* asking for input,
      * otherwise the user gets a "?" prompt for a bad variable.
+     * (A bad variable was compiled to a TOK_ERROR.)
      */
-    if (var_name < 'A' || var_name > 'Z')
+    token = ctx->code_ptr;
+    while (*token >= TOK_VAR && *token < TOK_VAR + NUM_VARIABLES)
+    {
+        token++;
+    }
+    if (*token == TOK_ERROR)
     {
-        report_error("INVALID VARIABLE");
+        ctx->code_ptr = token;
+        expect_token(TOK_VAR);
         return;
     }
 
-    printf("? "); /* The classic BASIC input prompt */
-    fflush(stdout); /* Make sure the "?" appears before we wait */
-
-    if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+    while (*ctx->code_ptr >= TOK_VAR && *ctx->code_ptr < TOK_VAR + NUM_VARIABLES)
     {
-        /* Handle end-of-file (Ctrl+D) - stop the program */
-        if (is_running) is_running = 0;
-        return;
+        /*
+         * The classic BASIC prompts: "?" for the first line, "??" if
+         * it held too few values. Streamed input has no one to ask.
+         */
+        if (ended != ',' && !is_streamed_input)
+        {
+            fprintf(ctx->output, is_first ? "? " : "?? ");
+            fflush(ctx->output); /* Make sure the "?" appears before we wait */
+        }
+        is_first = 0;
+
+        ended = (ctx->input != NULL) ? read_input_field(ctx->input, &value) : EOF;
+        if (ended == EOF)
+        {
+            /* Handle end-of-file (Ctrl+D), or no input at all - stop the program */
+            if (ctx->is_running) ctx->is_running = 0;
+            return;
+        }
+        if (ctx->is_trace_mode)
+        {
+            trace_variable(*ctx->code_ptr - TOK_VAR, value);
+        }
+        ctx->variables[*ctx->code_ptr++ - TOK_VAR] = value;
     }
 
-    /*
-     * Parse the user's input as a DECIMAL number.
-     * We use `strtol` (base 10) and then cast to `signed char`
-     * to get our 8-bit wraparound.
-     */
-    value = (signed char)strtol(input_buffer, NULL, 10);
-    variables[var_name - 'A'] = value;
+    /* Any more values on the line are ignored */
+    while (ended != '\n' && ended != EOF)
+    {
+        ended = IB_GETC(ctx->input);
+    }
 }
 
 /**
@@ -1295,84 +7058,108 @@ static void cmd_input(void)
  */
 static void cmd_let(void)
 {
-    char var_name;
-
-    skip_whitespace();
-    if (!isalpha((unsigned char)*parser_ptr))
-    {
-        report_error("EXPECTED VARIABLE FOR LET");
-        return;
-    }
-    var_name = toupper((unsigned char)*parser_ptr);
-    parser_ptr++; /* Consume variable name */
+    int var_index;
+    Value value;
 
-    if (var_name < 'A' || var_name > 'Z')
+    /* A missing or bad variable was compiled to a TOK_ERROR. */
+    if (*ctx->code_ptr == TOK_ERROR)
     {
-        report_error("INVALID VARIABLE");
+        expect_token(TOK_VAR);
         return;
     }
+    var_index = *ctx->code_ptr++ - TOK_VAR;
 
-    skip_whitespace();
-    if (*parser_ptr != '=')
+    /* A missing '=' was also compiled to a TOK_ERROR. */
+    if (*ctx->code_ptr == TOK_ERROR)
     {
-        report_error("EXPECTED '=' IN LET");
+        expect_token(TOK_EQ);
         return;
     }
-    parser_ptr++; /* Consume '=' */
 
     /*
-     * Parse the expression on the right-hand side
-     * and assign it to the variable.
+     * Evaluate the expression on the right-hand side
+     * and assign it to the variable (unless it reported an error).
      */
-    variables[var_name - 'A'] = parse_expression();
+    value = eval_expression();
+    if (ctx->is_running)
+    {
+        ctx->variables[var_index] = value;
+        if (ctx->is_trace_mode)
+        {
+            trace_variable(var_index, value);
+        }
+    }
 }
 
 /**
  * @brief cmd_goto
  * Handler for: GOTO [line_number]
  * Unconditionally jumps to a different line number.
+ *
+ * The TOK_LINE carries the target's line index from the last time it
+ * was looked up. That is only a hint: an edit since then may have
+ * moved the lines. So it is checked against the line number (one
+ * compare), and only if it is stale (or was never looked up, or the
+ * line was missing) do we search, and cache the new index in place.
+ * Editing a line therefore never has to touch any other line.
  */
 static void cmd_goto(void)
 {
+    unsigned char* target;
     int line_num;
     int index;
 
-    /* GOTO's argument is a single number, not a full expression */
-    line_num = (int)parse_number();
+    /* GOTO's argument is a TOK_LINE, not a full expression */
+    if (!expect_token(TOK_LINE)) return;
 
-    /* Stop if parsing the line number failed */
-    if (!is_running) return;
+    /* The line's tokens are writable: only the cached index changes */
+    target = (unsigned char*)ctx->code_ptr;
+    line_num = target[0] | (target[1] << 8);
+    index = target[2] | (target[3] << 8);
+    ctx->code_ptr += 4;
 
     if (is_debug_mode)
     {
-        printf("[DEBUG] GOTO: Jumping to line %d\n", line_num);
+        fprintf(ctx->output, "[DEBUG] GOTO: Jumping to line %d\n", line_num);
     }
 
-    index = find_line_index(line_num);
+    /* TARGET_UNRESOLVED and TARGET_MISSING are never below `line_count` */
+    if (index >= ctx->line_count || LINE_NUMBER(index) != line_num)
+    {
+        index = find_line_index(line_num);
+        target[2] = (unsigned char)((index < 0 ? TARGET_MISSING : index) & 0xFF);
+        target[3] = (unsigned char)((index < 0 ? TARGET_MISSING : index) >> 8);
+    }
 
-    if (index == -1)
+    if (index < 0)
     {
         report_error("LINE NOT FOUND");
     }
     else
     {
+        ctx->stats.jumps++;
+
         /*
          * This is the "jump". We set the program counter
-         * to the *index* of the target line.
+         * to the *index* of the target line, and skip whatever
+         * follows the GOTO on this line.
          */
-        program_counter = index;
+        ctx->program_counter = index;
+        ctx->code_ptr = &end_of_line;
     }
 }
 
 /**
  * @brief cmd_gosub
  * Handler for: GOSUB [line_number]
- * Pushes the next line onto the stack and jumps (GOTO) to a line.
+ * Pushes the return address onto the stack and jumps (GOTO) to a line.
  */
 static void cmd_gosub(void)
 {
+    GosubFrame* frame;
+
     /* 1. Check for Stack Overflow */
-    if (stack_pointer >= STACK_SIZE)
+    if (ctx->stack_pointer >= ctx->stack_size)
     {
         report_error("GOSUB STACK OVERFLOW");
         return;
@@ -1380,18 +7167,31 @@ static void cmd_gosub(void)
 
     if (is_debug_mode)
     {
-        printf("[DEBUG] GOSUB: Pushing return index %d to stack slot %d\n",
-               program_counter + 1, stack_pointer);
+        fprintf(ctx->output, "[DEBUG] GOSUB: Pushing return index %d to stack slot %d\n",
+                             ctx->program_counter, ctx->stack_pointer);
     }
 
     /*
-     * 2. Push the *next* line index onto the stack
-     * We push `program_counter + 1` so that when
-     * `RETURN` is called, we resume on the line *after*
-     * the GOSUB.
+     * 2. Push the return address onto the stack
+     * `program_counter` already points at the line *after*
+     * the GOSUB (see `run_program`), so when `RETURN` is
+     * called, we resume there. If more statements follow the
+     * GOSUB on its line ("GOSUB 100 : PRINT A"), we also keep
+     * where they start, and `RETURN` resumes there instead.
      */
-    gosub_stack[stack_pointer] = program_counter + 1;
-    stack_pointer++;
+    frame = &ctx->gosub_stack[ctx->stack_pointer];
+    frame->line = ctx->program_counter;
+    frame->offset = 0;
+    if (ctx->is_program_mode && ctx->code_ptr[0] == TOK_LINE && ctx->code_ptr[5] == TOK_COLON)
+    {
+        frame->offset = (int)(ctx->code_ptr + 5 - LINE_CODE(ctx->program_counter - 1));
+    }
+    ctx->stack_pointer++;
+    ctx->stats.gosubs++;
+    if (ctx->stack_pointer > ctx->stats.max_gosub_depth)
+    {
+        ctx->stats.max_gosub_depth = ctx->stack_pointer;
+    }
 
     /*
      * 3. Now, just perform a GOTO
@@ -1403,12 +7203,14 @@ static void cmd_gosub(void)
 /**
  * @brief cmd_return
  * Handler for: RETURN
- * Pops a line index from the stack and jumps to it.
+ * Pops a return address from the stack and jumps to it.
  */
 static void cmd_return(void)
 {
+    const GosubFrame* frame;
+
     /* 1. Check for Stack Underflow */
-    if (stack_pointer <= 0)
+    if (ctx->stack_pointer <= 0)
     {
         report_error("RETURN WITHOUT GOSUB");
         return;
@@ -1418,13 +7220,31 @@ static void cmd_return(void)
      * 2. Pop the return address
      * We decrement the pointer *first*, then read the value.
      */
-    stack_pointer--;
-    program_counter = gosub_stack[stack_pointer];
+    ctx->stack_pointer--;
+    frame = &ctx->gosub_stack[ctx->stack_pointer];
+    ctx->program_counter = frame->line;
+
+    /* Any FOR loops the subroutine left unfinished end with it */
+    while (ctx->loop_pointer > 0 &&
+           ctx->loop_stack[ctx->loop_pointer - 1].depth > ctx->stack_pointer)
+    {
+        ctx->loop_pointer--;
+    }
+
+    /*
+     * 3. Resume in mid-line (at the TOK_COLON after the GOSUB),
+     * or else with the next line, as after a GOTO.
+     */
+    ctx->code_ptr = &end_of_line;
+    if (frame->offset > 0 && ctx->is_program_mode)
+    {
+        ctx->code_ptr = LINE_CODE(frame->line - 1) + frame->offset;
+    }
 
     if (is_debug_mode)
     {
-        printf("[DEBUG] RETURN: Popping index %d from stack. New PC: %d\n",
-               program_counter, program_counter);
+        fprintf(ctx->output, "[DEBUG] RETURN: Popping index %d from stack. New PC: %d\n",
+                             ctx->program_counter, ctx->program_counter);
     }
 }
 
@@ -1435,216 +7255,627 @@ static void cmd_return(void)
  * Evaluates a condition and executes a statement if true.
  * e.g., IF A > B THEN GOTO 100
  * e.g., IF A = 7 THEN PRINT 1
+ * Any statements after it on the line run only if it was true.
  *
  * NOTE: This is a minimal IF. It does *not* support ELSE.
  */
 static void cmd_if(void)
 {
-    signed char val1, val2;
-    char op[3]; /* For operators like "<>" */
+    /* For the debug message. Indexed by (operator token - TOK_EQ). */
+    static const char* const op_names[] = { "=", "<>", "<", ">" };
+    Value val1, val2;
+    unsigned char op;
     int condition = 0;
 
-    /* 1. Parse the first expression */
-    val1 = parse_expression();
-    if (!is_running) return; /* Stop if parse failed */
+    /* 1. Evaluate the first expression */
+    val1 = eval_expression();
+    if (!ctx->is_running) return; /* Stop if evaluation failed */
 
-    /* 2. Parse the operator */
-    skip_whitespace();
-    if (*parser_ptr == '=')
+    /* 2. Read the operator (TOK_EQ, TOK_NE, TOK_LT or TOK_GT) */
+    op = *ctx->code_ptr;
+    if (op < TOK_EQ || op > TOK_GT)
+    {
+        expect_token(TOK_EQ); /* Reports "EXPECTED OPERATOR IN IF" */
+        return;
+    }
+    ctx->code_ptr++;
+
+    /* 3. Evaluate the second expression */
+    val2 = eval_expression();
+    if (!ctx->is_running) return; /* Stop if evaluation failed */
+
+    /* 4. Evaluate the condition */
+    switch (op)
     {
-        op[0] = '='; op[1] = '\0';
-        parser_ptr++;
+        case TOK_EQ: condition = (val1 == val2); break;
+        case TOK_NE: condition = (val1 != val2); break;
+        case TOK_LT: condition = (val1 < val2);  break;
+        case TOK_GT: condition = (val1 > val2);  break;
     }
-    else if (*parser_ptr == '<')
+
+    if (is_debug_mode)
     {
-        parser_ptr++;
-        if (*parser_ptr == '>')
-        {
-            op[0] = '<'; op[1] = '>'; op[2] = '\0'; /* "<>" operator */
-            parser_ptr++;
-        }
-        else
+        fprintf(ctx->output, "[DEBUG] IF: val1=%d, op='%s', val2=%d. Condition is %s\n",
+                             val1, op_names[op - TOK_EQ], val2, condition ? "TRUE" : "FALSE");
+    }
+
+    /* 5. Find the "THEN" keyword */
+    if (!expect_token(TOK_THEN)) return;
+
+    /*
+     * 6. Execute if true
+     * If the condition was true, we just call `execute_statement`
+     * again on the nested statement. For "IF A=1 THEN 100", the
+     * compiler already turned the line number into a GOTO.
+     */
+    if (condition)
+    {
+        if (is_debug_mode)
         {
-            op[0] = '<'; op[1] = '\0'; /* "<" operator */
+            fprintf(ctx->output, "[DEBUG] IF (TRUE): Executing THEN statement.\n");
         }
+        execute_statement();
     }
-    else if (*parser_ptr == '>')
+    else
     {
-        op[0] = '>'; op[1] = '\0';
-        parser_ptr++;
+        /*
+         * If condition is false, the rest of the line is skipped
+         * (as in classic BASIC, "IF A = 1 THEN PRINT 1 : PRINT 2"
+         * prints nothing when A is not 1), and the `run_program`
+         * loop will advance to the next line.
+         */
+        ctx->code_ptr = &end_of_line;
     }
-    else
+}
+
+/**
+ * @brief cmd_let_add
+ * Handler for the fused statement: LET X = X + k (see OP_LET_ADD)
+ * The compiler has already checked everything, so this is one add.
+ */
+static void cmd_let_add(void)
+{
+    int var_index = ctx->code_ptr[0] - TOK_VAR;
+
+    ctx->variables[var_index] = VALUE_ADD(ctx->variables[var_index], GET_VALUE(ctx->code_ptr + 2));
+    ctx->code_ptr += 1 + VALUE_LEN;
+    if (ctx->is_trace_mode)
+    {
+        trace_variable(var_index, ctx->variables[var_index]);
+    }
+}
+
+/**
+ * @brief cmd_if_branch
+ * Handler for the fused statements: IF X [op] k THEN n
+ * (OP_IF_EQ, OP_IF_NE, OP_IF_LT and OP_IF_GT)
+ *
+ * Compares a variable with a constant and, if the condition holds,
+ * jumps through the line's GOTO, exactly as `cmd_if` would.
+ */
+static void cmd_if_branch(void)
+{
+    static const char* const op_names[] = { "=", "<>", "<", ">" };
+    unsigned char op = (unsigned char)(ctx->code_ptr[-1] - OP_IF_EQ);
+    Value value = ctx->variables[ctx->code_ptr[0] - TOK_VAR];
+    Value constant = GET_VALUE(ctx->code_ptr + 2);
+    int condition = 0;
+
+    switch (op)
+    {
+        case 0: condition = (value == constant); break;
+        case 1: condition = (value != constant); break;
+        case 2: condition = (value < constant);  break;
+        case 3: condition = (value > constant);  break;
+    }
+    ctx->code_ptr += 1 + VALUE_LEN; /* Now at the OP_GOTO */
+
+    if (is_debug_mode)
+    {
+        fprintf(ctx->output, "[DEBUG] IF: val1=%d, op='%s', val2=%d. Condition is %s\n",
+                             value, op_names[op], constant, condition ? "TRUE" : "FALSE");
+    }
+
+    if (!condition)
     {
-        report_error("EXPECTED OPERATOR IN IF");
+        ctx->code_ptr = &end_of_line; /* Skip the rest of the line */
         return;
     }
 
-    /* 3. Parse the second expression */
-    val2 = parse_expression();
-    if (!is_running) return; /* Stop if parse failed */
+    if (is_debug_mode || is_profile_mode)
+    {
+        if (is_debug_mode)
+        {
+            fprintf(ctx->output, "[DEBUG] IF (TRUE): Executing THEN statement.\n");
+        }
+        execute_statement(); /* The GOTO is traced and counted as usual */
+    }
+    else
+    {
+        ctx->code_ptr++; /* Skip the OP_GOTO */
+        cmd_goto();
+    }
+}
 
-    /* 4. Evaluate the condition */
-    if (strcmp(op, "=") == 0)
+/**
+ * @brief cmd_for
+ * Handler for: FOR [variable] = [expr] TO [expr] [STEP [expr]]
+ *
+ * Sets the variable to its first value and pushes a loop onto the
+ * loop stack. The limit and the step are worked out only once, here.
+ * As in Microsoft BASIC, the test is made by NEXT, so the body always
+ * runs at least once.
+ *
+ * A FOR for a variable which already has a loop on the stack (say,
+ * one left with a GOTO) replaces that loop, and every loop inside it,
+ * so such loops never fill up the stack. (Only the loops of the
+ * current subroutine are looked at; see `LoopFrame`.)
+ */
+static void cmd_for(void)
+{
+    LoopFrame* frame;
+    int var_index;
+    int i;
+    Value start, limit;
+    Value step = 1;
+
+    /* A missing or bad variable was compiled to a TOK_ERROR. */
+    if (*ctx->code_ptr < TOK_VAR || *ctx->code_ptr >= TOK_VAR + NUM_VARIABLES)
     {
-        condition = (val1 == val2);
+        expect_token(TOK_VAR);
+        return;
     }
-    else if (strcmp(op, "<>") == 0)
+    var_index = *ctx->code_ptr++ - TOK_VAR;
+
+    /* 1. The first value, the limit and the step */
+    start = eval_expression();
+    if (!ctx->is_running) return;
+    if (!expect_token(TOK_TO)) return;
+    limit = eval_expression();
+    if (!ctx->is_running) return;
+    if (*ctx->code_ptr == TOK_STEP)
     {
-        condition = (val1 != val2);
+        ctx->code_ptr++;
+        step = eval_expression();
+        if (!ctx->is_running) return;
     }
-    else if (strcmp(op, "<") == 0)
+
+    /* 2. Find the slot: this variable's old loop, or the next free one */
+    for (i = ctx->loop_pointer - 1; i >= 0 && ctx->loop_stack[i].depth == ctx->stack_pointer; i--)
     {
-        condition = (val1 < val2);
+        if (ctx->loop_stack[i].variable == var_index)
+        {
+            ctx->loop_pointer = i;
+            break;
+        }
     }
-    else if (strcmp(op, ">") == 0)
+    if (ctx->loop_pointer >= LOOP_STACK_SIZE)
     {
-        condition = (val1 > val2);
+        report_error("FOR STACK OVERFLOW");
+        return;
     }
 
     if (is_debug_mode)
     {
-        printf("[DEBUG] IF: val1=%d, op='%s', val2=%d. Condition is %s\n",
-               val1, op, val2, condition ? "TRUE" : "FALSE");
+        fprintf(ctx->output, "[DEBUG] FOR: %c = %d TO %d STEP %d, loop stack slot %d\n",
+                             'A' + var_index, start, limit, step, ctx->loop_pointer);
     }
 
-    /* 5. Find the "THEN" keyword */
-    skip_whitespace();
+    /* 3. Push the loop. Its body starts right after this statement. */
+    ctx->variables[var_index] = start;
+    if (ctx->is_trace_mode)
+    {
+        trace_variable(var_index, start);
+    }
+    frame = &ctx->loop_stack[ctx->loop_pointer];
+    frame->line = ctx->program_counter;
+    frame->body = ctx->code_ptr;
+    frame->depth = ctx->stack_pointer;
+    frame->variable = (unsigned char)var_index;
+    frame->limit = limit;
+    frame->step = step;
+    ctx->loop_pointer++;
+}
 
-    /*
-     * We must use `ib_stricmp`
-     * to check for "THEN" case-insensitively.
-     */
-    if (ib_stricmp(parser_ptr, "THEN") != 0)
+/**
+ * @brief cmd_next
+ * Handler for: NEXT, NEXT [variable], NEXT [variable], [variable], ...
+ *
+ * Adds the step to the loop's variable and, unless it has gone past
+ * the limit, jumps back to the start of the loop's body. Otherwise the
+ * loop is popped, and execution carries on after the NEXT (or with
+ * the next variable in the list, as in "NEXT J, I").
+ *
+ * A step which wraps the value around has gone past any limit, so
+ * "FOR I = 1 TO 127" ends (with I = -128) instead of running forever.
+ * "NEXT I" also ends any loops inside I's loop which were never
+ * finished; a bare NEXT means the innermost loop.
+ */
+static void cmd_next(void)
+{
+    const unsigned char* token;
+    LoopFrame* frame;
+    Value old, value;
+    int i;
+
+    /* A bad variable was compiled to a TOK_ERROR: report it first. */
+    token = ctx->code_ptr;
+    while (*token >= TOK_VAR && *token < TOK_VAR + NUM_VARIABLES)
     {
-        /*
-         * Our portable ib_stricmp checks that the keyword
-         * is followed by a space or end-of-string.
-         * If it fails, it's an error.
-         */
-        report_error("EXPECTED 'THEN' IN IF");
+        token++;
+    }
+    if (*token == TOK_ERROR)
+    {
+        ctx->code_ptr = token;
+        expect_token(TOK_VAR);
         return;
     }
 
-    parser_ptr += 4; /* Move parser past "THEN" */
-    skip_whitespace();
-
-    /*
-     * 6. Execute if true
-     * If the condition was true, we just call `execute_statement`
-     * again on the *rest of the line*.
-     */
-    if (condition)
+    do
     {
-        if (is_debug_mode)
+        /* 1. Find the loop (in this subroutine) */
+        i = ctx->loop_pointer - 1;
+        if (*ctx->code_ptr >= TOK_VAR && *ctx->code_ptr < TOK_VAR + NUM_VARIABLES)
         {
-            printf("[DEBUG] IF (TRUE): Executing remainder of line: '%s'\n", parser_ptr);
+            while (i >= 0 && ctx->loop_stack[i].depth == ctx->stack_pointer &&
+                   ctx->loop_stack[i].variable != *ctx->code_ptr - TOK_VAR)
+            {
+                i--;
+            }
+            ctx->code_ptr++;
         }
-        /*
-         * Special implicit GOTO: "IF A=1 THEN 100"
-         * If the token after THEN is a number, we do a GOTO.
-         */
-        if (isdigit((unsigned char)*parser_ptr))
+        if (i < 0 || ctx->loop_stack[i].depth != ctx->stack_pointer)
         {
-            cmd_goto();
+            report_error("NEXT WITHOUT FOR");
+            return;
         }
-        else
+        ctx->loop_pointer = i + 1;
+        frame = &ctx->loop_stack[i];
+
+        /* 2. Step, and compare with the limit */
+        old = ctx->variables[frame->variable];
+        value = VALUE_ADD(old, frame->step);
+        ctx->variables[frame->variable] = value;
+        if (ctx->is_trace_mode)
+        {
+            trace_variable(frame->variable, value);
+        }
+
+        if (frame->step >= 0 ? (value >= old && value <= frame->limit)
+                             : (value <= old && value >= frame->limit))
+        {
+            /* 3. Go round again */
+            if (is_debug_mode)
+            {
+                fprintf(ctx->output, "[DEBUG] NEXT: %c = %d, looping back.\n",
+                                     'A' + frame->variable, value);
+            }
+            ctx->program_counter = frame->line;
+            ctx->code_ptr = frame->body;
+            return;
+        }
+
+        /* 4. The loop is finished */
+        if (is_debug_mode)
+        {
+            fprintf(ctx->output, "[DEBUG] NEXT: %c = %d, loop finished.\n",
+                                 'A' + frame->variable, value);
+        }
+        ctx->loop_pointer--;
+    } while (*ctx->code_ptr >= TOK_VAR && *ctx->code_ptr < TOK_VAR + NUM_VARIABLES);
+}
+
+/**
+ * @brief cmd_rem
+ * Handler for: REM [any text]
+ * Does nothing. This is a "REMark" (a comment).
+ */
+static void cmd_rem(void)
+{
+    /*
+     * We just "do nothing". The compiler emitted only
+     * the OP_REM opcode; the rest of the line was
+     * never tokenized.
+     */
+}
+
+/**
+ * @brief cmd_end
+ * Handler for: END (or STOP)
+ * Stops the program execution.
+ */
+static void cmd_end(void)
+{
+    /* This is the "off switch" for the `run_program` loop. */
+    ctx->is_running = 0;
+}
+
+/**
+ * @brief cmd_beep
+ * Handler for: BEEP
+ * Sounds the terminal's alert bell.
+ */
+static void cmd_beep(void)
+{
+    fprintf(ctx->output, "\a"); /* \a is the standard C "alert" character */
+    console_flush();
+}
+
+/**
+ * @brief cmd_system
+ * Handler for: SYSTEM
+ * Reserved command. Does nothing.
+ */
+static void cmd_system(void)
+{
+    /*
+     * This is a stub. Per the spec, it is reserved.
+     * We may add functionality later via a module.
+     */
+    cmd_stub("SYSTEM");
+}
+
+/**
+ * @brief cmd_exit
+ * Handler for: EXIT
+ * Reserved command. Does nothing. (Alias for QUIT)
+ */
+static void cmd_exit(void)
+{
+    /*
+     * Per ECMA-55, QUIT is the command to exit to the OS.
+     * We provide this as an alias.
+     */
+    cmd_quit();
+}
+
+/**
+ * @brief cmd_quit
+ * Handler for: QUIT
+ * Exits the interpreter and returns to the OS.
+ */
+static void cmd_quit(void)
+{
+    /* This stops the program if it's running */
+    if (ctx->is_running)
+    {
+        ctx->is_running = 0;
+    }
+    lprint_close(); /* Don't lose buffered LPRINT output */
+
+#ifdef IB_LIBRARY
+    /*
+     * A library must never end its host's process: QUIT only ends
+     * the program (like END), and `ib_run` returns.
+     */
+#else
+    /*
+     * This exits the entire `ib` process.
+     * `exit(0)` = "normal, successful exit".
+     * (In a --jobs batch, it only ends this program: the others
+     * carry on, and their output must not be lost.)
+     */
+    if (!is_job_mode)
+    {
+        exit(0);
+    }
+#endif
+}
+
+/**
+ * @brief cmd_stats
+ * Handler for: STATS (direct mode only)
+ * Shows the interpreter's counters since it started (see `RunStats`).
+ */
+static void cmd_stats(void)
+{
+    const RunStats* stats = &ctx->stats;
+
+    fprintf(ctx->output, "%-16s %lu\n", "RUNS", stats->runs);
+    fprintf(ctx->output, "%-16s %lu (LAST RUN %lu)\n", "STATEMENTS",
+                         stats->statements, stats->last_statements);
+    fprintf(ctx->output, "%-16s %lu\n", "GOTOS", stats->jumps - stats->gosubs);
+    fprintf(ctx->output, "%-16s %lu\n", "GOSUBS", stats->gosubs);
+    fprintf(ctx->output, "%-16s %d OF %d\n", "MAX GOSUB DEPTH",
+                         stats->max_gosub_depth, ctx->stack_size);
+    fprintf(ctx->output, "%-16s %lu\n", "LINE LOOKUPS", stats->line_lookups);
+    fprintf(ctx->output, "%-16s %lu\n", "LPRINT WRITES", stats->lprint_writes);
+    fprintf(ctx->output, "%-16s %.3f MS (LAST RUN %.3f MS)\n", "RUN TIME",
+                         stats->total_seconds * 1000.0, stats->last_seconds * 1000.0);
+}
+
+/**
+ * @brief cmd_trace
+ * Handler for: TRACE [ON | OFF] (direct mode only)
+ * TRACE shows the execution trace of the last RUN (see `trace_dump`);
+ * TRACE ON and TRACE OFF start and stop tracing (as --trace does).
+ */
+static void cmd_trace(void)
+{
+    /* The argument was compiled as a TOK_STR (see `compile_rest_of_line`) */
+    char argument[8];
+    int length = ctx->code_ptr[1];
+
+    if (length > (int)sizeof(argument) - 1)
+    {
+        length = (int)sizeof(argument) - 1;
+    }
+    memcpy(argument, ctx->code_ptr + 2, (size_t)length);
+    argument[length] = '\0';
+    argument[strcspn(argument, " \t")] = '\0';
+    ctx->code_ptr += 2 + ctx->code_ptr[1];
+
+    if (argument[0] == '\0')
+    {
+        if (!ctx->is_trace_mode && ctx->trace_count == 0)
         {
-            /*
-             * It's a regular command (e.g., "THEN PRINT A")
-             * We recursively call execute_statement() on the
-             * remainder of the line.
-             */
-            execute_statement();
+            fprintf(ctx->output, "TRACE IS OFF (USE TRACE ON)\n");
+            return;
         }
+        trace_dump(ctx->output);
+    }
+    else if (ib_stricmp(argument, "ON") == 0)
+    {
+        ctx->is_trace_mode = 1;
+    }
+    else if (ib_stricmp(argument, "OFF") == 0)
+    {
+        ctx->is_trace_mode = 0;
+    }
+    else
+    {
+        report_error("SYNTAX ERROR");
     }
-    /*
-     * If condition is false, we do nothing.
-     * `cmd_if` returns, and the `run_program` loop
-     * will advance to the next line.
-     */
 }
 
 /**
- * @brief cmd_rem
- * Handler for: REM [any text]
- * Does nothing. This is a "REMark" (a comment).
+ * @brief cmd_run
+ * Handler for: RUN (direct mode only)
  */
-static void cmd_rem(void)
+static void cmd_run(void)
 {
-    /*
-     * We just "do nothing". The parser has already
-     * consumed the "REM" token. The rest of the
-     * line (`parser_ptr`) is ignored.
-     */
+    run_program(0);
 }
 
 /**
- * @brief cmd_end
- * Handler for: END (or STOP)
- * Stops the program execution.
+ * @brief cmd_list
+ * Handler for: LIST [n][-[m]] (direct mode only)
  */
-static void cmd_end(void)
+static void cmd_list(void)
 {
-    /* This is the "off switch" for the `run_program` loop. */
-    is_running = 0;
+    int first_line;
+    int last_line;
+
+    /* The range was compiled as two TOK_LINEs (see `compile_list`) */
+    if (!expect_token(TOK_LINE)) return;
+    first_line = ctx->code_ptr[0] | (ctx->code_ptr[1] << 8);
+    ctx->code_ptr += 4;
+
+    if (!expect_token(TOK_LINE)) return;
+    last_line = ctx->code_ptr[0] | (ctx->code_ptr[1] << 8);
+    ctx->code_ptr += 4;
+
+    list_program(first_line, last_line);
 }
 
 /**
- * @brief cmd_beep
- * Handler for: BEEP
- * Sounds the terminal's alert bell.
+ * @brief cmd_new
+ * Handler for: NEW (direct mode only)
  */
-static void cmd_beep(void)
+static void cmd_new(void)
 {
-    printf("\a"); /* \a is the standard C "alert" character */
-    fflush(stdout);
+    new_program();
 }
 
 /**
- * @brief cmd_system
- * Handler for: SYSTEM
- * Reserved command. Does nothing.
+ * @brief cmd_save
+ * Handler for: SAVE [filename] (direct mode only)
  */
-static void cmd_system(void)
+static void cmd_save(void)
 {
     /*
-     * This is a stub. Per the spec, it is reserved.
-     * We may add functionality later via a module.
+     * The filename was compiled as a TOK_STR.
+     * We copy it into a null-terminated buffer for `fopen`.
      */
-    cmd_stub("SYSTEM");
+    char filename[MAX_LINE_LEN + 20];
+    int length = ctx->code_ptr[1];
+
+    memcpy(filename, ctx->code_ptr + 2, length);
+    filename[length] = '\0';
+    save_program(filename);
 }
 
 /**
- * @brief cmd_exit
- * Handler for: EXIT
- * Reserved command. Does nothing. (Alias for QUIT)
+ * @brief cmd_load
+ * Handler for: LOAD [filename] (direct mode only)
  */
-static void cmd_exit(void)
+static void cmd_load(void)
 {
-    /*
-     * Per ECMA-55, QUIT is the command to exit to the OS.
-     * We provide this as an alias.
-     */
-    cmd_quit();
+    /* Same as SAVE: the filename is a TOK_STR. */
+    char filename[MAX_LINE_LEN + 20];
+    int length = ctx->code_ptr[1];
+
+    memcpy(filename, ctx->code_ptr + 2, length);
+    filename[length] = '\0';
+    load_program(filename);
 }
 
 /**
- * @brief cmd_quit
- * Handler for: QUIT
- * Exits the interpreter and returns to the OS.
+ * @brief cmd_snapshot
+ * Handler for: SNAPSHOT [filename]
+ * Saves the program and the state of the run (see `save_snapshot`).
+ * In a program, RESTORE carries on with the next line.
  */
-static void cmd_quit(void)
+static void cmd_snapshot(void)
 {
-    /* This stops the program if it's running */
-    if (is_running)
-    {
-        is_running = 0;
-    }
-    /*
-     * This exits the entire `ib` process.
-     * `exit(0)` = "normal, successful exit".
-     */
-    exit(0);
+    /* Same as SAVE: the filename is a TOK_STR. */
+    char filename[MAX_LINE_LEN + 20];
+    int length = ctx->code_ptr[1];
+
+    memcpy(filename, ctx->code_ptr + 2, length);
+    filename[length] = '\0';
+    ctx->code_ptr += 2 + length;
+    save_snapshot(filename);
+}
+
+/**
+ * @brief cmd_restore
+ * Handler for: RESTORE [filename] (direct mode only)
+ * Restores a snapshot and carries on running its program.
+ */
+static void cmd_restore(void)
+{
+    /* Same as SAVE: the filename is a TOK_STR. */
+    char filename[MAX_LINE_LEN + 20];
+    int length = ctx->code_ptr[1];
+
+    memcpy(filename, ctx->code_ptr + 2, length);
+    filename[length] = '\0';
+    ctx->code_ptr += 2 + length;
+    restore_snapshot(filename);
+}
+
+/**
+ * @brief cmd_import
+ * Handler for the reserved module command $IMPORT.
+ * This is handled by a simple "stub" function for now.
+ */
+static void cmd_import(void)
+{
+    cmd_stub("$IMPORT");
+}
+
+/**
+ * @brief cmd_include
+ * Handler for: $INCLUDE [filename] (direct mode only)
+ * Merges a file into the program, unless it has already been read
+ * since the last NEW (see `merge_file`).
+ */
+static void cmd_include(void)
+{
+    /* Same as LOAD: the filename is a TOK_STR. */
+    char filename[MAX_LINE_LEN + 20];
+    int length = ctx->code_ptr[1];
+
+    memcpy(filename, ctx->code_ptr + 2, length);
+    filename[length] = '\0';
+    merge_program(filename, 1);
+}
+
+/**
+ * @brief cmd_merge
+ * Handler for: $MERGE [filename] (direct mode only)
+ * Merges a file into the program: its lines are added, and replace
+ * any lines with the same numbers (see `merge_file`).
+ */
+static void cmd_merge(void)
+{
+    char filename[MAX_LINE_LEN + 20];
+    int length = ctx->code_ptr[1];
+
+    memcpy(filename, ctx->code_ptr + 2, length);
+    filename[length] = '\0';
+    merge_program(filename, 0);
 }
 
 /**
@@ -1659,237 +7890,330 @@ static void cmd_stub(const char* command)
      * We don't use `report_error` here because this isn't
      * a *syntax* error, just an unimplemented feature.
      */
-    printf("FRAMEWORK: Command %s is not implemented.\n", command);
+    fprintf(ctx->output, "FRAMEWORK: Command %s is not implemented.\n", command);
     /* We don't stop the program, just ignore it. */
 }
 
 
 /*
  * =============================================================================
- * --- Parser Functions ---
+ * --- Expression Evaluator ---
  * =============================================================================
  */
 
 /**
- * @brief parse_expression
- * Parses a simple mathematical expression (e.g., A + 10 - B).
+ * @brief apply_operator
+ * Combines two values with an arithmetic operator token, wrapping the
+ * result to the width of a Value. Shared by the evaluator and the
+ * compiler's constant folding, so that both always agree.
+ * The caller must rule out a division by zero.
+ *
+ * @param op TOK_ADD, TOK_SUB, TOK_MUL or TOK_DIV.
+ * @return The signed result of "left op right".
+ */
+static Value apply_operator(unsigned char op, Value left, Value right)
+{
+    /*
+     * We cast to `Value` *after* the operation
+     * to perform the wraparound (see VALUE_ADD).
+     */
+    switch (op)
+    {
+        case TOK_ADD: return VALUE_ADD(left, right);
+        case TOK_SUB: return VALUE_SUB(left, right);
+        case TOK_MUL: return VALUE_MUL(left, right);
+        default:
+#ifdef IB_INT32
+            /*
+             * The one division which overflows an `int`, INT_MIN / -1,
+             * traps on most CPUs: negate instead (it wraps to INT_MIN).
+             */
+            if (right == -1)
+            {
+                return VALUE_SUB(0, left);
+            }
+#endif
+            /*
+             * C's integer division automatically truncates,
+             * which is exactly what we want.
+             */
+            return (Value)(left / right);
+    }
+}
+
+/**
+ * @brief eval_expression
+ * Evaluates a compiled expression (e.g., A + 10 - B) at `code_ptr`.
  *
- * **LIMITATION:** This parser has NO operator precedence.
+ * **LIMITATION:** This evaluator has NO operator precedence.
  * It evaluates strictly left-to-right.
  * `A + B * C` is evaluated as `(A + B) * C`.
  *
- * @return The final 8-bit signed result of the expression.
+ * The compiler stored the expression in postfix order ("A 10 + B -",
+ * see `compile_expression`), so this is one flat loop over a small
+ * value stack: numbers and variables are pushed, and an operator
+ * replaces the top two values with its result. The expression ends
+ * at the first token which is neither (e.g., TOK_EOL or TOK_THEN),
+ * and its result is the one value left on the stack.
+ *
+ * @return The final (wrapped) signed result of the expression.
  */
-static signed char parse_expression(void)
+static Value eval_expression(void)
 {
-    signed char result;
-    signed char next_term;
-    char op;
+    Value stack[EXPR_STACK_SIZE];
+    int depth = 0;
+    unsigned char token;
 
     /* Guard clause for cascading errors */
-    if (!is_running) return 0;
-
-    /* 1. Get the first term (e.g., "A" or "10" or "(...") */
-    result = parse_term();
+    if (!ctx->is_running) return 0;
 
-    /* 2. Loop for more terms (e.g., "+ 10", "- B") */
-    while (is_running)
+    for (;;)
     {
-        skip_whitespace();
-        op = *parser_ptr; /* Peek at the next char */
-
-        /* Check for a valid operator */
-        if (op != '+' && op != '-' && op != '*' && op != '/')
-        {
-            /*
-             * No more operators. The expression is done.
-             * Return the result we've calculated so far.
-             */
-            return result;
-        }
-        parser_ptr++; /* Consume the operator */
-
-        /* 3. Get the next term */
-        next_term = parse_term();
+        token = *ctx->code_ptr;
 
-        /* 4. Perform the operation */
-        if (op == '+')
-        {
-            /*
-             * We cast to (signed char) *after* the operation
-             * to perform the 8-bit wraparound.
-             */
-            result = (signed char)(result + next_term);
-        }
-        else if (op == '-')
+        if (token >= TOK_VAR && token < TOK_VAR + NUM_VARIABLES)
         {
-            result = (signed char)(result - next_term);
+            /* A variable (A-Z). The token itself tells us which one. */
+            if (depth >= EXPR_STACK_SIZE) break;
+            stack[depth++] = ctx->variables[token - TOK_VAR];
+            ctx->code_ptr++;
         }
-        else if (op == '*')
+        else if (token == TOK_NUM)
         {
-            result = (signed char)(result * next_term);
+            /* A number. It was parsed (and wrapped) by the compiler. */
+            if (depth >= EXPR_STACK_SIZE) break;
+            stack[depth++] = GET_VALUE(ctx->code_ptr + 1);
+            ctx->code_ptr += VALUE_LEN;
         }
-        else if (op == '/')
+        else if (token >= TOK_ADD && token <= TOK_DIV)
         {
-            if (next_term == 0)
+            if (depth < 2) break;
+            ctx->code_ptr++;
+            depth--;
+            if (token == TOK_DIV && stack[depth] == 0)
             {
                 report_error("DIVISION BY ZERO");
                 return 0; /* Stop immediately */
             }
+            stack[depth - 1] = apply_operator(token, stack[depth - 1], stack[depth]);
+        }
+        else if (depth == 1 && token != TOK_ERROR)
+        {
+            return stack[0]; /* The end of the expression */
+        }
+        else
+        {
             /*
-             * C's integer division automatically truncates,
-             * which is exactly what we want.
+             * A term is missing. The compiler left a TOK_ERROR
+             * here (e.g., "EXPECTED NUMBER"), which we now report.
              */
-            result = (signed char)(result / next_term);
+            expect_token(TOK_NUM);
+            return 0;
         }
     }
 
-    return result;
+    report_error("SYNTAX ERROR"); /* A malformed expression: should never happen */
+    return 0;
 }
 
 /**
- * @brief parse_term
- * Parses a single "term" in an expression.
- * A term is either a number, a variable, or a (sub-expression).
+ * @brief expect_token
+ * Consumes the expected token at `code_ptr`.
+ *
+ * If the token is not there, the compiler must have left a TOK_ERROR
+ * in its place (it emits an error exactly where the text stopped
+ * making sense), so we report the error that it carries.
  *
- * @return The 8-bit signed value of the term.
+ * @param token The token that should be next (e.g., TOK_THEN).
+ * @return 1 if the token was consumed, 0 if an error was reported.
  */
-static signed char parse_term(void)
+static int expect_token(unsigned char token)
 {
-    signed char value;
-
-    if (!is_running) return 0; /* Guard clause */
-    skip_whitespace();
-
-    if (isalpha((unsigned char)*parser_ptr))
+    if (*ctx->code_ptr == token)
     {
-        /*
-         * 1. Term is a Variable (A-Z)
-         * We get its value from storage.
-         */
-        char var_name = toupper((unsigned char)*parser_ptr);
-        parser_ptr++; /* Consume the variable name */
-        if (var_name < 'A' || var_name > 'Z')
-        {
-            report_error("INVALID VARIABLE");
-            return 0;
-        }
-        return variables[var_name - 'A'];
+        ctx->code_ptr++;
+        return 1;
     }
-    else if (*parser_ptr == '(')
+
+    if (*ctx->code_ptr == TOK_ERROR)
     {
-        /*
-         * 2. Term is a Sub-Expression, e.g., (A + 5)
-         * This adds support for operator precedence.
-         */
-        parser_ptr++; /* Consume the '(' */
-        value = parse_expression(); /* Recursively parse the expression inside */
-        skip_whitespace();
-        if (*parser_ptr != ')')
-        {
-            report_error("EXPECTED ')'");
-            return 0;
-        }
-        parser_ptr++; /* Consume the ')' */
-        return value;
+        report_error(error_messages[ctx->code_ptr[1]]);
     }
     else
     {
-        /*
-         * 3. Term is a Number
-         * It's a positive or negative number (e.g., 127, -8).
-         */
-        return parse_number();
+        report_error("SYNTAX ERROR"); /* Should never happen */
     }
+    return 0;
 }
 
+
+/*
+ * =============================================================================
+ * --- Utility Functions ---
+ * =============================================================================
+ */
+
 /**
- * @brief parse_number
- * Reads a decimal (base 10) number from the `parser_ptr` string,
- * advances the pointer, and returns the 8-bit signed value.
- *
- * @return The 8-bit signed value.
+ * @brief report_error
+ * A centralized function for reporting errors.
+ * It sounds the bell, prints the message, and stops the program
+ * *if* it's running.
+ * @param message The error message (e.g., "SYNTAX ERROR").
  */
-static signed char parse_number(void)
+static void report_error(const char* message)
 {
-    long value = 0;
-    char *end_ptr;
-
-    if (!is_running) return 0; /* Guard clause */
-    skip_whitespace();
-
-    /*
-     * We use `strtol` (string-to-long) to parse the number.
-     * - `parser_ptr`: Where to start parsing.
-     * - `&end_ptr`: `strtol` will set this to point *after* the parsed number.
-     * - `10`: The base (decimal).
-     */
-    value = strtol(parser_ptr, &end_ptr, 10);
-
-    /* Check 1: Did `strtol` parse *anything*? */
-    if (parser_ptr == end_ptr)
+    if (!is_batch_mode)
     {
-        /*
-         * No, it didn't. This means `parser_ptr` was pointing
-         * at something that isn't a number (e.g., in "PRINT "Hello"").
-         */
-        report_error("EXPECTED NUMBER");
-        return 0;
+        fprintf(ctx->output, "\a"); /* Sound the alert bell */
     }
+    fprintf(ctx->output, "ERROR: %s\n", message);
+    console_flush();
+    ctx->error_count++;
+    ctx->stats.errors++;
 
-    /*
-     * Check 2: Did `strtol` parse a *valid* number?
-     * `end_ptr` should now be pointing at a space or the end
-     * of the string. If it's pointing at a letter, it means
-     * the user typed "100ABC", which is an error.
-     */
-    if (*end_ptr != '\0' && !isspace((unsigned char)*end_ptr) && *end_ptr != ')')
+    if (ctx->is_running)
     {
-        report_error("INVALID NUMBER");
-        return 0;
+        if (ctx->is_trace_mode)
+        {
+            trace_dump(stderr); /* What led up to it */
+        }
+        if (is_debug_mode)
+        {
+            fprintf(ctx->output, "[DEBUG] Halting program due to error.\n");
+        }
+        ctx->is_running = 0; /* Stop the program */
     }
+}
 
+/**
+ * @brief report_load_error
+ * Reports an error in a line being loaded (see `read_lines`), with
+ * the position of that line: "LINE TOO LONG (big.bas LINE 1200)".
+ * @param message The error message (e.g., "LINE TOO LONG").
+ */
+static void report_load_error(const char* message)
+{
+    char text[160];
 
-    /* Success. Move our global parser pointer to where `strtol` finished */
-    parser_ptr = end_ptr;
+    if (ctx->load_file_name == NULL)
+    {
+        report_error(message);
+        return;
+    }
 
-    /*
-     * Finally, cast the `long` value to a `signed char`.
-     * This is where the 8-bit wraparound happens!
-     * `(signed char)128` automatically becomes -128.
-     * `(signed char)300` (which is 0x12C) becomes 0x2C, which is 44.
-     */
-    return (signed char)value;
+    if (*ctx->load_file_name == '\0')
+    {
+        sprintf(text, "%.40s (LINE %ld)", message, ctx->load_file_line);
+    }
+    else
+    {
+        sprintf(text, "%.40s (%.64s LINE %ld)", message,
+                ctx->load_file_name, ctx->load_file_line);
+    }
+    report_error(text);
 }
 
+/**
+ * @brief lprint_close
+ * Writes out any buffered LPRINT output and closes the printer file.
+ * Called whenever a program (or a direct-mode line) finishes, for
+ * any reason, and before the interpreter exits. The next LPRINT
+ * simply re-opens the file. (A job's `lprint_sink` stays open: it
+ * belongs to `run_jobs`.)
+ */
+static void lprint_close(void)
+{
+    if (ctx->lprint_file != NULL && ctx->lprint_file != ctx->lprint_sink)
+    {
+        fclose(ctx->lprint_file);
+    }
+    ctx->lprint_file = NULL;
+    ctx->lprint_count = 0;
+}
 
-/*
- * =============================================================================
- * --- Utility Functions ---
- * =============================================================================
+/**
+ * @brief console_flush
+ * Flushes standard output so that it appears *now* (a prompt, a bell,
+ * an error message), unless the output is buffered (see
+ * `is_buffered_output`), in which case it is left for the next block.
+ * INPUT always flushes, since the user must see its "?" prompt.
  */
+static void console_flush(void)
+{
+    if (!is_buffered_output)
+    {
+        fflush(ctx->output);
+    }
+}
 
 /**
- * @brief report_error
- * A centralized function for reporting errors.
- * It sounds the bell, prints the message, and stops the program
- * *if* it's running.
- * @param message The error message (e.g., "SYNTAX ERROR").
+ * @brief read_input_field
+ * Reads one value for INPUT: the next field of the current input
+ * line, up to a comma or the end of the line. Like `strtol`, it skips
+ * leading spaces, reads an optional sign and the digits, and ignores
+ * anything else in the field (a field without digits is 0). The value
+ * then wraps to the width of a Value, as every value does.
+ *
+ * The characters are taken one at a time straight from the stdio
+ * buffer (IB_GETC), so a stream of numbers costs no line copy and no
+ * extra library call per value.
+ *
+ * @param file  Where to read from.
+ * @param value Receives the value.
+ * @return ',' if more fields follow on the same line, '\n' if this was
+ * the last one, or EOF if the input ended before the field began.
  */
-static void report_error(const char* message)
+static int read_input_field(FILE* file, Value* value)
 {
-    printf("\a"); /* Sound the alert bell */
-    printf("ERROR: %s\n", message);
-    fflush(stdout);
+    int c = IB_GETC(file);
+    long number = 0;
+    int is_negative = 0;
+    int is_overflow = 0;
 
-    if (is_running)
+    if (c == EOF)
     {
-        if (is_debug_mode)
+        return EOF;
+    }
+
+    /* 1. Leading spaces, and the sign */
+    while (c != '\n' && isspace(c))
+    {
+        c = IB_GETC(file);
+    }
+    if (c == '-' || c == '+')
+    {
+        is_negative = (c == '-');
+        c = IB_GETC(file);
+    }
+
+    /* 2. The digits (saturating, as `strtol` does) */
+    while (c >= '0' && c <= '9')
+    {
+        if (number > (LONG_MAX - (c - '0')) / 10)
+        {
+            is_overflow = 1;
+        }
+        else
         {
-            printf("[DEBUG] Halting program due to error.\n");
+            number = number * 10 + (c - '0');
         }
-        is_running = 0; /* Stop the program */
+        c = IB_GETC(file);
+    }
+    if (is_overflow)
+    {
+        *value = (Value)(is_negative ? LONG_MIN : LONG_MAX);
+    }
+    else
+    {
+        *value = (Value)(is_negative ? -number : number);
+    }
+
+    /* 3. The rest of the field */
+    while (c != ',' && c != '\n' && c != EOF)
+    {
+        c = IB_GETC(file);
     }
+    return (c == ',') ? ',' : '\n';
 }
 
 /**
@@ -1898,10 +8222,36 @@ static void report_error(const char* message)
  */
 void skip_whitespace(void)
 {
-    if (parser_ptr == NULL) return;  /* Prevent accidental crash */
+    if (ctx->parser_ptr == NULL) return;  /* Prevent accidental crash */
+
+    while (*ctx->parser_ptr == ' ' || *ctx->parser_ptr == '\t')
+        ctx->parser_ptr++;
+}
+
+/**
+ * @brief format_line_number
+ * Writes a line number (0 to 65535) in decimal at `out`, with no
+ * '\0', for `write_program_text`: a hand-written replacement for
+ * "%d", which has no format string to parse.
+ *
+ * @return The position just after the last digit.
+ */
+static char* format_line_number(char* out, unsigned int line_number)
+{
+    char digits[5]; /* 65535 has 5 digits */
+    int count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + line_number % 10);
+        line_number /= 10;
+    } while (line_number != 0 && count < 5);
 
-    while (*parser_ptr == ' ' || *parser_ptr == '\t')
-        parser_ptr++;
+    while (count > 0)
+    {
+        *out++ = digits[--count];
+    }
+    return out;
 }
 
 /**
@@ -1940,3 +8290,4 @@ static int ib_stricmp(const char* s1, const char* s2)
     }
     return -1; /* Mismatch (e.g., "THENOR") */
 }
+
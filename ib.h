@@ -0,0 +1,70 @@
+/*
+ * =============================================================================
+ * FILENAME:    ib.h
+ * VERSION:     5.0
+ * DESCRIPTION: BASIC++ (IB) Interpreter - Library Interface
+ *
+ * The API of the library build of ib.c, for programs that embed the
+ * interpreter (README Section 2.7):
+ *
+ * gcc -Wall -O2 -c -DIB_LIBRARY ib.c
+ * gcc -Wall -O2 -o host host.c ib.o
+ *
+ * Each IB_Context is a complete, independent interpreter: its own
+ * program, variables, GOSUB stack and LPRINT file. Any number of them
+ * can exist at once, and different threads may run different contexts
+ * at the same time. A single context must only be used by one thread
+ * at a time.
+ *
+ * The one rule: the first call to ib_create (which builds the keyword
+ * index and the jump table every context shares) must return before
+ * any other thread calls ib_create.
+ * =============================================================================
+ */
+
+#ifndef IB_H
+#define IB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief IB_Context
+ * One interpreter. Its contents are private to ib.c.
+ */
+typedef struct IB_Context IB_Context;
+
+/**
+ * @brief ib_create
+ * Creates an interpreter with an empty program and the default sizes.
+ * @return The new context, or NULL if there is not enough memory.
+ */
+IB_Context* ib_create(void);
+
+/**
+ * @brief ib_load_string
+ * Replaces the program with the numbered lines in `source`
+ * ("10 PRINT 1\n20 END\n"), as LOAD would read them from a file.
+ * @return 1 if every line was stored, 0 if any was refused.
+ */
+int ib_load_string(IB_Context* context, const char* source);
+
+/**
+ * @brief ib_run
+ * Runs the program. PRINT output goes to stdout.
+ * @return 0 if it ended normally, 1 if an error stopped it.
+ */
+int ib_run(IB_Context* context);
+
+/**
+ * @brief ib_destroy
+ * Closes the context's LPRINT file and frees its memory.
+ */
+void ib_destroy(IB_Context* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IB_H */